@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file corun.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief cache sensitive work interleaved with large writes.
+ *
+ * Each round writes a large buffer to /dev/null and then chases pointers
+ * once through a working set that fits in the last level cache. With
+ * clean_write.so the write scrubs the buffer, through the cache with
+ * CLEAN_SCRUB_NT_MIN=0 and with non-temporal stores above
+ * CLEAN_SCRUB_NT_MIN otherwise: the pass over the working set after the
+ * write shows how much of it the scrub evicted. The buffer is only
+ * filled once so that the scrub is the only other memory traffic. A
+ * single thread is used so that the result does not depend on the number
+ * of CPUs.
+ *
+ * Usage: [LD_PRELOAD=...] bench/corun [size [working_set [rounds]]]
+ * (default 32 MiB writes, 4 MiB working set, 100 rounds)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINE_SIZE	64
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, unsigned long *ns, int rounds)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		total += ns[i];
+	}
+
+	qsort(ns, rounds, sizeof(*ns), compare);
+
+	printf("  %-6s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", name,
+	       total / 1000.0 / rounds, ns[rounds / 2] / 1000.0,
+	       ns[(rounds * 99) / 100] / 1000.0);
+}
+
+/**
+ * Link the cache lines of the working set in a random cycle so that
+ * every step is a dependent load the prefetcher cannot guess.
+ */
+static void **chase_setup(size_t size)
+{
+	size_t lines = size / LINE_SIZE;
+	size_t *order;
+	char *set;
+	size_t i;
+
+	set = aligned_alloc(LINE_SIZE, lines * LINE_SIZE);
+	order = malloc(lines * sizeof(*order));
+	if (!set || !order) {
+		return NULL;
+	}
+
+	for (i = 0; i < lines; i++) {
+		order[i] = i;
+	}
+	srand(1);
+	for (i = lines - 1; i > 0; i--) {
+		size_t j = (size_t)rand() % (i + 1);
+		size_t tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0; i < lines; i++) {
+		*(void **)(set + order[i] * LINE_SIZE) =
+		    set + order[(i + 1) % lines] * LINE_SIZE;
+	}
+	free(order);
+
+	return (void **)set;
+}
+
+/**
+ * One pass over the working set.
+ */
+static void **chase(void **p, size_t steps)
+{
+	while (steps--) {
+		p = *p;
+	}
+
+	return p;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 32 << 20;
+	size_t set_size = (argc > 2) ? strtoul(argv[2], NULL, 0) : 4 << 20;
+	int rounds = (argc > 3) ? atoi(argv[3]) : 100;
+	const char *preload = getenv("LD_PRELOAD");
+	const char *nt_min = getenv("CLEAN_SCRUB_NT_MIN");
+	unsigned long *write_ns;
+	unsigned long *chase_ns;
+	size_t steps = set_size / LINE_SIZE;
+	void **set;
+	char *buf;
+	int fd;
+	int i;
+
+	if (!size || (steps < 2) || (rounds <= 0)) {
+		fprintf(stderr, "usage: %s [size [working_set [rounds]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	fd = open("/dev/null", O_WRONLY);
+	set = chase_setup(set_size);
+	buf = malloc(size);
+	write_ns = calloc(rounds, sizeof(*write_ns));
+	chase_ns = calloc(rounds, sizeof(*chase_ns));
+	if ((fd < 0) || !set || !buf || !write_ns || !chase_ns) {
+		perror("corun");
+		return 1;
+	}
+
+	memset(buf, 0xa5, size);
+
+	/* warm the working set up */
+	set = chase(set, steps);
+
+	for (i = 0; i < rounds; i++) {
+		unsigned long start;
+
+		start = now_ns();
+		if (write(fd, buf, size) != (ssize_t)size) {
+			perror("corun: write");
+			return 1;
+		}
+		write_ns[i] = now_ns() - start;
+
+		start = now_ns();
+		set = chase(set, steps);
+		chase_ns[i] = now_ns() - start;
+	}
+
+	/* keep the loads from being optimized away */
+	if (!set) {
+		printf("\n");
+	}
+
+	printf("corun: %zu bytes writes, %zu bytes working set, %d rounds, "
+	       "%s%s%s%s\n", size, set_size, rounds,
+	       preload ? "LD_PRELOAD=" : "no preload",
+	       preload ? preload : "",
+	       nt_min ? " CLEAN_SCRUB_NT_MIN=" : "", nt_min ? nt_min : "");
+	report("write", write_ns, rounds);
+	report("chase", chase_ns, rounds);
+
+	close(fd);
+
+	return 0;
+}
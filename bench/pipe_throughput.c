@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file pipe_throughput.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief pipe throughput of write() and vmsplice().
+ *
+ * Each round fills a buffer, gives it to a pipe with write() or
+ * vmsplice() and reads it back from the other end. The buffer starts in
+ * the middle of a page so that vmsplice() has partial pages to bounce
+ * and whole pages to drop with clean_write.so. The fill is not timed,
+ * including the faults on the pages vmsplice() dropped.
+ *
+ * Usage: [LD_PRELOAD=...] bench/pipe_throughput [size [rounds]]
+ * (default 256 KiB, 5000 rounds)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int drain(int fd, char *data, size_t size)
+{
+	size_t got = 0;
+
+	while (got < size) {
+		ssize_t rc = read(fd, data + got, size - got);
+
+		if (rc <= 0) {
+			return -1;
+		}
+		got += rc;
+	}
+
+	return 0;
+}
+
+static int run(const char *name, int splice, int *pipefd, char *buf,
+	       char *data, size_t size, int rounds)
+{
+	unsigned long ns = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		struct iovec iov = { buf, size };
+		unsigned long start;
+		ssize_t rc;
+
+		memset(buf, i, size);
+
+		start = now_ns();
+		if (splice) {
+			rc = vmsplice(pipefd[1], &iov, 1, 0);
+		} else {
+			rc = write(pipefd[1], buf, size);
+		}
+		if ((rc != (ssize_t)size) || drain(pipefd[0], data, size)) {
+			perror("pipe_throughput");
+			return -1;
+		}
+		ns += now_ns() - start;
+	}
+
+	printf("  %-8s %8.1f MB/s  %8.1f us/round\n", name,
+	       (double)size * rounds * 1000.0 / ns, ns / 1000.0 / rounds);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 256 * 1024;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 5000;
+	const char *preload = getenv("LD_PRELOAD");
+	size_t page_size = getpagesize();
+	int pipefd[2];
+	char *area;
+	char *data;
+
+	if (!size || (rounds <= 0)) {
+		fprintf(stderr, "usage: %s [size [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	area = mmap(NULL, size + page_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	data = malloc(size);
+	/* vmsplice() takes a pipe slot per page, the buffer is not aligned */
+	if ((area == MAP_FAILED) || !data || pipe(pipefd) ||
+	    (fcntl(pipefd[1], F_SETPIPE_SZ, 2 * size) < 0)) {
+		perror("pipe_throughput");
+		return 1;
+	}
+
+	printf("pipe_throughput: %zu bytes, %d rounds, %s%s\n", size, rounds,
+	       preload ? "LD_PRELOAD=" : "no preload",
+	       preload ? preload : "");
+
+	if (run("write", 0, pipefd, area + page_size / 2, data, size,
+		rounds) ||
+	    run("vmsplice", 1, pipefd, area + page_size / 2, data, size,
+		rounds)) {
+		return 1;
+	}
+
+	return 0;
+}
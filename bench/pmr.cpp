@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file pmr.cpp
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief cost of the scrubbing C++ resources against the standard ones.
+ *
+ * Each round allocates, fills and frees:
+ * - a block of size bytes from std::allocator and clean::allocator,
+ * - a list of small nodes with each std::pmr resource and its
+ *   scrubbing counterpart (the monotonic resources are released at the
+ *   end of the round).
+ *
+ * Usage: bench/pmr [size [nodes [rounds]]]
+ * (default 64 KiB, 1000 nodes, 2000 rounds)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <list>
+#include <vector>
+#include <memory_resource>
+
+#include "../clean_pmr.hpp"
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned long ns, int rounds)
+{
+	printf("  %-42s %10.1f us/round\n", name, ns / 1000.0 / rounds);
+}
+
+/**
+ * The block is filled with memset(): a vector would construct its
+ * elements one by one with any allocator but std::allocator.
+ */
+template <class Alloc>
+static unsigned long run_alloc(std::size_t size, int rounds)
+{
+	unsigned long start = now_ns();
+	Alloc alloc;
+
+	for (int i = 0; i < rounds; i++) {
+		char *p = alloc.allocate(size);
+
+		memset(p, i, size);
+		/* or the compiler may drop the allocation altogether */
+		__asm__ __volatile__(""::"r"(p):"memory");
+		alloc.deallocate(p, size);
+	}
+
+	return now_ns() - start;
+}
+
+static unsigned long run_list(std::pmr::memory_resource *res, int nodes,
+			      int rounds, void (*release)(void *), void *arg)
+{
+	unsigned long start = now_ns();
+	unsigned long sum = 0;
+
+	for (int i = 0; i < rounds; i++) {
+		{
+			std::pmr::list<long> l(res);
+
+			for (int j = 0; j < nodes; j++) {
+				l.push_back(j);
+			}
+			sum += l.back();
+		}
+		if (release) {
+			release(arg);
+		}
+	}
+
+	if (sum == 1) {
+		printf("\n");
+	}
+
+	return now_ns() - start;
+}
+
+template <class Res>
+static void release_resource(void *res)
+{
+	static_cast<Res *>(res)->release();
+}
+
+int main(int argc, char *argv[])
+{
+	std::size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 64 * 1024;
+	int nodes = (argc > 2) ? atoi(argv[2]) : 1000;
+	int rounds = (argc > 3) ? atoi(argv[3]) : 2000;
+
+	if (!size || (nodes <= 0) || (rounds <= 0)) {
+		fprintf(stderr, "usage: %s [size [nodes [rounds]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	printf("pmr: block of %zu bytes, list of %d nodes, %d rounds\n",
+	       size, nodes, rounds);
+
+	report("block std::allocator",
+	       run_alloc<std::allocator<char>>(size, rounds), rounds);
+	report("block clean::allocator",
+	       run_alloc<clean::allocator<char>>(size, rounds), rounds);
+
+	{
+		clean::scrubbing_resource res;
+
+		report("list new_delete_resource",
+		       run_list(std::pmr::new_delete_resource(), nodes, rounds,
+				NULL, NULL), rounds);
+		report("list clean::scrubbing_resource",
+		       run_list(&res, nodes, rounds, NULL, NULL), rounds);
+	}
+
+	{
+		std::pmr::unsynchronized_pool_resource std_pool;
+		clean::unsynchronized_scrubbing_pool_resource pool;
+
+		report("list unsynchronized_pool_resource",
+		       run_list(&std_pool, nodes, rounds, NULL, NULL), rounds);
+		report("list clean::unsynchronized_scrubbing_pool",
+		       run_list(&pool, nodes, rounds, NULL, NULL), rounds);
+	}
+
+	{
+		std::pmr::synchronized_pool_resource std_pool;
+		clean::scrubbing_pool_resource pool;
+
+		report("list synchronized_pool_resource",
+		       run_list(&std_pool, nodes, rounds, NULL, NULL), rounds);
+		report("list clean::scrubbing_pool_resource",
+		       run_list(&pool, nodes, rounds, NULL, NULL), rounds);
+	}
+
+	{
+		std::pmr::monotonic_buffer_resource std_mono;
+		clean::scrubbing_monotonic_resource mono;
+
+		report("list monotonic_buffer_resource",
+		       run_list(&std_mono, nodes, rounds,
+				release_resource<std::pmr::
+				monotonic_buffer_resource>, &std_mono),
+		       rounds);
+		report("list clean::scrubbing_monotonic_resource",
+		       run_list(&mono, nodes, rounds,
+				release_resource<clean::
+				scrubbing_monotonic_resource>, &mono), rounds);
+	}
+
+	return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file region_lookup.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief cost of the region classifier of clean_write.so.
+ *
+ * The process gets many distinct mappings (writable and read-only pages
+ * in turn), then small buffers are written to /dev/null:
+ * - same: always from the same heap buffer (per-thread cache hit)
+ * - spread: from each writable mapping in turn (binary search)
+ * - rebuild: right after an mprotect(), which makes the table stale
+ * - munmap: right after unmapping a page (the table is updated)
+ *
+ * Usage: [LD_PRELOAD=./clean_write.so] bench/region_lookup [mappings]
+ * (default 1000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define WRITE_SIZE	64
+#define SAME_ROUNDS	200000
+#define SPREAD_ROUNDS	20
+#define STALE_ROUNDS	200
+
+static int fd;
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static void write_or_die(const void *buf)
+{
+	if (write(fd, buf, WRITE_SIZE) != WRITE_SIZE) {
+		perror("region_lookup: write");
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int count = (argc > 1) ? atoi(argv[1]) : 1000;
+	long page = sysconf(_SC_PAGESIZE);
+	const char *preload = getenv("LD_PRELOAD");
+	const char *regions = getenv("CLEAN_WRITE_REGIONS");
+	unsigned long start;
+	unsigned long total;
+	char *area;
+	char *heap;
+	int i;
+	int j;
+
+	if (count <= 0) {
+		fprintf(stderr, "usage: %s [mappings]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open("/dev/null", O_WRONLY);
+	heap = malloc(WRITE_SIZE);
+	area = mmap(NULL, 2 * count * page, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((fd < 0) || !heap || (area == MAP_FAILED)) {
+		perror("region_lookup");
+		return 1;
+	}
+
+	/* every other page read-only: 2 * count mappings */
+	for (i = 0; i < count; i++) {
+		mprotect(area + ((2 * i + 1) * page), page, PROT_READ);
+	}
+	memset(heap, 0xa5, WRITE_SIZE);
+	write_or_die(heap);
+
+	printf("region_lookup: %d mappings, %s%s%s%s\n", 2 * count,
+	       preload ? "LD_PRELOAD=" : "no preload",
+	       preload ? preload : "",
+	       regions ? " CLEAN_WRITE_REGIONS=" : "",
+	       regions ? regions : "");
+
+	start = now_ns();
+	for (i = 0; i < SAME_ROUNDS; i++) {
+		write_or_die(heap);
+	}
+	printf("  same    %8.1f ns per write\n",
+	       (double)(now_ns() - start) / SAME_ROUNDS);
+
+	start = now_ns();
+	for (j = 0; j < SPREAD_ROUNDS; j++) {
+		for (i = 0; i < count; i++) {
+			write_or_die(area + (2 * i * page));
+		}
+	}
+	printf("  spread  %8.1f ns per write\n",
+	       (double)(now_ns() - start) / (SPREAD_ROUNDS * count));
+
+	/* any mprotect() makes the table stale, even a no-op one */
+	total = 0;
+	for (i = 0; i < STALE_ROUNDS; i++) {
+		mprotect(area + ((2 * (i % count) + 1) * page), page, PROT_READ);
+		start = now_ns();
+		write_or_die(heap);
+		total += now_ns() - start;
+	}
+	printf("  rebuild %8.1f us per write\n",
+	       (double)total / STALE_ROUNDS / 1000);
+
+	total = 0;
+	for (i = 0; (i < STALE_ROUNDS) && (i < count); i++) {
+		munmap(area + (2 * i * page), page);
+		start = now_ns();
+		write_or_die(heap);
+		total += now_ns() - start;
+	}
+	printf("  munmap  %8.1f us per write\n",
+	       (double)total / i / 1000);
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file scrub_iov.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief clean_scrub_iov() against a memset() of each iovec.
+ *
+ * 64 iovecs of the same size are scrubbed, either laid out back to back
+ * in one buffer (merged into a single run by clean_scrub_iov()) or each
+ * in its own allocation. The buffers are dirtied before each round.
+ *
+ * Usage: bench/scrub_iov [segment [rounds]]
+ * (default 16, 64, 512 and 4096 bytes, 20000 rounds)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../clean_scrub.h"
+
+#define IOVCNT	64
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, unsigned long *ns, int rounds)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		total += ns[i];
+	}
+
+	qsort(ns, rounds, sizeof(*ns), compare);
+
+	printf("    %-10s mean %8.1f ns  p50 %8lu ns  p99 %8lu ns\n", name,
+	       (double)total / rounds, ns[rounds / 2],
+	       ns[(rounds * 99) / 100]);
+}
+
+static void dirty(struct iovec *iov)
+{
+	int i;
+
+	for (i = 0; i < IOVCNT; i++) {
+		memset(iov[i].iov_base, 0xa5, iov[i].iov_len);
+	}
+}
+
+static void run(const char *layout, struct iovec *iov, size_t segment,
+		int rounds, unsigned long *ns)
+{
+	size_t total = segment * IOVCNT;
+	unsigned long start;
+	int i;
+	int j;
+
+	printf("  %s, %d x %zu bytes\n", layout, IOVCNT, segment);
+
+	for (i = 0; i < rounds; i++) {
+		dirty(iov);
+		start = now_ns();
+		clean_scrub_iov(iov, IOVCNT, total);
+		ns[i] = now_ns() - start;
+	}
+	report("scrub_iov", ns, rounds);
+
+	for (i = 0; i < rounds; i++) {
+		dirty(iov);
+		start = now_ns();
+		for (j = 0; j < IOVCNT; j++) {
+			memset(iov[j].iov_base, 0, iov[j].iov_len);
+		}
+		/* or the compiler may drop the stores */
+		__asm__ __volatile__(""::"r"(iov):"memory");
+		ns[i] = now_ns() - start;
+	}
+	report("memset", ns, rounds);
+}
+
+static int bench(size_t segment, int rounds, unsigned long *ns)
+{
+	struct iovec iov[IOVCNT];
+	char *buf = malloc(segment * IOVCNT);
+	int i;
+
+	if (!buf) {
+		return -1;
+	}
+
+	for (i = 0; i < IOVCNT; i++) {
+		iov[i].iov_base = buf + (i * segment);
+		iov[i].iov_len = segment;
+	}
+	run("contiguous", iov, segment, rounds, ns);
+	free(buf);
+
+	for (i = 0; i < IOVCNT; i++) {
+		iov[i].iov_base = malloc(segment);
+		iov[i].iov_len = segment;
+		if (!iov[i].iov_base) {
+			return -1;
+		}
+	}
+	run("scattered", iov, segment, rounds, ns);
+	for (i = 0; i < IOVCNT; i++) {
+		free(iov[i].iov_base);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t segments[] = { 16, 64, 512, 4096 };
+	size_t segment = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 20000;
+	unsigned long *ns;
+	size_t i;
+
+	if (rounds <= 0) {
+		fprintf(stderr, "usage: %s [segment [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	ns = calloc(rounds, sizeof(*ns));
+	if (!ns) {
+		perror("scrub_iov");
+		return 1;
+	}
+
+	clean_scrub_init();
+
+	printf("scrub_iov: %d rounds\n", rounds);
+	for (i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+		if (segment) {
+			segments[i] = segment;
+		}
+		if (bench(segments[i], rounds, ns)) {
+			perror("scrub_iov");
+			return 1;
+		}
+		if (segment) {
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file send_free.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief free() of a block just sent, marked clean or not.
+ *
+ * Each round allocates a block, fills it, writes it to /dev/null and
+ * frees it. With clean.so the write scrubs the block and marks it clean,
+ * so free() only reads it. In the second pass one byte is stored at the
+ * start of the block after the write: free() then finds no clean prefix
+ * and scrubs the whole block again, as it did before blocks were marked.
+ * The library is built with -O0 by default; build it with CFLAGS=-O2 for
+ * numbers that mean something.
+ *
+ * Usage: LD_PRELOAD=./clean.so bench/send_free [size [rounds]]
+ * (default 1 MiB, 2000 rounds)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, unsigned long *ns, int rounds,
+		   size_t size)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		total += ns[i];
+	}
+
+	qsort(ns, rounds, sizeof(*ns), compare);
+
+	printf("  %-12s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  "
+	       "%8.1f MB/s\n", name, total / 1000.0 / rounds,
+	       ns[rounds / 2] / 1000.0, ns[(rounds * 99) / 100] / 1000.0,
+	       (double)size * rounds * 1000.0 / total);
+}
+
+static int run(int fd, size_t size, int rounds, int dirty,
+	       unsigned long *free_ns)
+{
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		char *buf = malloc(size);
+		unsigned long start;
+
+		if (!buf) {
+			return -1;
+		}
+		memset(buf, 0xa5, size);
+
+		if (write(fd, buf, size) != (ssize_t)size) {
+			return -1;
+		}
+		if (dirty) {
+			buf[0] = 1;
+		}
+
+		start = now_ns();
+		free(buf);
+		free_ns[i] = now_ns() - start;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024 * 1024;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 2000;
+	const char *preload = getenv("LD_PRELOAD");
+	unsigned long *free_ns;
+	int fd;
+
+	if (!size || (rounds <= 0)) {
+		fprintf(stderr, "usage: %s [size [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open("/dev/null", O_WRONLY);
+	free_ns = calloc(rounds, sizeof(*free_ns));
+	if ((fd < 0) || !free_ns) {
+		perror("send_free");
+		return 1;
+	}
+
+	printf("send_free: %zu bytes, %d rounds, %s%s\n", size, rounds,
+	       preload ? "LD_PRELOAD=" : "no preload",
+	       preload ? preload : "");
+
+	if (run(fd, size, rounds, 0, free_ns)) {
+		perror("send_free");
+		return 1;
+	}
+	report("free clean", free_ns, rounds, size);
+
+	if (run(fd, size, rounds, 1, free_ns)) {
+		perror("send_free");
+		return 1;
+	}
+	report("free dirtied", free_ns, rounds, size);
+
+	close(fd);
+
+	return 0;
+}
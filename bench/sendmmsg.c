@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file sendmmsg.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief one sendmmsg() against a loop of sendmsg() for a batch.
+ *
+ * Each round sends a batch of UDP datagrams to a loopback port nobody
+ * listens on, either with a single sendmmsg() or one sendmsg() per
+ * datagram. Each datagram is a small header and a payload in separate
+ * iovecs, refilled before each round as they are scrubbed when
+ * clean_write.so is preloaded.
+ *
+ * Usage: [LD_PRELOAD=...] bench/sendmmsg [payload [batch [rounds]]]
+ * (default 1024 bytes, 32 datagrams, 20000 rounds)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define HEADER_SIZE	16
+#define DISCARD_PORT	9
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, unsigned long *ns, int rounds)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		total += ns[i];
+	}
+
+	qsort(ns, rounds, sizeof(*ns), compare);
+
+	printf("  %-8s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", name,
+	       total / 1000.0 / rounds, ns[rounds / 2] / 1000.0,
+	       ns[(rounds * 99) / 100] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t payload = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024;
+	int batch = (argc > 2) ? atoi(argv[2]) : 32;
+	int rounds = (argc > 3) ? atoi(argv[3]) : 20000;
+	const char *preload = getenv("LD_PRELOAD");
+	struct sockaddr_in addr;
+	struct mmsghdr *msgvec;
+	struct iovec *iov;
+	unsigned long *ns;
+	char *buf;
+	int fd;
+	int i;
+	int j;
+
+	if (!payload || (batch <= 0) || (rounds <= 0)) {
+		fprintf(stderr, "usage: %s [payload [batch [rounds]]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(DISCARD_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	msgvec = calloc(batch, sizeof(*msgvec));
+	iov = calloc(2 * batch, sizeof(*iov));
+	buf = malloc(batch * (HEADER_SIZE + payload));
+	ns = calloc(rounds, sizeof(*ns));
+	if ((fd < 0) || !msgvec || !iov || !buf || !ns) {
+		perror("sendmmsg");
+		return 1;
+	}
+
+	for (i = 0; i < batch; i++) {
+		char *datagram = buf + (i * (HEADER_SIZE + payload));
+
+		iov[2 * i].iov_base = datagram;
+		iov[2 * i].iov_len = HEADER_SIZE;
+		iov[2 * i + 1].iov_base = datagram + HEADER_SIZE;
+		iov[2 * i + 1].iov_len = payload;
+		msgvec[i].msg_hdr.msg_name = &addr;
+		msgvec[i].msg_hdr.msg_namelen = sizeof(addr);
+		msgvec[i].msg_hdr.msg_iov = &iov[2 * i];
+		msgvec[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	printf("sendmmsg: %d datagrams of %zu bytes, %d rounds, %s%s\n",
+	       batch, HEADER_SIZE + payload, rounds,
+	       preload ? "LD_PRELOAD=" : "no preload",
+	       preload ? preload : "");
+
+	for (i = 0; i < rounds; i++) {
+		unsigned long start;
+
+		memset(buf, 0xa5, batch * (HEADER_SIZE + payload));
+		start = now_ns();
+		if (sendmmsg(fd, msgvec, batch, 0) != batch) {
+			perror("sendmmsg: sendmmsg");
+			return 1;
+		}
+		ns[i] = now_ns() - start;
+	}
+	report("sendmmsg", ns, rounds);
+
+	for (i = 0; i < rounds; i++) {
+		unsigned long start;
+
+		memset(buf, 0xa5, batch * (HEADER_SIZE + payload));
+		start = now_ns();
+		for (j = 0; j < batch; j++) {
+			if (sendmsg(fd, &msgvec[j].msg_hdr, 0) < 0) {
+				perror("sendmmsg: sendmsg");
+				return 1;
+			}
+		}
+		ns[i] = now_ns() - start;
+	}
+	report("sendmsg", ns, rounds);
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file uring_depth.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief io_uring writes tracked by clean_uring against pwrite().
+ *
+ * The same buffers are written to a temporary file, either with one
+ * pwrite() each (scrubbed on return by clean_write.so) or submitted to
+ * an io_uring queue depth at a time, tracked with clean_uring_track()
+ * and scrubbed in one batch once the completions have been reaped. The
+ * ring is driven with the raw system calls, liburing is not needed. The
+ * buffers are refilled before each round, out of the timing.
+ *
+ * Usage: bench/uring_depth [size [total]]
+ * (linked with clean_write.so, default 16 KiB writes, 64 MiB per depth)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "../clean_uring.h"
+
+#define MAX_DEPTH	256
+
+struct ring {
+	int fd;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int ring_setup(struct ring *ring, unsigned int entries)
+{
+	struct io_uring_params p;
+	char *sq;
+	char *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	sq = mmap(NULL, p.sq_off.array + p.sq_entries * sizeof(unsigned int),
+		  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		  IORING_OFF_SQ_RING);
+	cq = mmap(NULL, p.cq_off.cqes +
+		  p.cq_entries * sizeof(struct io_uring_cqe),
+		  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		  IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  ring->fd, IORING_OFF_SQES);
+	if ((sq == MAP_FAILED) || (cq == MAP_FAILED) ||
+	    (ring->sqes == MAP_FAILED)) {
+		return -1;
+	}
+
+	ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+static void ring_write(struct ring *ring, int fd, void *buf, size_t len,
+		       off_t offset, uint64_t user_data)
+{
+	unsigned int tail = *ring->sq_tail;
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submit the queued requests, wait for all of them and reap them.
+ */
+static int ring_run(struct ring *ring, struct clean_uring *cu,
+		    unsigned int count)
+{
+	unsigned int head = *ring->cq_head;
+	unsigned int done = 0;
+
+	if (syscall(__NR_io_uring_enter, ring->fd, count, count,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+		return -1;
+	}
+
+	while (done < count) {
+		unsigned int tail = __atomic_load_n(ring->cq_tail,
+						    __ATOMIC_ACQUIRE);
+
+		for (; head != tail; head++, done++) {
+			struct io_uring_cqe *cqe =
+			    &ring->cqes[head & *ring->cq_mask];
+
+			if (cqe->res < 0) {
+				return -1;
+			}
+			clean_uring_complete(cu, cqe->user_data, cqe->res,
+					     cqe->flags);
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	clean_uring_scrub(cu);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 16 * 1024;
+	size_t total = (argc > 2) ? strtoul(argv[2], NULL, 0) : 64 << 20;
+	unsigned int depths[] = { 1, 8, 32, 128 };
+	char name[] = "/tmp/uring_depthXXXXXX";
+	struct clean_uring *cu;
+	struct ring ring;
+	char *bufs[MAX_DEPTH];
+	unsigned int d;
+	int fd;
+
+	if (!size || (total < size)) {
+		fprintf(stderr, "usage: %s [size [total]]\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp(name);
+	cu = clean_uring_create(MAX_DEPTH);
+	if ((fd < 0) || !cu) {
+		perror("uring_depth");
+		return 1;
+	}
+	unlink(name);
+
+	if (ring_setup(&ring, MAX_DEPTH)) {
+		printf("uring_depth: skipped, no io_uring\n");
+		return 0;
+	}
+
+	for (d = 0; d < MAX_DEPTH; d++) {
+		bufs[d] = malloc(size);
+		if (!bufs[d]) {
+			perror("uring_depth");
+			return 1;
+		}
+	}
+
+	printf("uring_depth: %zu bytes writes, %zu bytes per depth\n", size,
+	       total);
+
+	for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+		unsigned int depth = depths[d];
+		size_t rounds = total / (size * depth);
+		unsigned long sync_ns = 0;
+		unsigned long ring_ns = 0;
+		unsigned long start;
+		unsigned int i;
+		size_t r;
+
+		if (!rounds) {
+			break;
+		}
+
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < depth; i++) {
+				memset(bufs[i], 0xa5, size);
+			}
+			start = now_ns();
+			for (i = 0; i < depth; i++) {
+				if (pwrite(fd, bufs[i], size, i * size) !=
+				    (ssize_t)size) {
+					perror("uring_depth: pwrite");
+					return 1;
+				}
+			}
+			sync_ns += now_ns() - start;
+
+			for (i = 0; i < depth; i++) {
+				memset(bufs[i], 0xa5, size);
+			}
+			start = now_ns();
+			for (i = 0; i < depth; i++) {
+				ring_write(&ring, fd, bufs[i], size, i * size,
+					   i);
+				clean_uring_track(cu, i, fd, bufs[i], size);
+			}
+			if (ring_run(&ring, cu, depth)) {
+				perror("uring_depth: io_uring");
+				return 1;
+			}
+			ring_ns += now_ns() - start;
+		}
+
+		printf("  depth %3u  pwrite %8.1f MB/s  io_uring %8.1f MB/s\n",
+		       depth, (double)size * depth * rounds * 1000.0 / sync_ns,
+		       (double)size * depth * rounds * 1000.0 / ring_ns);
+	}
+
+	clean_uring_destroy(cu);
+	close(fd);
+
+	return 0;
+}
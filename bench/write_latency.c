@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file write_latency.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief latency of write() and free() of large malloc'd buffers.
+ *
+ * Each round allocates a buffer, fills it, writes it to /dev/null and
+ * frees it. The write() and free() calls are timed separately: with
+ * clean_write.so the scrub is paid by write(), in the deferred mode of
+ * clean.so it moves to the helper thread.
+ *
+ * Usage: [LD_PRELOAD=...] bench/write_latency [size [rounds]]
+ * (default 1 MiB, 2000 rounds)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, unsigned long *ns, int rounds)
+{
+	unsigned long total = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		total += ns[i];
+	}
+
+	qsort(ns, rounds, sizeof(*ns), compare);
+
+	printf("  %-6s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", name,
+	       total / 1000.0 / rounds, ns[rounds / 2] / 1000.0,
+	       ns[(rounds * 99) / 100] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1024 * 1024;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 2000;
+	unsigned long *write_ns;
+	unsigned long *free_ns;
+	const char *preload = getenv("LD_PRELOAD");
+	int fd;
+	int i;
+
+	if (!size || (rounds <= 0)) {
+		fprintf(stderr, "usage: %s [size [rounds]]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open("/dev/null", O_WRONLY);
+	write_ns = calloc(rounds, sizeof(*write_ns));
+	free_ns = calloc(rounds, sizeof(*free_ns));
+	if ((fd < 0) || !write_ns || !free_ns) {
+		perror("write_latency");
+		return 1;
+	}
+
+	for (i = 0; i < rounds; i++) {
+		char *buf = malloc(size);
+		unsigned long start;
+
+		if (!buf) {
+			perror("write_latency: malloc");
+			return 1;
+		}
+		memset(buf, 0xa5, size);
+
+		start = now_ns();
+		if (write(fd, buf, size) != (ssize_t)size) {
+			perror("write_latency: write");
+			return 1;
+		}
+		write_ns[i] = now_ns() - start;
+
+		start = now_ns();
+		free(buf);
+		free_ns[i] = now_ns() - start;
+	}
+
+	printf("write_latency: %zu bytes, %d rounds, %s%s%s\n", size, rounds,
+	       preload ? "LD_PRELOAD=" : "no preload",
+	       preload ? preload : "",
+	       getenv("CLEAN_WRITE_DEFERRED") ? " (deferred)" : "");
+	report("write", write_ns, rounds);
+	report("free", free_ns, rounds);
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_arena.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief arena (region) allocator with a single scrub on reset/destroy.
+ *
+ * Request scoped memory is bump allocated from large chunks obtained
+ * with mmap(). Nothing is freed individually: the used part of each
+ * chunk is scrubbed in one pass when the arena is reset or destroyed.
+ * Chunks of destroyed arenas are kept (already scrubbed) in a process
+ * wide cache so new arenas reuse pages that are already faulted in.
+ *
+ * The chunks do not come from malloc() so this file does not depend
+ * on the malloc interposition.
+ *
+ * Changes:
+ *
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "clean_malloc.h"
+#include "clean_scrub.h"
+
+#define ARENA_DEFAULT_CHUNK_SIZE	(1024 * 1024)
+#define ARENA_ALIGN			16
+#define ARENA_CACHE_MAX_SIZE		(64 * 1024 * 1024)
+
+#define ALIGN_UP(x, a)	(((x) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;		/* size of the mapping */
+	size_t start;		/* offset of the first allocatable byte */
+	size_t used;		/* offset of the first free byte */
+};
+
+struct clean_arena {
+	struct arena_chunk *first;
+	struct arena_chunk *current;
+	size_t chunk_size;
+	unsigned int flags;
+};
+
+#define CHUNK_HEADER_SIZE	ALIGN_UP(sizeof(struct arena_chunk), ARENA_ALIGN)
+#define ARENA_HEADER_SIZE	ALIGN_UP(sizeof(struct clean_arena), ARENA_ALIGN)
+
+/*
+ * Cache of scrubbed chunks given back by destroyed arenas.
+ */
+static pthread_mutex_t chunk_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct arena_chunk *chunk_cache;
+static size_t chunk_cache_size;
+
+/**
+ * Get a chunk of at least size bytes, from the cache if possible or
+ * from the system otherwise. The chunk content is all 0.
+ */
+static struct arena_chunk *arena_chunk_get(size_t size)
+{
+	struct arena_chunk *chunk;
+	struct arena_chunk **prev;
+
+	pthread_mutex_lock(&chunk_cache_lock);
+	for (prev = &chunk_cache; *prev; prev = &(*prev)->next) {
+		if ((*prev)->size >= size) {
+			chunk = *prev;
+			*prev = chunk->next;
+			chunk_cache_size -= chunk->size;
+			pthread_mutex_unlock(&chunk_cache_lock);
+
+			chunk->next = NULL;
+			chunk->start = CHUNK_HEADER_SIZE;
+			chunk->used = CHUNK_HEADER_SIZE;
+			return chunk;
+		}
+	}
+	pthread_mutex_unlock(&chunk_cache_lock);
+
+	chunk = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk == MAP_FAILED) {
+		return NULL;
+	}
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->start = CHUNK_HEADER_SIZE;
+	chunk->used = CHUNK_HEADER_SIZE;
+
+	return chunk;
+}
+
+/**
+ * Give a scrubbed chunk back to the cache, or to the system if the
+ * cache is full.
+ */
+static void arena_chunk_put(struct arena_chunk *chunk)
+{
+	pthread_mutex_lock(&chunk_cache_lock);
+	if ((chunk_cache_size + chunk->size) <= ARENA_CACHE_MAX_SIZE) {
+		chunk->next = chunk_cache;
+		chunk_cache = chunk;
+		chunk_cache_size += chunk->size;
+		chunk = NULL;
+	}
+	pthread_mutex_unlock(&chunk_cache_lock);
+
+	if (chunk) {
+		munmap(chunk, chunk->size);
+	}
+}
+
+/**
+ * Scrub the used part of a chunk.
+ * With CLEAN_ARENA_DONTNEED the whole pages are dropped with madvise()
+ * and only the partial page in front of them is written. A large used
+ * part is written around the cache, so a reset does not evict the
+ * working set of the application.
+ */
+static void arena_chunk_scrub(struct arena_chunk *chunk, unsigned int flags)
+{
+	char *from = (char *)chunk + chunk->start;
+	char *to = (char *)chunk + chunk->used;
+
+	if (flags & CLEAN_ARENA_DONTNEED) {
+		size_t page_size = getpagesize();
+		char *page = (char *)ALIGN_UP((uintptr_t) from, page_size);
+
+		if ((page < to) &&
+		    !madvise(page, ALIGN_UP((uintptr_t) to, page_size) -
+			     (uintptr_t) page, MADV_DONTNEED)) {
+			to = page;
+		}
+	}
+
+	clean_scrub_nt(from, to - from);
+	chunk->used = chunk->start;
+}
+
+struct clean_arena *clean_arena_create(size_t chunk_size, unsigned int flags)
+{
+	struct arena_chunk *chunk;
+	struct clean_arena *arena;
+
+	if (!chunk_size) {
+		chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+	}
+
+	if (chunk_size > (SIZE_MAX / 2)) {
+		return NULL;
+	}
+
+	chunk_size = ALIGN_UP(chunk_size + CHUNK_HEADER_SIZE +
+			      ARENA_HEADER_SIZE, getpagesize());
+
+	chunk = arena_chunk_get(chunk_size);
+	if (!chunk) {
+		return NULL;
+	}
+
+	/* The arena itself lives at the start of its first chunk */
+	arena = (struct clean_arena *)((char *)chunk + chunk->start);
+	chunk->start += ARENA_HEADER_SIZE;
+	chunk->used = chunk->start;
+
+	arena->first = chunk;
+	arena->current = chunk;
+	arena->chunk_size = chunk_size;
+	arena->flags = flags;
+
+	return arena;
+}
+
+void *clean_arena_memalign(struct clean_arena *arena, size_t alignment,
+			   size_t size)
+{
+	struct arena_chunk *chunk;
+	uintptr_t ptr;
+
+	if (!arena || (size > (SIZE_MAX / 2)) || (alignment > (SIZE_MAX / 4))
+	    || (alignment & (alignment - 1))) {
+		return NULL;
+	}
+
+	if (alignment < ARENA_ALIGN) {
+		alignment = ARENA_ALIGN;
+	}
+
+	size = ALIGN_UP(size ? size : 1, ARENA_ALIGN);
+
+	for (chunk = arena->current; chunk; chunk = chunk->next) {
+		ptr = ALIGN_UP((uintptr_t) chunk + chunk->used, alignment);
+		if ((ptr + size) <= ((uintptr_t) chunk + chunk->size)) {
+			break;
+		}
+	}
+
+	if (!chunk) {
+		size_t chunk_size = arena->chunk_size;
+		size_t needed = size + CHUNK_HEADER_SIZE + alignment;
+
+		if (needed > chunk_size) {
+			chunk_size = ALIGN_UP(needed, getpagesize());
+		}
+
+		chunk = arena_chunk_get(chunk_size);
+		if (!chunk) {
+			return NULL;
+		}
+
+		/* Chunks after current are free, insert right after it */
+		chunk->next = arena->current->next;
+		arena->current->next = chunk;
+
+		ptr = ALIGN_UP((uintptr_t) chunk + chunk->used, alignment);
+	}
+
+	arena->current = chunk;
+	chunk->used = (ptr + size) - (uintptr_t) chunk;
+
+	return (void *)ptr;
+}
+
+void *clean_arena_alloc(struct clean_arena *arena, size_t size)
+{
+	return clean_arena_memalign(arena, ARENA_ALIGN, size);
+}
+
+void clean_arena_reset(struct clean_arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	if (!arena) {
+		return;
+	}
+
+	for (chunk = arena->first; chunk; chunk = chunk->next) {
+		if (chunk->used != chunk->start) {
+			arena_chunk_scrub(chunk, arena->flags);
+		}
+	}
+
+	arena->current = arena->first;
+}
+
+void clean_arena_destroy(struct clean_arena *arena)
+{
+	struct arena_chunk *chunk;
+	struct arena_chunk *next;
+
+	if (!arena) {
+		return;
+	}
+
+	clean_arena_reset(arena);
+
+	chunk = arena->first;
+
+	/* Forget the arena header held by the first chunk */
+	clean_scrub(arena, ARENA_HEADER_SIZE);
+	chunk->start = CHUNK_HEADER_SIZE;
+	chunk->used = CHUNK_HEADER_SIZE;
+
+	for (; chunk; chunk = next) {
+		next = chunk->next;
+		arena_chunk_put(chunk);
+	}
+}
@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_bg.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief helper thread shared by the interposing libraries.
+ *
+ * Changes:
+ *
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include "clean_bg.h"
+
+struct bg_job {
+	void (*fn) (void);
+	size_t period_ms;
+	unsigned long next;	/* ms */
+	int woken;
+};
+
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t bg_once = PTHREAD_ONCE_INIT;
+static pthread_cond_t bg_cond;
+static struct bg_job bg_jobs[CLEAN_BG_MAX_JOBS];
+static int bg_count;
+static int bg_running;
+
+/* the condition variable waits on the monotonic clock (see bg_init) */
+static unsigned long bg_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000UL) + (ts.tv_nsec / 1000000);
+}
+
+/**
+ * Collect the jobs to run now in due and return their number, or set
+ * next to the time the first job is due. Called with bg_lock held.
+ */
+static int bg_due(void (**due) (void), unsigned long *next)
+{
+	unsigned long now = bg_now_ms();
+	int count = 0;
+	int i;
+
+	*next = now + 1000;
+
+	for (i = 0; i < bg_count; i++) {
+		struct bg_job *job = &bg_jobs[i];
+
+		if (__atomic_exchange_n(&job->woken, 0, __ATOMIC_ACQ_REL) ||
+		    (now >= job->next)) {
+			job->next = now + job->period_ms;
+			due[count++] = job->fn;
+		} else if (job->next < *next) {
+			*next = job->next;
+		}
+	}
+
+	return count;
+}
+
+static void *bg_thread(void *arg)
+{
+	void (*due[CLEAN_BG_MAX_JOBS]) (void);
+	unsigned long next;
+	struct timespec ts;
+	int count;
+	int i;
+
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&bg_lock);
+		while (!(count = bg_due(due, &next))) {
+			ts.tv_sec = next / 1000;
+			ts.tv_nsec = (next % 1000) * 1000000;
+			pthread_cond_timedwait(&bg_cond, &bg_lock, &ts);
+		}
+		pthread_mutex_unlock(&bg_lock);
+
+		for (i = 0; i < count; i++) {
+			due[i] ();
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Take the lock around fork() so that the child does not inherit it
+ * held by the helper thread, which does not exist in the child.
+ */
+static void bg_fork_prepare(void)
+{
+	pthread_mutex_lock(&bg_lock);
+}
+
+static void bg_fork_parent(void)
+{
+	pthread_mutex_unlock(&bg_lock);
+}
+
+static void bg_fork_child(void)
+{
+	pthread_mutex_unlock(&bg_lock);
+	bg_running = 0;
+}
+
+/**
+ * The deadlines must not move when the wall clock is set.
+ */
+static void bg_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&bg_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/**
+ * The thread does not take any signal from the application.
+ */
+void clean_bg_start(void)
+{
+	pthread_t thread;
+	sigset_t all;
+	sigset_t old;
+
+	pthread_once(&bg_once, bg_init);
+
+	if (__atomic_load_n(&bg_running, __ATOMIC_ACQUIRE) ||
+	    __atomic_exchange_n(&bg_running, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&thread, NULL, bg_thread, NULL)) {
+		debug("failed to start the helper thread\n");
+		__atomic_store_n(&bg_running, 0, __ATOMIC_RELEASE);
+	} else {
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+int clean_bg_add(void (*job) (void), size_t period_ms)
+{
+	static int atfork_done;
+	int id = -1;
+
+	pthread_once(&bg_once, bg_init);
+
+	pthread_mutex_lock(&bg_lock);
+	if (!atfork_done) {
+		atfork_done = !pthread_atfork(bg_fork_prepare, bg_fork_parent,
+					      bg_fork_child);
+	}
+	if (atfork_done && (bg_count < CLEAN_BG_MAX_JOBS)) {
+		id = bg_count++;
+		bg_jobs[id].fn = job;
+		bg_jobs[id].period_ms = period_ms ? period_ms : 1;
+		bg_jobs[id].next = bg_now_ms() + bg_jobs[id].period_ms;
+		bg_jobs[id].woken = 0;
+		/* the thread may be waiting for a later deadline */
+		pthread_cond_signal(&bg_cond);
+	}
+	pthread_mutex_unlock(&bg_lock);
+
+	if (id < 0) {
+		debug("no room for a helper job\n");
+		return -1;
+	}
+
+	clean_bg_start();
+
+	return id;
+}
+
+/**
+ * This does not wait, it may be called from a signal handler. When the
+ * lock is busy the job runs at its next period instead.
+ */
+void clean_bg_wake(int id)
+{
+	if ((id < 0) || (id >= CLEAN_BG_MAX_JOBS)) {
+		return;
+	}
+
+	__atomic_store_n(&bg_jobs[id].woken, 1, __ATOMIC_RELEASE);
+
+	if (!pthread_mutex_trylock(&bg_lock)) {
+		pthread_cond_signal(&bg_cond);
+		pthread_mutex_unlock(&bg_lock);
+	}
+}
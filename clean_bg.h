@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_bg.h
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief helper thread shared by the interposing libraries.
+ *
+ * The periodic work of a library (deferred scrubbing, cache decay,
+ * trimming) is registered as a job run by a single helper thread. In
+ * clean.so both libraries share it.
+ */
+
+#ifndef CLEAN_BG_H
+#define CLEAN_BG_H
+
+#include <stddef.h>
+
+#include "clean_common.h"
+
+#define CLEAN_BG_MAX_JOBS	4
+
+/**
+ * Run job every period_ms milliseconds from the helper thread, which is
+ * started if needed. Returns the id of the job or -1.
+ */
+CLEAN_HIDDEN int clean_bg_add(void (*job) (void), size_t period_ms);
+
+/**
+ * Run a job as soon as possible. Does not wait nor start the thread.
+ */
+CLEAN_HIDDEN void clean_bg_wake(int id);
+
+/**
+ * Start the helper thread if it is not running. It does not survive a
+ * fork(): a library that needs it in the child calls this again.
+ */
+CLEAN_HIDDEN void clean_bg_start(void);
+
+#endif /* CLEAN_BG_H */
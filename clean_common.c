@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_common.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief helpers shared by the interposing libraries.
+ *
+ * Changes:
+ *
+ */
+
+#include <stdlib.h>
+
+#include "clean_common.h"
+#include "clean_scrub.h"
+
+size_t clean_env_size(const char *name, size_t def)
+{
+	const char *str = getenv(name);
+	unsigned long long val;
+	char *end;
+
+	if (!str || !*str) {
+		return def;
+	}
+
+	val = strtoull(str, &end, 0);
+	switch (*end) {
+	case 'g':
+	case 'G':
+		val *= 1024;
+		/* fall through */
+	case 'm':
+	case 'M':
+		val *= 1024;
+		/* fall through */
+	case 'k':
+	case 'K':
+		val *= 1024;
+		break;
+	case '\0':
+		break;
+	default:
+		debug("invalid value '%s' for %s\n", str, name);
+		return def;
+	}
+
+	return val;
+}
+
+#ifdef CLEAN_COMBINED
+/**
+ * clean.so: initialize the scrub kernels first as both halves use them,
+ * then the allocator (the dynamic linker and dlsym() may allocate) and
+ * last the write side, in a single constructor.
+ */
+__attribute__ ((constructor))
+static void clean_init(void)
+{
+	clean_scrub_init();
+	init_malloc();
+	init_malloc_background();
+	init_write();
+}
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_common.h
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief helpers shared by the interposing libraries.
+ *
+ * Like clean_scrub.h, these are internal to each library and not
+ * exported.
+ *
+ * When the libraries are built together in clean.so (CLEAN_COMBINED)
+ * their initialization functions are no longer constructors: a single
+ * constructor in clean_common.c calls them in order.
+ */
+
+#ifndef CLEAN_COMMON_H
+#define CLEAN_COMMON_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define CLEAN_HIDDEN	__attribute__ ((visibility("hidden")))
+
+#ifdef CLEAN_COMBINED
+#define CLEAN_CONSTRUCTOR
+#else
+#define CLEAN_CONSTRUCTOR	__attribute__ ((constructor))
+#endif
+
+#define MIN(a,b)	((a>b) ? b : a)
+
+#ifdef DEBUG
+#define debug(fmt, ...) fprintf(stderr, "%s " fmt, __func__, ## __VA_ARGS__)
+#else
+#define debug(fmt, ...)
+#endif
+
+/**
+ * Read a size from the environment. K, M and G suffixes are accepted.
+ * def is returned if the variable is not set or invalid.
+ */
+CLEAN_HIDDEN size_t clean_env_size(const char *name, size_t def);
+
+#ifdef CLEAN_COMBINED
+void init_malloc(void);
+CLEAN_HIDDEN void init_malloc_background(void);
+void init_write(void);
+#endif
+
+#endif /* CLEAN_COMMON_H */
@@ -35,15 +35,93 @@
  * - valloc (deprecated)
  * - memalign (deprecated)
  * - posix_memalign
+ * - malloc_usable_size
  * - free
  *
  * In turn these functions will use the following functions from glibc.
  * - malloc
+ * - calloc
  * - free
  * - posix_memalign
+ * - malloc_usable_size
+ * - malloc_trim
  *
  * Usage: LD_PRELOAD=./clean_malloc.so command args ...
  *
+ * The library also exports an arena allocator (see clean_malloc.h and
+ * clean_arena.c) for request scoped memory that is scrubbed in bulk.
+ *
+ * calloc() requests between 4 KiB and 256 KiB are served from a pool of
+ * blocks that are known to be all 0 (blocks are scrubbed by free() before
+ * going back to the pool) so no memset is needed. The pool is tuned with
+ * the following environment variables (sizes accept K, M and G suffixes):
+ * - CLEAN_MALLOC_ZPOOL_BUDGET: total pool size (0 disables the pool)
+ * - CLEAN_MALLOC_ZPOOL_HIGH: maximum number of blocks kept per size class
+ * - CLEAN_MALLOC_ZPOOL_LOW: number of blocks per size class kept when
+ *   the pool is trimmed
+ *
+ * Requests of CLEAN_MALLOC_LARGE_MIN bytes or more are mapped directly
+ * with mmap(). When they are freed the mappings are scrubbed (with
+ * madvise(MADV_DONTNEED) above CLEAN_MALLOC_LARGE_DONTNEED bytes) and
+ * kept in a cache of mappings known to be all 0, so a later malloc or
+ * calloc of a similar size needs neither a syscall nor a memset.
+ * - CLEAN_MALLOC_LARGE_CACHE: total size of the cached mappings
+ * - CLEAN_MALLOC_LARGE_DECAY_MS: cached mappings unused for half this
+ *   time have their pages dropped, they are unmapped after this time
+ *
+ * Mappings given back to the system are not unmapped one by one: they go
+ * to a release queue that coalesces adjacent ranges and is flushed in
+ * one batch, saving a TLB shootdown per range. Pages dropped in bulk
+ * are released with a single process_madvise() call when the kernel
+ * supports it.
+ * - CLEAN_MALLOC_RELEASE_BATCH: queued bytes triggering a flush
+ * - CLEAN_MALLOC_RELEASE_DELAY_MS: maximum time a range stays queued
+ *
+ * When CLEAN_MALLOC_HUGEPAGE is set to 1, small and medium blocks are
+ * carved out of 2 MiB aligned regions marked MADV_HUGEPAGE (one size
+ * class per region) to reduce TLB misses in the application and in the
+ * scrub loops. Blocks are scrubbed with plain stores so hugepages are
+ * never split; regions idle for CLEAN_MALLOC_HUGE_DECAY_MS are given
+ * back to the system in bulk.
+ *
+ * When CLEAN_MALLOC_PRESSURE is set to 1, a monitor thread watches the
+ * memory pressure (PSI trigger on /proc/pressure/memory) and the cgroup
+ * v2 memory.current/memory.max ratio. Under pressure the caches above
+ * are shrunk and kept small until the pressure is gone, and the scrubs
+ * deferred by clean_write are done at once.
+ * - CLEAN_MALLOC_PRESSURE_STALL_US: PSI stall time triggering pressure
+ *   in a PSI window of CLEAN_MALLOC_PRESSURE_WINDOW_US
+ * - CLEAN_MALLOC_PRESSURE_CGROUP_PCT: memory.current percentage of
+ *   memory.max triggering pressure
+ * - CLEAN_MALLOC_PRESSURE_INTERVAL_MS: cgroup polling interval
+ * - CLEAN_MALLOC_PRESSURE_HOLD_MS: time without pressure before the
+ *   caches grow again
+ *
+ * When CLEAN_MALLOC_TRIM is set to 1, a helper thread (shared with
+ * clean_write in clean.so) periodically
+ * decays the caches, flushes the release queue and calls malloc_trim()
+ * once the allocator has been idle for a while, so the memory freed to
+ * glibc stops counting in the RSS.
+ * - CLEAN_MALLOC_TRIM_INTERVAL_MS: period of the background work
+ * - CLEAN_MALLOC_TRIM_IDLE_MS: time without free() before a trim
+ * - CLEAN_MALLOC_TRIM_BYTES: bytes freed since the last trim needed
+ *
+ * Every block returned by the library is recorded in an ownership index
+ * (one bit per 16 bytes of address space, in a lazily mapped two level
+ * table) so free() and realloc() can tell our blocks from pointers
+ * allocated by glibc directly (before the preload, through
+ * __libc_malloc, ...) without reading the memory in front of them.
+ * Foreign pointers are scrubbed and given to the real free().
+ *
+ * realloc() resizes in place when the block is large enough, scrubbing
+ * the tail when it shrinks. Call sites that keep growing the same block
+ * get CLEAN_MALLOC_REALLOC_GROWTH percent more than requested (at most
+ * CLEAN_MALLOC_REALLOC_MAX_SLACK bytes) so their next calls are done in
+ * place without a copy and a scrub.
+ *
+ * When CLEAN_MALLOC_STATS is set, statistics are printed on stderr at
+ * exit. They can also be read with clean_malloc_get_stats().
+ *
  * Changes:
  *
  */
@@ -51,43 +129,275 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
 
 #define __USE_GNU
 #include <dlfcn.h>
 
+#include "clean_malloc.h"
+#include "clean_scrub.h"
+#include "clean_common.h"
+#include "clean_bg.h"
+
 static void *default_malloc(size_t size);
+static void *default_calloc(size_t nmemb, size_t size);
 static void default_free(void *ptr);
 static int default_posix_memalign(void **memptr, size_t alignment, size_t size);
+static int default_malloc_trim(size_t pad);
+static size_t default_malloc_usable_size(void *ptr);
 
 static void *(*real_malloc) (size_t size) = default_malloc;
+static void *(*real_calloc) (size_t nmemb, size_t size) = default_calloc;
 static void (*real_free) (void *ptr) = default_free;
 static int (*real_posix_memalign) (void **memptr, size_t alignment,
 				   size_t size) = default_posix_memalign;
+static int (*real_malloc_trim) (size_t pad) = default_malloc_trim;
+static size_t (*real_malloc_usable_size) (void *ptr) =
+    default_malloc_usable_size;
 
-#define MIN(a,b)	((a>b) ? b : a)
+/* optional, from clean_write.so (see clean_malloc_mark_deferred()) */
+static void (*write_forget) (void *ptr);
+static void (*write_barrier) (void);
 
-#ifdef DEBUG
-#define debug(fmt, ...) fprintf(stderr, "%s " fmt, __func__, ## __VA_ARGS__)
-#else
-#define debug(fmt, ...)
-#endif
-
-#ifdef CHECK_COOKIE
 #define ALLOC_COOKIE 0x12345678
-#endif
 
+/*
+ * The header size is a multiple of 16 so the user pointer keeps the
+ * alignment guaranteed by the real malloc. The cookie sits right before
+ * the user area and is only checked with CHECK_COOKIE.
+ */
 struct alloc_header {
-#ifdef CHECK_COOKIE
-	unsigned int cookie;
-	unsigned int dummy;
-#endif
 	void *ptr;
+	size_t usable_size;
 	size_t requested_size;
+	unsigned int flags;
+	unsigned int cookie;
+};
+
+/* The block belongs to a zero pool size class (usable_size) */
+#define ALLOC_ZPOOL	0x1
+/* The block is a private mapping of usable_size + header bytes */
+#define ALLOC_LARGE	0x2
+/* The block is a slot of a hugepage region */
+#define ALLOC_HUGE	0x4
+/* The user area was 0 when marked (see clean_malloc_mark_clean()) */
+#define ALLOC_CLEAN	0x8
+/* Scrubs of the user area pending in clean_write (a count, see
+ * clean_malloc_mark_deferred()) */
+#define ALLOC_DEFERRED_ONE	0x10000
+#define ALLOC_DEFERRED_MASK	0xffff0000
+
+/*
+ * Pool of blocks that are all 0, one list per power of 2 size class.
+ * A pooled block keeps its header and is linked through the first word
+ * after the header (cleared again when the block is handed out).
+ */
+#define ZPOOL_MIN_SHIFT		12	/* 4 KiB */
+#define ZPOOL_MAX_SHIFT		18	/* 256 KiB */
+#define ZPOOL_CLASSES		(ZPOOL_MAX_SHIFT - ZPOOL_MIN_SHIFT + 1)
+
+#define ZPOOL_DEFAULT_BUDGET	(32 * 1024 * 1024)
+#define ZPOOL_DEFAULT_HIGH	64
+#define ZPOOL_DEFAULT_LOW	4
+
+struct zpool_class {
+	pthread_mutex_t lock;
+	struct alloc_header *head;
+	size_t count;
+};
+
+static struct zpool_class zpool[ZPOOL_CLASSES] = {
+	[0 ... ZPOOL_CLASSES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}
+};
+
+static size_t zpool_budget = ZPOOL_DEFAULT_BUDGET;
+static size_t zpool_high = ZPOOL_DEFAULT_HIGH;
+static size_t zpool_low = ZPOOL_DEFAULT_LOW;
+
+/*
+ * Cache of released large mappings. Their content is all 0: the part
+ * used by the application was scrubbed and the rest was never written.
+ */
+#define LARGE_CACHE_ENTRIES	32
+
+#define LARGE_DEFAULT_MIN	(1024 * 1024)
+#define LARGE_DEFAULT_DONTNEED	(8 * 1024 * 1024)
+#define LARGE_DEFAULT_CACHE	(128 * 1024 * 1024)
+#define LARGE_DEFAULT_DECAY_MS	10000
+
+struct large_entry {
+	struct alloc_header *store_ptr;
+	size_t size;		/* size of the mapping */
+	unsigned long last_used;	/* ms */
+	int purged;		/* pages already dropped */
+};
+
+static pthread_mutex_t large_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct large_entry large_cache[LARGE_CACHE_ENTRIES];
+static unsigned int large_count;
+
+static size_t large_min = LARGE_DEFAULT_MIN;
+static size_t large_dontneed = LARGE_DEFAULT_DONTNEED;
+static size_t large_cache_max = LARGE_DEFAULT_CACHE;
+static size_t large_decay_ms = LARGE_DEFAULT_DECAY_MS;
+
+/*
+ * Queue of ranges to unmap. They are all 0 and unused so they can wait.
+ */
+#define RELEASE_QUEUE_ENTRIES	64
+#define RELEASE_IOV_BATCH	64
+
+#define RELEASE_DEFAULT_BATCH		(64 * 1024 * 1024)
+#define RELEASE_DEFAULT_DELAY_MS	100
+
+static pthread_mutex_t release_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct iovec release_queue[RELEASE_QUEUE_ENTRIES];
+static unsigned int release_count;
+static size_t release_bytes;
+static unsigned long release_oldest;	/* ms */
+
+static size_t release_batch = RELEASE_DEFAULT_BATCH;
+static size_t release_delay_ms = RELEASE_DEFAULT_DELAY_MS;
+
+/*
+ * Hugepage regions. Each 2 MiB aligned region holds the slots of a single
+ * power of 2 size class (header included) and starts with its descriptor.
+ * Regions with free slots (other than the current one) are linked in the
+ * partial list of their class. Freed slots are linked through the first
+ * word after their header.
+ */
+#define HUGE_REGION_SHIFT	21
+#define HUGE_REGION_SIZE	(1UL << HUGE_REGION_SHIFT)
+#define HUGE_MIN_SHIFT		6	/* 64 bytes */
+#define HUGE_MAX_SHIFT		17	/* 128 KiB */
+#define HUGE_CLASSES		(HUGE_MAX_SHIFT - HUGE_MIN_SHIFT + 1)
+#define HUGE_PURGE_BATCH	64
+
+#define HUGE_DEFAULT_DECAY_MS	1000
+
+struct huge_region {
+	struct huge_region *prev;
+	struct huge_region *next;
+	struct alloc_header *free_list;
+	size_t bump;		/* offset of the first never used slot */
+	unsigned int class;
+	unsigned int live;	/* slots handed out */
+	unsigned long idle_since;	/* ms, when live dropped to 0 */
+	int in_partial;
+};
+
+struct huge_class {
+	pthread_mutex_t lock;
+	struct huge_region *current;
+	struct huge_region *partial;
+};
+
+static struct huge_class huge_classes[HUGE_CLASSES] = {
+	[0 ... HUGE_CLASSES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}
+};
+
+static size_t huge_enabled;
+static size_t huge_decay_ms = HUGE_DEFAULT_DECAY_MS;
+static unsigned long huge_last_purge;
+
+static int pressure_on(void);
+
+/*
+ * Memory pressure monitor
+ */
+#define PRESSURE_DEFAULT_STALL_US	150000
+#define PRESSURE_DEFAULT_WINDOW_US	2000000
+#define PRESSURE_DEFAULT_CGROUP_PCT	90
+#define PRESSURE_DEFAULT_INTERVAL_MS	1000
+#define PRESSURE_DEFAULT_HOLD_MS	5000
+
+static size_t pressure_enabled;
+static size_t pressure_stall_us = PRESSURE_DEFAULT_STALL_US;
+static size_t pressure_window_us = PRESSURE_DEFAULT_WINDOW_US;
+static size_t pressure_cgroup_pct = PRESSURE_DEFAULT_CGROUP_PCT;
+static size_t pressure_interval_ms = PRESSURE_DEFAULT_INTERVAL_MS;
+static size_t pressure_hold_ms = PRESSURE_DEFAULT_HOLD_MS;
+
+/* set while the system is under memory pressure: caches stay small */
+static int pressure_active;
+
+/* the monitor thread does not survive a fork (see pressure_on()) */
+static int pressure_running;
+static int pressure_psi_fd = -1;
+
+/*
+ * Background trim of the real allocator. free() accounts the bytes given
+ * to the real allocator per thread and publishes them by TRIM_ACCOUNT_STEP.
+ */
+#define TRIM_DEFAULT_INTERVAL_MS	1000
+#define TRIM_DEFAULT_IDLE_MS		5000
+#define TRIM_DEFAULT_BYTES		(16 * 1024 * 1024)
+#define TRIM_ACCOUNT_STEP		(64 * 1024)
+
+static size_t trim_enabled;
+static size_t trim_interval_ms = TRIM_DEFAULT_INTERVAL_MS;
+static size_t trim_idle_ms = TRIM_DEFAULT_IDLE_MS;
+static size_t trim_bytes = TRIM_DEFAULT_BYTES;
+static size_t trim_freed_bytes;
+static __thread size_t trim_freed_local;
+
+/*
+ * realloc() growth prediction. A small table indexed by call site
+ * remembers the last block returned to the site and how many times in a
+ * row the site grew it. The table is a hint: races are harmless.
+ */
+#define REALLOC_SITES		256
+#define REALLOC_STREAK		2
+
+#define REALLOC_DEFAULT_GROWTH		100	/* % */
+#define REALLOC_DEFAULT_MAX_SLACK	(4 * 1024 * 1024)
+
+struct realloc_site {
+	void *site;
+	void *last;
+	unsigned int streak;
 };
 
+static struct realloc_site realloc_sites[REALLOC_SITES];
+
+static size_t realloc_growth = REALLOC_DEFAULT_GROWTH;
+static size_t realloc_max_slack = REALLOC_DEFAULT_MAX_SLACK;
+
+/*
+ * Ownership index: one bit per OWNER_GRANULE bytes, set for the user
+ * pointers we hand out. The first level (in .bss, only touched pages
+ * use memory) covers OWNER_ADDR_BITS of address space by steps of
+ * 1 << OWNER_LEAF_SHIFT bytes, the leaves are mapped on first use.
+ * Addresses out of the index cannot be checked and are assumed ours.
+ */
+#define OWNER_GRANULE_SHIFT	4
+#define OWNER_LEAF_SHIFT	30
+#define OWNER_ADDR_BITS		48
+#define OWNER_L1_ENTRIES	(1UL << (OWNER_ADDR_BITS - OWNER_LEAF_SHIFT))
+#define OWNER_LEAF_BITS		(1UL << (OWNER_LEAF_SHIFT - OWNER_GRANULE_SHIFT))
+#define OWNER_LEAF_SIZE		(OWNER_LEAF_BITS / 8)
+#define OWNER_WORD_BITS		(8 * sizeof(unsigned long))
+
+static unsigned long *owner_index[OWNER_L1_ENTRIES];
+
+static struct clean_malloc_stats stats;
+
+#define STAT_ADD(field, val) \
+	__atomic_fetch_add(&stats.field, (val), __ATOMIC_RELAXED)
+#define STAT_SUB(field, val) \
+	__atomic_fetch_sub(&stats.field, (val), __ATOMIC_RELAXED)
+
 #define EXTRA_STATIC_SPACE	128
 static char extra_space[EXTRA_STATIC_SPACE];
 static int extra_space_count = 0;
@@ -99,8 +409,7 @@ static int extra_space_count = 0;
  * constructor is called. In such instance we setup some default versions
  * of these functions that will force the call to the constructor.
  */
-__attribute__ ((constructor))
-void init_malloc(void)
+CLEAN_CONSTRUCTOR void init_malloc(void)
 {
 	static int init_done;
 	void *ptr;
@@ -126,6 +435,13 @@ void init_malloc(void)
 		debug("malloc %s\n", dlerror());
 	}
 
+	ptr = dlsym(RTLD_NEXT, "calloc");
+	if (ptr) {
+		real_calloc = ptr;
+	} else {
+		debug("calloc %s\n", dlerror());
+	}
+
 	ptr = dlsym(RTLD_NEXT, "free");
 	if (ptr) {
 		real_free = ptr;
@@ -139,6 +455,136 @@ void init_malloc(void)
 	} else {
 		debug("posix_memalign %s\n", dlerror());
 	}
+
+	ptr = dlsym(RTLD_NEXT, "malloc_usable_size");
+	if (ptr) {
+		real_malloc_usable_size = ptr;
+	} else {
+		debug("malloc_usable_size %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "malloc_trim");
+	if (ptr) {
+		real_malloc_trim = ptr;
+	} else {
+		debug("malloc_trim %s\n", dlerror());
+	}
+
+	zpool_budget = clean_env_size("CLEAN_MALLOC_ZPOOL_BUDGET",
+				      zpool_budget);
+	zpool_high = clean_env_size("CLEAN_MALLOC_ZPOOL_HIGH", zpool_high);
+	zpool_low = MIN(clean_env_size("CLEAN_MALLOC_ZPOOL_LOW", zpool_low),
+			zpool_high);
+
+	large_min = clean_env_size("CLEAN_MALLOC_LARGE_MIN", large_min);
+	large_dontneed = clean_env_size("CLEAN_MALLOC_LARGE_DONTNEED",
+					large_dontneed);
+	large_cache_max = clean_env_size("CLEAN_MALLOC_LARGE_CACHE",
+					 large_cache_max);
+	large_decay_ms = clean_env_size("CLEAN_MALLOC_LARGE_DECAY_MS",
+					large_decay_ms);
+
+	huge_enabled = clean_env_size("CLEAN_MALLOC_HUGEPAGE", huge_enabled);
+	huge_decay_ms = clean_env_size("CLEAN_MALLOC_HUGE_DECAY_MS",
+				       huge_decay_ms);
+
+	pressure_enabled = clean_env_size("CLEAN_MALLOC_PRESSURE",
+					  pressure_enabled);
+	pressure_stall_us = clean_env_size("CLEAN_MALLOC_PRESSURE_STALL_US",
+					   pressure_stall_us);
+	pressure_window_us = clean_env_size("CLEAN_MALLOC_PRESSURE_WINDOW_US",
+					    pressure_window_us);
+	pressure_cgroup_pct = clean_env_size("CLEAN_MALLOC_PRESSURE_CGROUP_PCT",
+					     pressure_cgroup_pct);
+	pressure_interval_ms =
+	    clean_env_size("CLEAN_MALLOC_PRESSURE_INTERVAL_MS",
+			   pressure_interval_ms);
+	pressure_hold_ms = clean_env_size("CLEAN_MALLOC_PRESSURE_HOLD_MS",
+					  pressure_hold_ms);
+
+	trim_enabled = clean_env_size("CLEAN_MALLOC_TRIM", trim_enabled);
+	trim_interval_ms = clean_env_size("CLEAN_MALLOC_TRIM_INTERVAL_MS",
+					  trim_interval_ms);
+	trim_idle_ms = clean_env_size("CLEAN_MALLOC_TRIM_IDLE_MS",
+				      trim_idle_ms);
+	trim_bytes = clean_env_size("CLEAN_MALLOC_TRIM_BYTES", trim_bytes);
+
+	realloc_growth = clean_env_size("CLEAN_MALLOC_REALLOC_GROWTH",
+					realloc_growth);
+	realloc_max_slack = clean_env_size("CLEAN_MALLOC_REALLOC_MAX_SLACK",
+					   realloc_max_slack);
+
+	release_batch = clean_env_size("CLEAN_MALLOC_RELEASE_BATCH",
+				       release_batch);
+	release_delay_ms = clean_env_size("CLEAN_MALLOC_RELEASE_DELAY_MS",
+					  release_delay_ms);
+
+	/* optional, clean_write.so (or clean.so) */
+	write_forget = dlsym(RTLD_DEFAULT, "clean_write_forget");
+	write_barrier = dlsym(RTLD_DEFAULT, "clean_write_barrier");
+}
+
+/**
+ * Print the statistics at exit when CLEAN_MALLOC_STATS is set.
+ */
+__attribute__ ((destructor))
+static void fini_malloc(void)
+{
+	struct clean_malloc_stats s;
+	size_t calls;
+
+	if (!getenv("CLEAN_MALLOC_STATS")) {
+		return;
+	}
+
+	clean_malloc_get_stats(&s);
+	calls = s.zpool_hits + s.zpool_misses;
+
+	fprintf(stderr, "clean_malloc: zpool hits %zu misses %zu "
+		"(hit rate %zu%%) blocks %zu bytes %zu\n",
+		s.zpool_hits, s.zpool_misses,
+		calls ? (s.zpool_hits * 100) / calls : 0,
+		s.zpool_blocks, s.zpool_bytes);
+
+	fprintf(stderr, "clean_malloc: large cache hits %zu misses %zu "
+		"blocks %zu bytes %zu\n", s.large_hits, s.large_misses,
+		s.large_blocks, s.large_bytes);
+
+	fprintf(stderr, "clean_malloc: release ranges %zu syscalls %zu "
+		"(avoided %zu)\n", s.release_ranges, s.release_syscalls,
+		s.release_ranges - s.release_syscalls);
+
+	fprintf(stderr, "clean_malloc: realloc in place %zu (saved %zu bytes "
+		"of copy and scrub) predicted %zu\n", s.realloc_in_place,
+		s.realloc_saved_bytes, s.realloc_predicted);
+
+	if (s.clean_marked) {
+		fprintf(stderr, "clean_malloc: marked clean %zu (skipped %zu "
+			"bytes of scrub)\n", s.clean_marked,
+			s.clean_skipped_bytes);
+	}
+
+	if (pressure_enabled) {
+		fprintf(stderr, "clean_malloc: pressure purges %zu "
+			"bytes %zu\n", s.pressure_purges,
+			s.pressure_purged_bytes);
+	}
+
+	if (trim_enabled) {
+		fprintf(stderr, "clean_malloc: trims %zu reclaimed %zu bytes\n",
+			s.trims, s.trim_reclaimed_bytes);
+	}
+
+	if (huge_enabled) {
+		size_t region_bytes = s.huge_regions * HUGE_REGION_SIZE;
+
+		fprintf(stderr, "clean_malloc: huge regions %zu purged %zu "
+			"hugepage backed %zu/%zu bytes (%zu%%)\n",
+			s.huge_regions, s.huge_purged, s.huge_backed_bytes,
+			region_bytes, region_bytes ?
+			(MIN(s.huge_backed_bytes, region_bytes) * 100) /
+			region_bytes : 0);
+	}
 }
 
 /*
@@ -203,6 +649,60 @@ static void default_free(void *ptr)
 	real_free(ptr);
 }
 
+/**
+ * For this default calloc function, we force the constructor and call the
+ * real calloc if the function address resolution was successful.
+ * Otherwise we fall back on malloc and memset.
+ */
+static void *default_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	init_malloc();
+
+	if (real_calloc != default_calloc) {
+		return real_calloc(nmemb, size);
+	}
+
+	ptr = real_malloc(nmemb * size);
+	if (ptr) {
+		memset(ptr, 0, nmemb * size);
+	}
+
+	return ptr;
+}
+
+/**
+ * There is nothing to trim before the real allocator is resolved.
+ */
+static int default_malloc_trim(size_t pad)
+{
+	(void)pad;
+
+	init_malloc();
+
+	if (real_malloc_trim == default_malloc_trim) {
+		return 0;
+	}
+
+	return real_malloc_trim(pad);
+}
+
+/**
+ * The size of a foreign block is unknown before the real allocator is
+ * resolved.
+ */
+static size_t default_malloc_usable_size(void *ptr)
+{
+	init_malloc();
+
+	if (real_malloc_usable_size == default_malloc_usable_size) {
+		return 0;
+	}
+
+	return real_malloc_usable_size(ptr);
+}
+
 /**
  * For this default posix_memalign function, we force the constructor and 
  * call the real posix_memalign if the function address resolution was 
@@ -228,131 +728,1705 @@ static int default_posix_memalign(void **memptr, size_t alignment, size_t size)
 }
 
 /**
- * This is our malloc function. Basically we add a header to the requested
- * memory where we can store the size of the allocated memory and the real
- * pointer to the block.
- * We need to support malloc(0) as the glibc malloc function returns a 
- * valid pointer in such case. Some RegExp functions (among others) do not 
- * expect malloc(0) to return NULL.
+ * Return the leaf of the ownership index covering ptr (mapping it when
+ * create is set) and the bit index of ptr in it.
+ * Returns NULL if ptr is out of the index or the leaf does not exist.
  */
-void *malloc(size_t size)
+static unsigned long *owner_leaf(const void *ptr, size_t *bit, int create)
 {
-	void *ptr = NULL;
-	struct alloc_header alloc_header;
-	size_t allocated_size;
+	uintptr_t addr = (uintptr_t) ptr;
+	unsigned long **slot;
+	unsigned long *leaf;
+	unsigned long *expected = NULL;
 
-	alloc_header.requested_size = size;
-	allocated_size = alloc_header.requested_size + sizeof(alloc_header);
-#ifdef CHECK_COOKIE
-	alloc_header.cookie = ALLOC_COOKIE;
-	alloc_header.dummy = 0;
-#endif
-	alloc_header.ptr = real_malloc(allocated_size);
-	if (alloc_header.ptr) {
-		*(struct alloc_header *)alloc_header.ptr = alloc_header;
-		ptr = alloc_header.ptr + sizeof(alloc_header);
+	if (addr >> OWNER_ADDR_BITS) {
+		return NULL;
 	}
 
-	return ptr;
+	*bit = (addr >> OWNER_GRANULE_SHIFT) & (OWNER_LEAF_BITS - 1);
+	slot = &owner_index[addr >> OWNER_LEAF_SHIFT];
+
+	leaf = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (leaf || !create) {
+		return leaf;
+	}
+
+	leaf = mmap(NULL, OWNER_LEAF_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (leaf == MAP_FAILED) {
+		return NULL;
+	}
+
+	/* another thread may have been faster */
+	if (!__atomic_compare_exchange_n(slot, &expected, leaf, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		munmap(leaf, OWNER_LEAF_SIZE);
+		leaf = expected;
+	}
+
+	return leaf;
 }
 
 /**
- * For calloc, we just call malloc then memset the area to 0
+ * Record ptr as one of our blocks.
  */
-void *calloc(size_t nmemb, size_t size)
+static void owner_set(const void *ptr)
 {
-	void *ptr = malloc(size * nmemb);
+	size_t bit;
+	unsigned long *leaf = owner_leaf(ptr, &bit, 1);
 
-	if (ptr && (size * nmemb)) {
-		memset(ptr, 0, size * nmemb);
+	if (leaf) {
+		__atomic_fetch_or(&leaf[bit / OWNER_WORD_BITS],
+				  1UL << (bit % OWNER_WORD_BITS),
+				  __ATOMIC_RELAXED);
 	}
-
-	return ptr;
 }
 
 /**
- * for free, we memset the allocated memory to 0 (using the header
- * information, before calling the real free function
+ * Check if ptr is one of our blocks and forget it when clear is set.
  */
-void free(void *ptr)
+static int owner_check(const void *ptr, int clear)
 {
-	if (ptr) {
-		struct alloc_header *store_ptr = (struct alloc_header *)ptr;
-		store_ptr--;
+	size_t bit;
+	unsigned long *leaf = owner_leaf(ptr, &bit, 0);
+	unsigned long mask = 1UL << (bit % OWNER_WORD_BITS);
 
-#ifdef CHECK_COOKIE
-		if (store_ptr->cookie != ALLOC_COOKIE) {
-			fprintf(stderr, "%s: Invalid pointer\n", __func__);
-			return;
-		}
-#endif
-		memset(store_ptr->ptr, 0,
-		       (ptr - store_ptr->ptr) + store_ptr->requested_size);
-		real_free(store_ptr->ptr);
+	if (!leaf) {
+		/* out of the index, nothing was recorded there */
+		return (uintptr_t) ptr >> OWNER_ADDR_BITS;
 	}
+
+	if (clear) {
+		return !!(__atomic_fetch_and(&leaf[bit / OWNER_WORD_BITS],
+					     ~mask, __ATOMIC_RELAXED) & mask);
+	}
+
+	return !!(__atomic_load_n(&leaf[bit / OWNER_WORD_BITS],
+				  __ATOMIC_RELAXED) & mask);
 }
 
-void *realloc(void *ptr, size_t size)
+/*
+ * Blocks marked clean.
+ *
+ * With clean_write.so a buffer sent then freed would be scrubbed twice.
+ * clean_write marks the blocks it fully scrubbed and free() reads them
+ * up to the first byte written since, rather than writing zeros over
+ * zeros: a read pass does not dirty the cache lines nor write them back
+ * to memory. The rest of the block is scrubbed as usual, so a block
+ * written again after it was marked is still cleaned.
+ */
+int clean_malloc_mark_clean(void *ptr, size_t len)
 {
-	void *new_ptr = malloc(size);
+	struct alloc_header *store_ptr = (struct alloc_header *)ptr - 1;
 
-	if (ptr) {
-		if (new_ptr) {
-			struct alloc_header *store_ptr =
-			    (struct alloc_header *)ptr;
+	/* only the start of one of our blocks has its owner bit set */
+	if (!ptr || ((uintptr_t) ptr >> OWNER_ADDR_BITS) ||
+	    ((uintptr_t) ptr & ((1UL << OWNER_GRANULE_SHIFT) - 1)) ||
+	    !owner_check(ptr, 0) || (len < store_ptr->requested_size)) {
+		return 0;
+	}
 
-			store_ptr--;
+	__atomic_fetch_or(&store_ptr->flags, ALLOC_CLEAN, __ATOMIC_RELAXED);
+	STAT_ADD(clean_marked, 1);
 
-			memcpy(new_ptr, ptr,
-			       MIN(size, store_ptr->requested_size));
-		}
+	return 1;
+}
+
+/*
+ * Blocks with a deferred scrub pending.
+ *
+ * In the deferred mode of clean_write.so the helper thread scrubs a
+ * written block some time after the write. The block must not be
+ * released before: once reused by another allocation, the helper
+ * thread would zero a live object. clean_write counts the pending
+ * scrubs of a block in its header, and free() and realloc() have
+ * clean_write_forget() drop them before the block is released or
+ * resized (free() scrubs it anyway).
+ */
+int clean_malloc_mark_deferred(void *ptr, size_t len)
+{
+	struct alloc_header *store_ptr = (struct alloc_header *)ptr - 1;
+	unsigned int flags;
 
-		free(ptr);
+	if (!write_forget || !ptr || ((uintptr_t) ptr >> OWNER_ADDR_BITS) ||
+	    ((uintptr_t) ptr & ((1UL << OWNER_GRANULE_SHIFT) - 1)) ||
+	    !owner_check(ptr, 0) || (len > store_ptr->requested_size)) {
+		return 0;
 	}
 
-	return new_ptr;
+	flags = __atomic_load_n(&store_ptr->flags, __ATOMIC_RELAXED);
+	do {
+		if ((flags & ALLOC_DEFERRED_MASK) == ALLOC_DEFERRED_MASK) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&store_ptr->flags, &flags,
+					      flags + ALLOC_DEFERRED_ONE, 1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return 1;
 }
 
-int posix_memalign(void **memptr, size_t alignment, size_t size)
+int clean_malloc_unmark_deferred(void *ptr)
 {
-	int rc = 0;
+	struct alloc_header *store_ptr = (struct alloc_header *)ptr - 1;
 
-	if (!alignment || !memptr) {
-		rc = -EINVAL;
-	} else {
-		struct alloc_header alloc_header;
-		size_t allocated_size;
+	/* release: the scrub is done before free() can see the count drop */
+	return __atomic_sub_fetch(&store_ptr->flags, ALLOC_DEFERRED_ONE,
+				  __ATOMIC_RELEASE) / ALLOC_DEFERRED_ONE;
+}
 
-		*memptr = NULL;
+/**
+ * Drop the deferred scrubs still pending on a block of ours.
+ */
+static void deferred_forget(struct alloc_header *store_ptr)
+{
+	if (__atomic_load_n(&store_ptr->flags, __ATOMIC_ACQUIRE) &
+	    ALLOC_DEFERRED_MASK) {
+		write_forget(store_ptr + 1);
+	}
+}
 
-		alloc_header.requested_size = size;
-		allocated_size =
-		    (sizeof(alloc_header) / alignment) +
-		    ((sizeof(alloc_header) % alignment) ? 1 : 0);
-		allocated_size *= alignment;
-		allocated_size += alloc_header.requested_size;
-#ifdef CHECK_COOKIE
-		alloc_header.cookie = ALLOC_COOKIE;
-		alloc_header.dummy = 0;
-#endif
-		alloc_header.ptr = NULL;
-		rc = real_posix_memalign(&alloc_header.ptr, alignment,
-					 allocated_size);
+/**
+ * Return the number of leading bytes of the first len bytes of a block
+ * marked clean that are still 0, by steps of a cache line.
+ */
+static size_t clean_prefix(struct alloc_header *store_ptr, size_t len)
+{
+	size_t off;
 
-		if (!rc && alloc_header.ptr) {
-			struct alloc_header *store_ptr;
-			*memptr =
-			    alloc_header.ptr + allocated_size -
-			    alloc_header.requested_size;
-			store_ptr = (struct alloc_header *)*memptr;
+	if (!(__atomic_load_n(&store_ptr->flags, __ATOMIC_RELAXED) &
+	      ALLOC_CLEAN)) {
+		return 0;
+	}
+
+	off = clean_zero_prefix(store_ptr + 1, len);
+	STAT_ADD(clean_skipped_bytes, off);
+
+	return off;
+}
+
+/**
+ * Size of a block we did not allocate.
+ */
+static size_t foreign_size(void *ptr)
+{
+	if (((char *)ptr >= extra_space) &&
+	    ((char *)ptr < &extra_space[EXTRA_STATIC_SPACE])) {
+		return &extra_space[EXTRA_STATIC_SPACE] - (char *)ptr;
+	}
+
+	return real_malloc_usable_size(ptr);
+}
+
+/**
+ * Scrub and release a block we did not allocate. The blocks handed out
+ * by default_malloc() are never released.
+ */
+static void foreign_free(void *ptr)
+{
+	if (((char *)ptr >= extra_space) &&
+	    ((char *)ptr < &extra_space[EXTRA_STATIC_SPACE])) {
+		return;
+	}
+
+	clean_scrub_nt(ptr, real_malloc_usable_size(ptr));
+	real_free(ptr);
+}
+
+/**
+ * Return the zero pool size class for a block size or -1 if the size is
+ * not handled by the pool.
+ */
+static int zpool_class_of(size_t size)
+{
+	int shift = ZPOOL_MIN_SHIFT;
+
+	if ((size < (1UL << ZPOOL_MIN_SHIFT)) ||
+	    (size > (1UL << ZPOOL_MAX_SHIFT))) {
+		return -1;
+	}
+
+	while ((1UL << shift) < size) {
+		shift++;
+	}
+
+	return shift - ZPOOL_MIN_SHIFT;
+}
+
+/**
+ * Take a block from the zero pool. The whole user area of the block is 0
+ * but the block is not marked clean any more: it is a new allocation.
+ */
+static struct alloc_header *zpool_get(int class)
+{
+	struct zpool_class *zc = &zpool[class];
+	struct alloc_header *store_ptr;
+
+	pthread_mutex_lock(&zc->lock);
+	store_ptr = zc->head;
+	if (store_ptr) {
+		zc->head = *(struct alloc_header **)(store_ptr + 1);
+		zc->count--;
+	}
+	pthread_mutex_unlock(&zc->lock);
+
+	if (store_ptr) {
+		*(struct alloc_header **)(store_ptr + 1) = NULL;
+		store_ptr->flags &= ~ALLOC_CLEAN;
+		STAT_SUB(zpool_blocks, 1);
+		STAT_SUB(zpool_bytes, store_ptr->usable_size);
+	}
+
+	return store_ptr;
+}
+
+/**
+ * Give an already scrubbed block to the zero pool.
+ * Returns 0 if the pool is full and the block must be released.
+ */
+static int zpool_put(struct alloc_header *store_ptr)
+{
+	struct zpool_class *zc =
+	    &zpool[zpool_class_of(store_ptr->usable_size)];
+	size_t keep = pressure_on() ? zpool_low : zpool_high;
+	int rc = 0;
+
+	pthread_mutex_lock(&zc->lock);
+	if ((zc->count < keep) &&
+	    ((__atomic_load_n(&stats.zpool_bytes, __ATOMIC_RELAXED) +
+	      store_ptr->usable_size) <= zpool_budget)) {
+		*(struct alloc_header **)(store_ptr + 1) = zc->head;
+		zc->head = store_ptr;
+		zc->count++;
+		rc = 1;
+	}
+	pthread_mutex_unlock(&zc->lock);
+
+	if (rc) {
+		STAT_ADD(zpool_blocks, 1);
+		STAT_ADD(zpool_bytes, store_ptr->usable_size);
+	}
+
+	return rc;
+}
+
+/**
+ * Release the pooled blocks above keep blocks per size class.
+ */
+static void zpool_trim(size_t keep)
+{
+	int class;
+
+	for (class = 0; class < ZPOOL_CLASSES; class++) {
+		struct zpool_class *zc = &zpool[class];
+		struct alloc_header *list = NULL;
+		struct alloc_header *store_ptr;
+
+		pthread_mutex_lock(&zc->lock);
+		while (zc->count > keep) {
+			store_ptr = zc->head;
+			zc->head = *(struct alloc_header **)(store_ptr + 1);
+			zc->count--;
+			*(struct alloc_header **)(store_ptr + 1) = list;
+			list = store_ptr;
+		}
+		pthread_mutex_unlock(&zc->lock);
+
+		while (list) {
+			store_ptr = list;
+			list = *(struct alloc_header **)(store_ptr + 1);
+			STAT_SUB(zpool_blocks, 1);
+			STAT_SUB(zpool_bytes, store_ptr->usable_size);
+			real_free(store_ptr->ptr);
+		}
+	}
+}
+
+static unsigned long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	return (ts.tv_sec * 1000UL) + (ts.tv_nsec / 1000000);
+}
+
+/**
+ * Sort ranges by address and merge the adjacent ones.
+ * Returns the new number of ranges.
+ */
+static unsigned int release_coalesce(struct iovec *iov, unsigned int count)
+{
+	unsigned int i;
+	unsigned int j;
+
+	/* insertion sort, there are only a few entries and no malloc */
+	for (i = 1; i < count; i++) {
+		struct iovec tmp = iov[i];
+
+		for (j = i; j && (iov[j - 1].iov_base > tmp.iov_base); j--) {
+			iov[j] = iov[j - 1];
+		}
+		iov[j] = tmp;
+	}
+
+	for (i = 0, j = 1; j < count; j++) {
+		if (((char *)iov[i].iov_base + iov[i].iov_len) ==
+		    iov[j].iov_base) {
+			iov[i].iov_len += iov[j].iov_len;
+		} else {
+			iov[++i] = iov[j];
+		}
+	}
+
+	return count ? i + 1 : 0;
+}
+
+/**
+ * Unmap a batch of ranges, one munmap() per run of adjacent ranges.
+ */
+static void release_unmap_batch(struct iovec *iov, unsigned int count)
+{
+	unsigned int i;
+
+	STAT_ADD(release_ranges, count);
+
+	count = release_coalesce(iov, count);
+	for (i = 0; i < count; i++) {
+		munmap(iov[i].iov_base, iov[i].iov_len);
+	}
+
+	STAT_ADD(release_syscalls, count);
+}
+
+/**
+ * Flush the release queue. With force 0 it is only done when the queue
+ * holds enough bytes or its oldest range waited long enough.
+ */
+static void release_flush(int force)
+{
+	struct iovec batch[RELEASE_QUEUE_ENTRIES];
+	unsigned int count = 0;
+
+	pthread_mutex_lock(&release_lock);
+	if (release_count &&
+	    (force || (release_count == RELEASE_QUEUE_ENTRIES) ||
+	     (release_bytes >= release_batch) ||
+	     ((now_ms() - release_oldest) >= release_delay_ms))) {
+		count = release_count;
+		memcpy(batch, release_queue, count * sizeof(*batch));
+		release_count = 0;
+		release_bytes = 0;
+	}
+	pthread_mutex_unlock(&release_lock);
+
+	if (count) {
+		release_unmap_batch(batch, count);
+	}
+}
+
+/**
+ * Queue a range to unmap. The range must already be scrubbed.
+ */
+static void release_unmap(void *addr, size_t len)
+{
+	pthread_mutex_lock(&release_lock);
+	while (release_count == RELEASE_QUEUE_ENTRIES) {
+		pthread_mutex_unlock(&release_lock);
+		release_flush(1);
+		pthread_mutex_lock(&release_lock);
+	}
+	if (!release_count) {
+		release_oldest = now_ms();
+	}
+	release_queue[release_count].iov_base = addr;
+	release_queue[release_count].iov_len = len;
+	release_count++;
+	release_bytes += len;
+	pthread_mutex_unlock(&release_lock);
+
+	release_flush(0);
+}
+
+/**
+ * Drop the pages of a batch of ranges (they read as 0 afterward).
+ * All ranges go to the kernel in one process_madvise() call when it
+ * supports MADV_DONTNEED on our own process, otherwise we fall back to
+ * one madvise() per run of adjacent ranges.
+ * The caller must make sure nobody uses the ranges meanwhile.
+ */
+static void release_purge_batch(struct iovec *iov, unsigned int count)
+{
+	static int pidfd = -1;
+	static pid_t pidfd_pid;
+	static int unsupported;
+	unsigned int i = 0;
+
+	STAT_ADD(release_ranges, count);
+
+	count = release_coalesce(iov, count);
+
+#if defined(SYS_process_madvise) && defined(SYS_pidfd_open)
+	/* the pidfd would refer to our parent after a fork */
+	pthread_mutex_lock(&release_lock);
+	if (!unsupported && (pidfd_pid != getpid())) {
+		if (pidfd >= 0) {
+			close(pidfd);
+		}
+		pidfd_pid = getpid();
+		pidfd = syscall(SYS_pidfd_open, pidfd_pid, 0);
+		unsupported = (pidfd < 0);
+	}
+	pthread_mutex_unlock(&release_lock);
+
+	while (!unsupported && (i < count)) {
+		unsigned int n = MIN(count - i, RELEASE_IOV_BATCH);
+		long done = syscall(SYS_process_madvise, pidfd, &iov[i], n,
+				    MADV_DONTNEED, 0);
+
+		STAT_ADD(release_syscalls, 1);
+
+		if (done < 0) {
+			unsupported = (errno == EINVAL) || (errno == ENOSYS) ||
+			    (errno == EPERM);
+			break;
+		}
+
+		/* skip what was done, a partial range is redone below */
+		while ((i < count) && ((size_t)done >= iov[i].iov_len)) {
+			done -= iov[i].iov_len;
+			i++;
+		}
+		if (done) {
+			break;
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		madvise(iov[i].iov_base, iov[i].iov_len, MADV_DONTNEED);
+		STAT_ADD(release_syscalls, 1);
+	}
+}
+
+/**
+ * Remove the cache entry at index i. Called with large_lock held.
+ */
+static struct large_entry large_cache_remove(unsigned int i)
+{
+	struct large_entry entry = large_cache[i];
+
+	STAT_SUB(large_blocks, 1);
+	STAT_SUB(large_bytes, entry.size);
+	large_cache[i] = large_cache[--large_count];
+
+	return entry;
+}
+
+/**
+ * Add an entry to the cache. Returns 0 if the cache is full.
+ */
+static int large_cache_insert(struct large_entry *entry)
+{
+	int rc = 0;
+
+	if (pressure_on()) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&large_lock);
+	if ((large_count < LARGE_CACHE_ENTRIES) &&
+	    ((__atomic_load_n(&stats.large_bytes, __ATOMIC_RELAXED) +
+	      entry->size) <= large_cache_max)) {
+		large_cache[large_count++] = *entry;
+		STAT_ADD(large_blocks, 1);
+		STAT_ADD(large_bytes, entry->size);
+		rc = 1;
+	}
+	pthread_mutex_unlock(&large_lock);
+
+	return rc;
+}
+
+/**
+ * Cached mappings unused for max_age / 2 ms have their pages dropped
+ * (in one batch) and those unused for max_age ms are unmapped.
+ */
+static void large_cache_decay(unsigned long max_age)
+{
+	struct large_entry victims[LARGE_CACHE_ENTRIES];
+	struct large_entry idle[LARGE_CACHE_ENTRIES];
+	struct iovec iov[LARGE_CACHE_ENTRIES];
+	unsigned int victim_count = 0;
+	unsigned int idle_count = 0;
+	unsigned long now = now_ms();
+	unsigned int i = 0;
+
+	pthread_mutex_lock(&large_lock);
+	while (i < large_count) {
+		unsigned long age = now - large_cache[i].last_used;
+
+		if (age >= max_age) {
+			victims[victim_count++] = large_cache_remove(i);
+		} else if (!large_cache[i].purged && (age >= (max_age / 2))) {
+			/* out of the cache until its pages are dropped */
+			idle[idle_count++] = large_cache_remove(i);
+		} else {
+			i++;
+		}
+	}
+	pthread_mutex_unlock(&large_lock);
+
+	if (idle_count) {
+		size_t page_size = getpagesize();
+
+		/* keep the header page */
+		for (i = 0; i < idle_count; i++) {
+			iov[i].iov_base = (char *)idle[i].store_ptr + page_size;
+			iov[i].iov_len = idle[i].size - page_size;
+		}
+		release_purge_batch(iov, idle_count);
+
+		for (i = 0; i < idle_count; i++) {
+			idle[i].purged = 1;
+			if (!large_cache_insert(&idle[i])) {
+				victims[victim_count++] = idle[i];
+			}
+		}
+	}
+
+	for (i = 0; i < victim_count; i++) {
+		release_unmap(victims[i].store_ptr, victims[i].size);
+	}
+}
+
+/**
+ * Return a mapping able to hold size bytes, from the cache (best fit)
+ * or from the system. The user area is all 0.
+ */
+static void *large_alloc(size_t size)
+{
+	struct alloc_header *store_ptr = NULL;
+	size_t map_size;
+	unsigned int best = LARGE_CACHE_ENTRIES;
+	unsigned int i;
+
+	if (size > (SIZE_MAX / 2)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	map_size = size + sizeof(*store_ptr);
+	map_size = (map_size + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+
+	pthread_mutex_lock(&large_lock);
+	for (i = 0; i < large_count; i++) {
+		/* do not waste more than half of a cached mapping */
+		if ((large_cache[i].size >= map_size) &&
+		    (large_cache[i].size <= (2 * map_size)) &&
+		    ((best == LARGE_CACHE_ENTRIES) ||
+		     (large_cache[i].size < large_cache[best].size))) {
+			best = i;
+		}
+	}
+	if (best != LARGE_CACHE_ENTRIES) {
+		store_ptr = large_cache_remove(best).store_ptr;
+	}
+	pthread_mutex_unlock(&large_lock);
+
+	if (store_ptr) {
+		/* a new allocation, whatever was marked on the last one */
+		store_ptr->flags &= ~ALLOC_CLEAN;
+		STAT_ADD(large_hits, 1);
+	} else {
+		STAT_ADD(large_misses, 1);
+
+		store_ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (store_ptr == MAP_FAILED) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		store_ptr->cookie = ALLOC_COOKIE;
+		store_ptr->ptr = store_ptr;
+		store_ptr->usable_size = map_size - sizeof(*store_ptr);
+		store_ptr->flags = ALLOC_LARGE;
+	}
+
+	store_ptr->requested_size = size;
+
+	owner_set(store_ptr + 1);
+
+	return store_ptr + 1;
+}
+
+/**
+ * Scrub a large block and keep it in the cache if there is room.
+ * Above large_dontneed bytes the pages are dropped with madvise() rather
+ * than written: the kernel gives back zero filled pages on next access.
+ */
+static void large_free(struct alloc_header *store_ptr)
+{
+	size_t map_size = store_ptr->usable_size + sizeof(*store_ptr);
+	char *ptr = (char *)(store_ptr + 1);
+	size_t len = store_ptr->requested_size;
+	struct large_entry entry;
+	size_t skip;
+
+	if (len >= large_dontneed) {
+		size_t page_size = getpagesize();
+		size_t head = page_size - sizeof(*store_ptr);
+
+		/* keep the header page, drop all the others */
+		if (!madvise(ptr + head, (len - head + page_size - 1) &
+			     ~(page_size - 1), MADV_DONTNEED)) {
+			len = head;
+		}
+	}
+
+	skip = clean_prefix(store_ptr, len);
+	clean_scrub_nt(ptr + skip, len - skip);
+
+	entry.store_ptr = store_ptr;
+	entry.size = map_size;
+	entry.last_used = now_ms();
+	entry.purged = 0;
+
+	large_cache_decay(large_decay_ms);
+
+	if (!large_cache_insert(&entry)) {
+		release_unmap(store_ptr, map_size);
+	}
+}
+
+/**
+ * Return the huge size class for a block size or -1.
+ */
+static int huge_class_of(size_t size)
+{
+	int shift = HUGE_MIN_SHIFT;
+
+	if (size > ((1UL << HUGE_MAX_SHIFT) - sizeof(struct alloc_header))) {
+		return -1;
+	}
+
+	size += sizeof(struct alloc_header);
+	while ((1UL << shift) < size) {
+		shift++;
+	}
+
+	return shift - HUGE_MIN_SHIFT;
+}
+
+static size_t huge_first_slot(unsigned int class)
+{
+	size_t slot_size = 1UL << (class + HUGE_MIN_SHIFT);
+
+	return (sizeof(struct huge_region) + slot_size - 1) & ~(slot_size - 1);
+}
+
+static void huge_partial_add(struct huge_class *hc, struct huge_region *region)
+{
+	region->prev = NULL;
+	region->next = hc->partial;
+	if (region->next) {
+		region->next->prev = region;
+	}
+	hc->partial = region;
+	region->in_partial = 1;
+}
+
+static void huge_partial_remove(struct huge_class *hc,
+				struct huge_region *region)
+{
+	if (region->prev) {
+		region->prev->next = region->next;
+	} else {
+		hc->partial = region->next;
+	}
+	if (region->next) {
+		region->next->prev = region->prev;
+	}
+	region->in_partial = 0;
+}
+
+/**
+ * Map a new 2 MiB aligned region and ask for hugepages.
+ */
+static struct huge_region *huge_region_new(unsigned int class)
+{
+	struct huge_region *region;
+	char *map;
+	char *aligned;
+
+	map = mmap(NULL, 2 * HUGE_REGION_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	aligned = (char *)(((uintptr_t) map + HUGE_REGION_SIZE - 1) &
+			   ~(HUGE_REGION_SIZE - 1));
+	if (aligned != map) {
+		munmap(map, aligned - map);
+	}
+	munmap(aligned + HUGE_REGION_SIZE,
+	       (map + (2 * HUGE_REGION_SIZE)) - (aligned + HUGE_REGION_SIZE));
+
+	madvise(aligned, HUGE_REGION_SIZE, MADV_HUGEPAGE);
+
+	region = (struct huge_region *)aligned;
+	region->class = class;
+	region->bump = huge_first_slot(class);
+
+	STAT_ADD(huge_regions, 1);
+
+	return region;
+}
+
+/**
+ * Return a slot of the class. Its user area is all 0.
+ */
+static void *huge_alloc(int class, size_t size)
+{
+	struct huge_class *hc = &huge_classes[class];
+	size_t slot_size = 1UL << (class + HUGE_MIN_SHIFT);
+	struct huge_region *region;
+	struct alloc_header *store_ptr;
+
+	pthread_mutex_lock(&hc->lock);
+
+	region = hc->current;
+	if (!region || (!region->free_list &&
+			((region->bump + slot_size) > HUGE_REGION_SIZE))) {
+		/* the current region is full, it is in no list anymore */
+		region = hc->partial;
+		if (region) {
+			huge_partial_remove(hc, region);
+		} else {
+			region = huge_region_new(class);
+			if (!region) {
+				pthread_mutex_unlock(&hc->lock);
+				errno = ENOMEM;
+				return NULL;
+			}
+		}
+		hc->current = region;
+	}
+
+	store_ptr = region->free_list;
+	if (store_ptr) {
+		region->free_list = *(struct alloc_header **)(store_ptr + 1);
+	} else {
+		store_ptr = (struct alloc_header *)((char *)region +
+						    region->bump);
+		region->bump += slot_size;
+	}
+	region->live++;
+
+	pthread_mutex_unlock(&hc->lock);
+
+	*(struct alloc_header **)(store_ptr + 1) = NULL;
+
+	store_ptr->cookie = ALLOC_COOKIE;
+	store_ptr->ptr = store_ptr;
+	store_ptr->usable_size = slot_size - sizeof(*store_ptr);
+	store_ptr->requested_size = size;
+	store_ptr->flags = ALLOC_HUGE;
+
+	owner_set(store_ptr + 1);
+
+	return store_ptr + 1;
+}
+
+/**
+ * Give the regions idle for max_age ms back to the system in one batch.
+ * Whole 2 MiB regions are unmapped so no hugepage is split.
+ */
+static void huge_purge_idle(unsigned long max_age)
+{
+	struct huge_region *victims[HUGE_PURGE_BATCH];
+	unsigned int count = 0;
+	unsigned long now = now_ms();
+	int class;
+
+	huge_last_purge = now;
+
+	for (class = 0; class < HUGE_CLASSES; class++) {
+		struct huge_class *hc = &huge_classes[class];
+		struct huge_region *region;
+		struct huge_region *next;
+
+		pthread_mutex_lock(&hc->lock);
+		for (region = hc->partial; region && (count < HUGE_PURGE_BATCH);
+		     region = next) {
+			next = region->next;
+			if (!region->live &&
+			    ((now - region->idle_since) >= max_age)) {
+				huge_partial_remove(hc, region);
+				victims[count++] = region;
+			}
+		}
+		pthread_mutex_unlock(&hc->lock);
+	}
+
+	if (count) {
+		STAT_ADD(huge_purged, count);
+		STAT_SUB(huge_regions, count);
+
+		while (count--) {
+			/* only the descriptor is not 0 */
+			clean_scrub(victims[count], sizeof(struct huge_region));
+			release_unmap(victims[count], HUGE_REGION_SIZE);
+		}
+		release_flush(1);
+	}
+}
+
+/**
+ * Scrub a slot with plain stores (madvise would split the hugepage) and
+ * put it back in its region.
+ */
+static void huge_free(struct alloc_header *store_ptr)
+{
+	struct huge_region *region =
+	    (struct huge_region *)((uintptr_t) store_ptr &
+				   ~(HUGE_REGION_SIZE - 1));
+	struct huge_class *hc = &huge_classes[region->class];
+	size_t skip = clean_prefix(store_ptr, store_ptr->requested_size);
+	int idle;
+
+	clean_scrub((char *)(store_ptr + 1) + skip,
+		    store_ptr->requested_size - skip);
+
+	pthread_mutex_lock(&hc->lock);
+	*(struct alloc_header **)(store_ptr + 1) = region->free_list;
+	region->free_list = store_ptr;
+	region->live--;
+	if ((region != hc->current) && !region->in_partial) {
+		huge_partial_add(hc, region);
+	}
+	idle = !region->live;
+	if (idle) {
+		region->idle_since = now_ms();
+	}
+	pthread_mutex_unlock(&hc->lock);
+
+	if (idle && pressure_on()) {
+		huge_purge_idle(0);
+	} else if (idle &&
+		   ((now_ms() - huge_last_purge) >= (huge_decay_ms / 2))) {
+		huge_purge_idle(huge_decay_ms);
+	}
+}
+
+/**
+ * Read the amount of memory backed by transparent hugepages in the
+ * process from /proc/self/smaps_rollup (without calling malloc).
+ */
+static size_t huge_backed_bytes(void)
+{
+	char buf[4096];
+	ssize_t len;
+	char *line;
+	int fd;
+
+	fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return 0;
+	}
+	buf[len] = '\0';
+
+	line = strstr(buf, "AnonHugePages:");
+	if (!line) {
+		return 0;
+	}
+
+	return strtoull(line + strlen("AnonHugePages:"), NULL, 10) * 1024;
+}
+
+void clean_malloc_get_stats(struct clean_malloc_stats *s)
+{
+	s->zpool_hits = __atomic_load_n(&stats.zpool_hits, __ATOMIC_RELAXED);
+	s->zpool_misses =
+	    __atomic_load_n(&stats.zpool_misses, __ATOMIC_RELAXED);
+	s->zpool_blocks =
+	    __atomic_load_n(&stats.zpool_blocks, __ATOMIC_RELAXED);
+	s->zpool_bytes = __atomic_load_n(&stats.zpool_bytes, __ATOMIC_RELAXED);
+	s->large_hits = __atomic_load_n(&stats.large_hits, __ATOMIC_RELAXED);
+	s->large_misses =
+	    __atomic_load_n(&stats.large_misses, __ATOMIC_RELAXED);
+	s->large_blocks =
+	    __atomic_load_n(&stats.large_blocks, __ATOMIC_RELAXED);
+	s->large_bytes = __atomic_load_n(&stats.large_bytes, __ATOMIC_RELAXED);
+	s->release_ranges =
+	    __atomic_load_n(&stats.release_ranges, __ATOMIC_RELAXED);
+	s->release_syscalls =
+	    __atomic_load_n(&stats.release_syscalls, __ATOMIC_RELAXED);
+	s->huge_regions = __atomic_load_n(&stats.huge_regions, __ATOMIC_RELAXED);
+	s->huge_purged = __atomic_load_n(&stats.huge_purged, __ATOMIC_RELAXED);
+	s->huge_backed_bytes = huge_enabled ? huge_backed_bytes() : 0;
+	s->pressure_purges =
+	    __atomic_load_n(&stats.pressure_purges, __ATOMIC_RELAXED);
+	s->pressure_purged_bytes =
+	    __atomic_load_n(&stats.pressure_purged_bytes, __ATOMIC_RELAXED);
+	s->realloc_in_place =
+	    __atomic_load_n(&stats.realloc_in_place, __ATOMIC_RELAXED);
+	s->realloc_saved_bytes =
+	    __atomic_load_n(&stats.realloc_saved_bytes, __ATOMIC_RELAXED);
+	s->realloc_predicted =
+	    __atomic_load_n(&stats.realloc_predicted, __ATOMIC_RELAXED);
+	s->trims = __atomic_load_n(&stats.trims, __ATOMIC_RELAXED);
+	s->trim_reclaimed_bytes =
+	    __atomic_load_n(&stats.trim_reclaimed_bytes, __ATOMIC_RELAXED);
+	s->clean_marked = __atomic_load_n(&stats.clean_marked, __ATOMIC_RELAXED);
+	s->clean_skipped_bytes =
+	    __atomic_load_n(&stats.clean_skipped_bytes, __ATOMIC_RELAXED);
+}
+
+void clean_malloc_trim(void)
+{
+	zpool_trim(zpool_low);
+	large_cache_decay(0);
+	if (huge_enabled) {
+		huge_purge_idle(0);
+	}
+	release_flush(1);
+}
+
+/**
+ * Memory held by our caches.
+ */
+static size_t cached_bytes(void)
+{
+	return __atomic_load_n(&stats.zpool_bytes, __ATOMIC_RELAXED) +
+	    __atomic_load_n(&stats.large_bytes, __ATOMIC_RELAXED) +
+	    (__atomic_load_n(&stats.huge_regions, __ATOMIC_RELAXED) *
+	     HUGE_REGION_SIZE);
+}
+
+/**
+ * Read a small file in buf (no malloc). Returns the length or -1.
+ */
+static ssize_t read_file(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len >= 0) {
+		buf[len] = '\0';
+	}
+
+	return len;
+}
+
+/**
+ * Find the cgroup v2 directory of the process. Returns 0 on success.
+ */
+static int pressure_cgroup_dir(char *dir, size_t size)
+{
+	char buf[1024];
+	char *path;
+	char *end;
+
+	if (read_file("/proc/self/cgroup", buf, sizeof(buf)) <= 0) {
+		return -1;
+	}
+
+	/* the cgroup v2 line is "0::/path" */
+	path = strstr(buf, "0::");
+	if (!path || ((path != buf) && (path[-1] != '\n'))) {
+		return -1;
+	}
+	path += 3;
+	end = strchr(path, '\n');
+	if (end) {
+		*end = '\0';
+	}
+
+	if ((size_t)snprintf(dir, size, "/sys/fs/cgroup%s", path) >= size) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Check the cgroup usage against its limit.
+ */
+static int pressure_cgroup_check(const char *dir)
+{
+	char path[512];
+	char buf[64];
+	unsigned long long max;
+	unsigned long long current;
+
+	snprintf(path, sizeof(path), "%s/memory.max", dir);
+	if ((read_file(path, buf, sizeof(buf)) <= 0) ||
+	    !strncmp(buf, "max", 3)) {
+		return 0;
+	}
+	max = strtoull(buf, NULL, 10);
+
+	snprintf(path, sizeof(path), "%s/memory.current", dir);
+	if (read_file(path, buf, sizeof(buf)) <= 0) {
+		return 0;
+	}
+	current = strtoull(buf, NULL, 10);
+
+	return max && (current >= ((max / 100) * pressure_cgroup_pct));
+}
+
+/**
+ * Give back what our caches hold and record it. The buffers waiting for
+ * a deferred scrub are scrubbed first: pages about to be swapped out
+ * must not carry what was written from them.
+ */
+static void pressure_purge(void)
+{
+	size_t before = cached_bytes();
+	size_t after;
+
+	if (write_barrier) {
+		write_barrier();
+	}
+
+	clean_malloc_trim();
+
+	after = cached_bytes();
+
+	STAT_ADD(pressure_purges, 1);
+	STAT_ADD(pressure_purged_bytes, (before > after) ? before - after : 0);
+}
+
+/**
+ * Read the resident set size of the process from /proc/self/statm.
+ */
+static size_t resident_bytes(void)
+{
+	char buf[128];
+	char *field;
+
+	if (read_file("/proc/self/statm", buf, sizeof(buf)) <= 0) {
+		return 0;
+	}
+
+	/* second field: resident pages */
+	field = strchr(buf, ' ');
+	if (!field) {
+		return 0;
+	}
+
+	return strtoull(field + 1, NULL, 10) * getpagesize();
+}
+
+/**
+ * Ask the real allocator to give its free memory back to the system
+ * when enough memory was freed and nothing was freed for a while.
+ */
+static void background_trim(void)
+{
+	static size_t last_freed;
+	static size_t trimmed_freed;
+	static unsigned long last_activity;
+	size_t freed = __atomic_load_n(&trim_freed_bytes, __ATOMIC_RELAXED);
+	unsigned long now = now_ms();
+	size_t before;
+	size_t after;
+
+	if (freed != last_freed) {
+		last_freed = freed;
+		last_activity = now;
+		return;
+	}
+
+	if (((freed - trimmed_freed) < trim_bytes) ||
+	    ((now - last_activity) < trim_idle_ms)) {
+		return;
+	}
+
+	trimmed_freed = freed;
+
+	before = resident_bytes();
+	real_malloc_trim(0);
+	after = resident_bytes();
+
+	STAT_ADD(trims, 1);
+	STAT_ADD(trim_reclaimed_bytes, (before > after) ? before - after : 0);
+}
+
+/**
+ * Periodic work run from the shared helper thread: decay the caches and
+ * flush the release queue even when the application does not call
+ * free() anymore, then trim the real allocator if it has been idle long
+ * enough.
+ */
+static void background_work(void)
+{
+	large_cache_decay(large_decay_ms);
+	if (huge_enabled) {
+		huge_purge_idle(huge_decay_ms);
+	}
+	release_flush(0);
+	background_trim();
+}
+
+/**
+ * The pressure thread waits for PSI events (or polls the cgroup files
+ * when PSI is not available) and purges the caches under pressure. It
+ * blocks in poll() so it does not share the helper thread.
+ */
+static void *pressure_thread(void *arg)
+{
+	char cgroup_dir[256];
+	int has_cgroup = 0;
+	unsigned long last_pressure = 0;
+	struct pollfd pfd;
+	char trigger[64];
+	size_t timeout;
+
+	(void)arg;
+
+	pfd.fd = -1;
+	pfd.events = POLLPRI;
+
+	if (pressure_enabled) {
+		has_cgroup = !pressure_cgroup_dir(cgroup_dir,
+						  sizeof(cgroup_dir));
+
+		pfd.fd = open("/proc/pressure/memory",
+			      O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (pfd.fd >= 0) {
+			int len = snprintf(trigger, sizeof(trigger),
+					   "some %zu %zu", pressure_stall_us,
+					   pressure_window_us);
+
+			if (write(pfd.fd, trigger, len + 1) < 0) {
+				debug("PSI trigger %s\n", strerror(errno));
+				close(pfd.fd);
+				pfd.fd = -1;
+			}
+		}
+		pressure_psi_fd = pfd.fd;
+
+		if ((pfd.fd < 0) && !has_cgroup) {
+			debug("no PSI nor cgroup, pressure is not monitored\n");
+		}
+	}
+
+	timeout = pressure_interval_ms;
+
+	for (;;) {
+		int pressure = 0;
+		int rc;
+
+		rc = poll(&pfd, 1, timeout);
+		if ((rc > 0) && (pfd.revents & POLLERR)) {
+			/* the PSI file went away, keep the cgroup polling */
+			close(pfd.fd);
+			pfd.fd = -1;
+			pressure_psi_fd = -1;
+		} else if ((rc > 0) && (pfd.revents & POLLPRI)) {
+			pressure = 1;
+		}
+
+		if (!pressure && has_cgroup) {
+			pressure = pressure_cgroup_check(cgroup_dir);
+		}
+
+		if (pressure) {
+			last_pressure = now_ms();
+			__atomic_store_n(&pressure_active, 1, __ATOMIC_RELAXED);
+			pressure_purge();
+		} else if (pressure_active &&
+			   ((now_ms() - last_pressure) >= pressure_hold_ms)) {
+			__atomic_store_n(&pressure_active, 0, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the pressure thread if it is not running. It does not take any
+ * signal from the application.
+ */
+static void pressure_start(void)
+{
+	pthread_t thread;
+	sigset_t all;
+	sigset_t old;
+
+	if (__atomic_exchange_n(&pressure_running, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	if (pthread_create(&thread, NULL, pressure_thread, NULL)) {
+		debug("failed to start the pressure thread\n");
+	} else {
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * Return non zero while the caches must stay small. A child forked by a
+ * monitored process has no monitor thread: it is started again here,
+ * by the first cache that asks.
+ */
+static int pressure_on(void)
+{
+	if (pressure_enabled &&
+	    !__atomic_load_n(&pressure_running, __ATOMIC_ACQUIRE)) {
+		pressure_start();
+	}
+
+	return __atomic_load_n(&pressure_active, __ATOMIC_RELAXED);
+}
+
+/**
+ * The pressure seen by the parent says nothing about the child, and its
+ * PSI trigger belongs to the thread that is gone.
+ */
+static void pressure_fork_child(void)
+{
+	__atomic_store_n(&pressure_active, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&pressure_running, 0, __ATOMIC_RELEASE);
+	if (pressure_psi_fd >= 0) {
+		close(pressure_psi_fd);
+		pressure_psi_fd = -1;
+	}
+}
+
+/*
+ * Take the cache locks around fork() so that the child does not inherit
+ * one held by a thread that does not exist there (the helper thread
+ * trimming the caches, or any thread in malloc() or free()). The locks
+ * are never nested, the order does not matter.
+ */
+static void malloc_fork_prepare(void)
+{
+	int class;
+
+	for (class = 0; class < ZPOOL_CLASSES; class++) {
+		pthread_mutex_lock(&zpool[class].lock);
+	}
+	for (class = 0; class < HUGE_CLASSES; class++) {
+		pthread_mutex_lock(&huge_classes[class].lock);
+	}
+	pthread_mutex_lock(&large_lock);
+	pthread_mutex_lock(&release_lock);
+}
+
+static void malloc_fork_parent(void)
+{
+	int class;
+
+	pthread_mutex_unlock(&release_lock);
+	pthread_mutex_unlock(&large_lock);
+	for (class = 0; class < HUGE_CLASSES; class++) {
+		pthread_mutex_unlock(&huge_classes[class].lock);
+	}
+	for (class = 0; class < ZPOOL_CLASSES; class++) {
+		pthread_mutex_unlock(&zpool[class].lock);
+	}
+}
+
+static void malloc_fork_child(void)
+{
+	malloc_fork_parent();
+}
+
+/**
+ * Start the background work once the library is initialized.
+ */
+CLEAN_CONSTRUCTOR CLEAN_HIDDEN void init_malloc_background(void)
+{
+	init_malloc();
+
+	if (pthread_atfork(malloc_fork_prepare, malloc_fork_parent,
+			   malloc_fork_child)) {
+		debug("caches not protected across fork\n");
+	}
+
+	if (trim_enabled &&
+	    (clean_bg_add(background_work, trim_interval_ms) < 0)) {
+		debug("failed to register the background work\n");
+	}
+
+	if (!pressure_enabled) {
+		return;
+	}
+
+	if (pthread_atfork(NULL, NULL, pressure_fork_child)) {
+		debug("pressure monitor not restarted after fork\n");
+	}
+
+	pressure_start();
+}
+
+/**
+ * This is our malloc function. Basically we add a header to the requested
+ * memory where we can store the size of the allocated memory and the real
+ * pointer to the block.
+ * We need to support malloc(0) as the glibc malloc function returns a 
+ * valid pointer in such case. Some RegExp functions (among others) do not 
+ * expect malloc(0) to return NULL.
+ */
+void *malloc(size_t size)
+{
+	void *ptr = NULL;
+	struct alloc_header alloc_header;
+	size_t allocated_size;
+
+	if (large_min && (size >= large_min)) {
+		return large_alloc(size);
+	}
+
+	if (huge_enabled) {
+		int class = huge_class_of(size);
+
+		if (class >= 0) {
+			return huge_alloc(class, size);
+		}
+	}
+
+	alloc_header.usable_size = size;
+	alloc_header.requested_size = size;
+	alloc_header.flags = 0;
+	allocated_size = alloc_header.requested_size + sizeof(alloc_header);
+	alloc_header.cookie = ALLOC_COOKIE;
+	alloc_header.ptr = real_malloc(allocated_size);
+	if (alloc_header.ptr) {
+		*(struct alloc_header *)alloc_header.ptr = alloc_header;
+		ptr = alloc_header.ptr + sizeof(alloc_header);
+		owner_set(ptr);
+	}
+
+	return ptr;
+}
+
+/**
+ * For calloc, sizes handled by the zero pool are taken from it without
+ * touching the memory. On a miss we ask the real calloc for a block of
+ * the full class size (it knows when fresh memory does not need to be
+ * cleared) so that it can go to the pool when it is freed.
+ * Other sizes just call malloc then memset the area to 0.
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+	size_t total;
+	int class;
+
+	if (__builtin_mul_overflow(nmemb, size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* hugepage slots are known to be 0 */
+	if (huge_enabled) {
+		class = huge_class_of(total);
+		if (class >= 0) {
+			return huge_alloc(class, total);
+		}
+	}
+
+	class = zpool_budget ? zpool_class_of(total) : -1;
+	if (class >= 0) {
+		struct alloc_header *store_ptr = zpool_get(class);
+
+		if (store_ptr) {
+			STAT_ADD(zpool_hits, 1);
+		} else {
+			size_t usable_size = 1UL << (class + ZPOOL_MIN_SHIFT);
+
+			STAT_ADD(zpool_misses, 1);
+
+			store_ptr = real_calloc(1, sizeof(*store_ptr) +
+						usable_size);
+			if (!store_ptr) {
+				return NULL;
+			}
+			store_ptr->cookie = ALLOC_COOKIE;
+			store_ptr->ptr = store_ptr;
+			store_ptr->usable_size = usable_size;
+			store_ptr->flags = ALLOC_ZPOOL;
+		}
+
+		store_ptr->requested_size = total;
+
+		owner_set(store_ptr + 1);
+
+		return store_ptr + 1;
+	}
+
+	/* large blocks are known to be 0 */
+	if (large_min && (total >= large_min)) {
+		return large_alloc(total);
+	}
+
+	ptr = malloc(total);
+
+	if (ptr && total) {
+		memset(ptr, 0, total);
+	}
+
+	return ptr;
+}
+
+/**
+ * for free, we memset the allocated memory to 0 (using the header
+ * information, before calling the real free function
+ */
+void free(void *ptr)
+{
+	if (ptr) {
+		struct alloc_header *store_ptr = (struct alloc_header *)ptr;
+		void *real_ptr;
+		size_t size;
+		size_t skip;
+
+		if (!owner_check(ptr, 1)) {
+			foreign_free(ptr);
+			return;
+		}
+
+		store_ptr--;
+
+#ifdef CHECK_COOKIE
+		/* only a consistency check now, ptr is known to be ours */
+		if (store_ptr->cookie != ALLOC_COOKIE) {
+			fprintf(stderr, "%s: Invalid pointer\n", __func__);
+			return;
+		}
+#endif
+		deferred_forget(store_ptr);
+
+		/*
+		 * The bytes after requested_size were never given to the
+		 * application so the whole user area is 0 once scrubbed.
+		 * The header is kept for the pool.
+		 */
+		if (store_ptr->flags & ALLOC_ZPOOL) {
+			skip = clean_prefix(store_ptr,
+					    store_ptr->requested_size);
+			clean_scrub((char *)ptr + skip,
+				    store_ptr->requested_size - skip);
+			if (!zpool_put(store_ptr)) {
+				real_free(store_ptr->ptr);
+			}
+			return;
+		} else if (store_ptr->flags & ALLOC_LARGE) {
+			large_free(store_ptr);
+			return;
+		} else if (store_ptr->flags & ALLOC_HUGE) {
+			huge_free(store_ptr);
+			return;
+		}
+
+		/* the header is scrubbed too, keep what we need from it */
+		real_ptr = store_ptr->ptr;
+		size = store_ptr->requested_size;
+		skip = clean_prefix(store_ptr, size);
+		if (skip) {
+			clean_scrub(real_ptr, ptr - real_ptr);
+			clean_scrub_nt((char *)ptr + skip, size - skip);
+		} else {
+			clean_scrub_nt(real_ptr, (ptr - real_ptr) + size);
+		}
+		real_free(real_ptr);
+
+		if (trim_enabled) {
+			trim_freed_local += size;
+			if (trim_freed_local >= TRIM_ACCOUNT_STEP) {
+				/* the helper thread does not survive a fork */
+				clean_bg_start();
+				__atomic_fetch_add(&trim_freed_bytes,
+						   trim_freed_local,
+						   __ATOMIC_RELAXED);
+				trim_freed_local = 0;
+			}
+		}
+	}
+}
+
+/**
+ * Return the size to allocate when a call site grows a block to size.
+ * Sites that grew the same block REALLOC_STREAK times in a row get some
+ * extra room so the next calls can be done in place.
+ */
+static size_t realloc_predict(struct realloc_site *rs, void *site, void *ptr,
+			      size_t size)
+{
+	size_t slack;
+
+	if ((rs->site != site) || (rs->last != ptr)) {
+		rs->site = site;
+		rs->streak = 0;
+	}
+	rs->streak++;
+
+	if (!realloc_growth || (rs->streak < REALLOC_STREAK)) {
+		return size;
+	}
+
+	slack = MIN((size / 100) * realloc_growth, realloc_max_slack);
+	if (slack > (SIZE_MAX - size)) {
+		return size;
+	}
+
+	STAT_ADD(realloc_predicted, 1);
+
+	return size + slack;
+}
+
+/**
+ * For realloc, the block is resized in place when it is large enough:
+ * the bytes after requested_size were never given to the application
+ * (and are 0 for the blocks that must be) so growing only updates the
+ * header while shrinking scrubs the tail. We do not keep a block that
+ * would be more than half empty.
+ * Otherwise a new block is allocated, the data copied and the old block
+ * freed (and scrubbed). On failure the old block is left untouched.
+ */
+void *realloc(void *ptr, size_t size)
+{
+	struct alloc_header *store_ptr;
+	struct realloc_site *rs;
+	void *site = __builtin_return_address(0);
+	size_t capacity = size;
+	void *new_ptr;
+
+	if (!ptr) {
+		return malloc(size);
+	}
+
+	if (!owner_check(ptr, 0)) {
+		new_ptr = malloc(size);
+		if (new_ptr) {
+			memcpy(new_ptr, ptr, MIN(size, foreign_size(ptr)));
+			foreign_free(ptr);
+		}
+		return new_ptr;
+	}
+
+	store_ptr = (struct alloc_header *)ptr;
+	store_ptr--;
+
+	/* the block keeps its content, it must not be scrubbed later */
+	deferred_forget(store_ptr);
+
+	if ((size <= store_ptr->usable_size) &&
+	    ((size >= store_ptr->requested_size) ||
+	     (size >= (store_ptr->usable_size / 2)))) {
+		if (size < store_ptr->requested_size) {
+			clean_scrub((char *)ptr + size,
+				    store_ptr->requested_size - size);
+		}
+
+		STAT_ADD(realloc_in_place, 1);
+		STAT_ADD(realloc_saved_bytes, store_ptr->requested_size);
+
+		store_ptr->requested_size = size;
+
+		return ptr;
+	}
+
+	rs = &realloc_sites[((uintptr_t) site >> 4) % REALLOC_SITES];
+	if (size > store_ptr->requested_size) {
+		capacity = realloc_predict(rs, site, ptr, size);
+	}
+
+	new_ptr = malloc(capacity);
+	if (!new_ptr) {
+		return NULL;
+	}
+
+	if (capacity != size) {
+		((struct alloc_header *)new_ptr - 1)->requested_size = size;
+	}
+
+	memcpy(new_ptr, ptr, MIN(size, store_ptr->requested_size));
+
+	free(ptr);
+
+	rs->last = new_ptr;
+
+	return new_ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	int rc = 0;
+
+	if (!alignment || !memptr) {
+		rc = -EINVAL;
+	} else {
+		struct alloc_header alloc_header;
+		size_t allocated_size;
+
+		*memptr = NULL;
+
+		alloc_header.usable_size = size;
+		alloc_header.requested_size = size;
+		alloc_header.flags = 0;
+		allocated_size =
+		    (sizeof(alloc_header) / alignment) +
+		    ((sizeof(alloc_header) % alignment) ? 1 : 0);
+		allocated_size *= alignment;
+		allocated_size += alloc_header.requested_size;
+		alloc_header.cookie = ALLOC_COOKIE;
+		alloc_header.ptr = NULL;
+		rc = real_posix_memalign(&alloc_header.ptr, alignment,
+					 allocated_size);
+
+		if (!rc && alloc_header.ptr) {
+			struct alloc_header *store_ptr;
+			*memptr =
+			    alloc_header.ptr + allocated_size -
+			    alloc_header.requested_size;
+			store_ptr = (struct alloc_header *)*memptr;
 			store_ptr--;
 			*store_ptr = alloc_header;
+			owner_set(*memptr);
 		}
 	}
 
 	return rc;
 }
 
+/**
+ * Only the requested size is usable: the rest of the block is not
+ * scrubbed by free().
+ */
+size_t malloc_usable_size(void *ptr)
+{
+	if (!ptr) {
+		return 0;
+	}
+
+	if (!owner_check(ptr, 0)) {
+		return foreign_size(ptr);
+	}
+
+	return ((struct alloc_header *)ptr - 1)->requested_size;
+}
+
 void *memalign(size_t boundary, size_t size)
 {
 	void *ptr = NULL;
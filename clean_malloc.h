@@ -0,0 +1,149 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_malloc.h
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief public API exported by clean_malloc.so.
+ *
+ * Applications that only rely on LD_PRELOAD do not need this file.
+ * It is meant for applications that want to use the extra services
+ * provided by the library (link with clean_malloc.so).
+ */
+
+#ifndef CLEAN_MALLOC_H
+#define CLEAN_MALLOC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Arena (region) allocator.
+ *
+ * Memory is bump allocated from large chunks and is never released
+ * individually. clean_arena_reset() scrubs everything that was handed
+ * out in one pass and rewinds the arena while keeping its chunks.
+ * clean_arena_destroy() scrubs the arena and gives its chunks to a
+ * process wide cache so the next arena does not need to fault pages in.
+ *
+ * An arena is not thread safe: use one arena per request or per thread.
+ */
+struct clean_arena;
+
+/* Scrub with madvise(MADV_DONTNEED) instead of writing zeros */
+#define CLEAN_ARENA_DONTNEED	0x1
+
+/**
+ * Create an arena. chunk_size is the size of the chunks requested from
+ * the system (0 selects the default). Returns NULL on failure.
+ */
+struct clean_arena *clean_arena_create(size_t chunk_size, unsigned int flags);
+
+/**
+ * Return size bytes from the arena aligned on 16 bytes or NULL.
+ */
+void *clean_arena_alloc(struct clean_arena *arena, size_t size);
+
+/**
+ * Same as clean_arena_alloc() with a larger alignment. alignment must
+ * be a power of two.
+ */
+void *clean_arena_memalign(struct clean_arena *arena, size_t alignment,
+			   size_t size);
+
+/**
+ * Scrub all memory handed out by the arena and make it available again.
+ */
+void clean_arena_reset(struct clean_arena *arena);
+
+/**
+ * Scrub the arena and release it.
+ */
+void clean_arena_destroy(struct clean_arena *arena);
+
+/**
+ * Statistics of the library.
+ */
+struct clean_malloc_stats {
+	size_t zpool_hits;	/* calloc() served by the zero pool */
+	size_t zpool_misses;	/* calloc() in pool range not served by it */
+	size_t zpool_blocks;	/* blocks currently held by the zero pool */
+	size_t zpool_bytes;	/* bytes currently held by the zero pool */
+	size_t large_hits;	/* large blocks served by the mapping cache */
+	size_t large_misses;	/* large blocks mapped from the system */
+	size_t large_blocks;	/* mappings currently held by the cache */
+	size_t large_bytes;	/* bytes currently held by the cache */
+	size_t release_ranges;	/* ranges unmapped or purged */
+	size_t release_syscalls;	/* syscalls used to release them */
+	size_t huge_regions;	/* hugepage regions currently mapped */
+	size_t huge_purged;	/* idle hugepage regions given back */
+	size_t huge_backed_bytes;	/* process memory backed by hugepages */
+	size_t pressure_purges;	/* purges due to memory pressure */
+	size_t pressure_purged_bytes;	/* bytes given back by these purges */
+	size_t realloc_in_place;	/* realloc() without copy */
+	size_t realloc_saved_bytes;	/* bytes not copied nor scrubbed */
+	size_t realloc_predicted;	/* blocks grown more than requested */
+	size_t trims;		/* background malloc_trim() calls */
+	size_t trim_reclaimed_bytes;	/* RSS reclaimed by these calls */
+	size_t clean_marked;	/* blocks marked clean by clean_write */
+	size_t clean_skipped_bytes;	/* bytes free() found already 0 */
+};
+
+void clean_malloc_get_stats(struct clean_malloc_stats *stats);
+
+/**
+ * Give the memory held in the library caches back to the allocator.
+ */
+void clean_malloc_trim(void);
+
+/**
+ * Tell the library that the first len bytes of the block ptr (as
+ * returned by malloc() and the like) have just been scrubbed, as
+ * clean_write.so does for the buffers it scrubs after a write. free()
+ * then only reads the block up to the first byte written since,
+ * instead of writing zeros over it again.
+ * Returns 1 if ptr is one of our blocks and len covers it, 0 otherwise.
+ */
+int clean_malloc_mark_clean(void *ptr, size_t len);
+
+/**
+ * Tell the library that the first len bytes of the block ptr (as
+ * returned by malloc() and the like) are going to be scrubbed later, as
+ * clean_write.so does in its deferred mode. free() and realloc() then
+ * have clean_write_forget() drop the pending scrubs before the block is
+ * released or resized. Each mark is undone by
+ * clean_malloc_unmark_deferred() once the scrub is done or dropped.
+ * Returns 1 if ptr is one of our blocks, len does not go past it and
+ * clean_write.so is loaded, 0 otherwise: the caller must then scrub the
+ * bytes right away.
+ */
+int clean_malloc_mark_deferred(void *ptr, size_t len);
+
+/**
+ * Undo one clean_malloc_mark_deferred() of the block ptr. Returns the
+ * number of scrubs still pending on it.
+ */
+int clean_malloc_unmark_deferred(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLEAN_MALLOC_H */
@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_pmr.cpp
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief C++ memory resources and allocator scrubbing on deallocation.
+ *
+ * Changes:
+ *
+ */
+
+#include "clean_pmr.hpp"
+
+extern "C" {
+#include "clean_malloc.h"
+#include "clean_scrub.h"
+}
+
+namespace clean {
+
+void scrub(void *p, std::size_t n) noexcept
+{
+	clean_scrub(p, n);
+}
+
+/*
+ * scrubbing_resource
+ */
+void *scrubbing_resource::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+	return upstream_->allocate(bytes, alignment);
+}
+
+void scrubbing_resource::do_deallocate(void *p, std::size_t bytes,
+				       std::size_t alignment)
+{
+	clean_scrub(p, bytes);
+	upstream_->deallocate(p, bytes, alignment);
+}
+
+bool scrubbing_resource::do_is_equal(const std::pmr::memory_resource &other)
+    const noexcept
+{
+	const scrubbing_resource *res =
+	    dynamic_cast<const scrubbing_resource *>(&other);
+
+	return res && (*upstream_ == *res->upstream_);
+}
+
+/*
+ * scrubbing_monotonic_resource
+ */
+scrubbing_monotonic_resource::scrubbing_monotonic_resource(std::size_t
+							   chunk_size)
+:arena_(clean_arena_create(chunk_size, 0))
+{
+	if (!arena_) {
+		throw std::bad_alloc();
+	}
+}
+
+scrubbing_monotonic_resource::~scrubbing_monotonic_resource()
+{
+	clean_arena_destroy(arena_);
+}
+
+void scrubbing_monotonic_resource::release() noexcept
+{
+	clean_arena_reset(arena_);
+}
+
+void *scrubbing_monotonic_resource::do_allocate(std::size_t bytes,
+						std::size_t alignment)
+{
+	void *p = clean_arena_memalign(arena_, alignment, bytes);
+
+	if (!p) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+/**
+ * Like std::pmr::monotonic_buffer_resource, individual deallocations
+ * are ignored: the memory is scrubbed by release() or the destructor.
+ */
+void scrubbing_monotonic_resource::do_deallocate(void *, std::size_t,
+						 std::size_t)
+{
+}
+
+bool scrubbing_monotonic_resource::do_is_equal(const std::pmr::
+					       memory_resource &other)
+    const noexcept
+{
+	return this == &other;
+}
+
+/*
+ * basic_scrubbing_pool_resource
+ */
+template <class Pool>
+void *basic_scrubbing_pool_resource<Pool>::do_allocate(std::size_t bytes,
+						       std::size_t alignment)
+{
+	return pool_.allocate(bytes, alignment);
+}
+
+/**
+ * The block is scrubbed before the pool can hand it out again.
+ */
+template <class Pool>
+void basic_scrubbing_pool_resource<Pool>::do_deallocate(void *p,
+							std::size_t bytes,
+							std::size_t alignment)
+{
+	clean_scrub(p, bytes);
+	pool_.deallocate(p, bytes, alignment);
+}
+
+template <class Pool>
+bool basic_scrubbing_pool_resource<Pool>::do_is_equal(const std::pmr::
+						      memory_resource &other)
+    const noexcept
+{
+	return this == &other;
+}
+
+template class basic_scrubbing_pool_resource <
+    std::pmr::synchronized_pool_resource >;
+template class basic_scrubbing_pool_resource <
+    std::pmr::unsynchronized_pool_resource >;
+
+}				/* namespace clean */
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_pmr.hpp
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief C++ memory resources and allocator scrubbing on deallocation.
+ *
+ * This is the opt-in alternative to LD_PRELOAD=./clean_malloc.so for
+ * C++ code: containers select scrubbing per instance. The size of a
+ * block is given back by deallocate(p, n) so no header is added to the
+ * allocated memory.
+ *
+ * - clean::scrubbing_resource: scrubs then gives the block back to an
+ *   upstream resource (new/delete by default).
+ * - clean::scrubbing_monotonic_resource: bump allocates from a
+ *   clean_arena, release() scrubs everything in one pass.
+ * - clean::scrubbing_pool_resource (and its unsynchronized variant):
+ *   scrubs the block before it goes back to a std::pmr pool.
+ * - clean::allocator<T>: standard allocator scrubbing on deallocate.
+ *
+ * Usage: link with clean_pmr.so (C++17).
+ */
+
+#ifndef CLEAN_PMR_HPP
+#define CLEAN_PMR_HPP
+
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+
+struct clean_arena;
+
+namespace clean {
+
+/**
+ * Set n bytes at p to 0 with the library scrub kernel.
+ */
+void scrub(void *p, std::size_t n) noexcept;
+
+class scrubbing_resource : public std::pmr::memory_resource {
+public:
+	explicit scrubbing_resource(std::pmr::memory_resource *upstream =
+				    std::pmr::new_delete_resource()) noexcept
+	: upstream_(upstream) {
+	}
+
+	std::pmr::memory_resource *upstream_resource() const noexcept {
+		return upstream_;
+	}
+
+protected:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void *p, std::size_t bytes,
+			   std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource &other)
+	    const noexcept override;
+
+private:
+	std::pmr::memory_resource *upstream_;
+};
+
+class scrubbing_monotonic_resource : public std::pmr::memory_resource {
+public:
+	explicit scrubbing_monotonic_resource(std::size_t chunk_size = 0);
+	~scrubbing_monotonic_resource() override;
+
+	scrubbing_monotonic_resource(const scrubbing_monotonic_resource &) =
+	    delete;
+	scrubbing_monotonic_resource &operator=(const
+						scrubbing_monotonic_resource &)
+	    = delete;
+
+	/* Scrub all memory handed out so far and make it available again */
+	void release() noexcept;
+
+protected:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void *p, std::size_t bytes,
+			   std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource &other)
+	    const noexcept override;
+
+private:
+	struct clean_arena *arena_;
+};
+
+template <class Pool>
+class basic_scrubbing_pool_resource : public std::pmr::memory_resource {
+public:
+	basic_scrubbing_pool_resource() : pool_() {
+	}
+
+	explicit basic_scrubbing_pool_resource(const std::pmr::pool_options &
+					       opts,
+					       std::pmr::memory_resource *
+					       upstream =
+					       std::pmr::new_delete_resource())
+	: pool_(opts, upstream) {
+	}
+
+	void release() {
+		pool_.release();
+	}
+
+	std::pmr::pool_options options() const {
+		return pool_.options();
+	}
+
+protected:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void *p, std::size_t bytes,
+			   std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource &other)
+	    const noexcept override;
+
+private:
+	Pool pool_;
+};
+
+extern template class basic_scrubbing_pool_resource <
+    std::pmr::synchronized_pool_resource >;
+extern template class basic_scrubbing_pool_resource <
+    std::pmr::unsynchronized_pool_resource >;
+
+using scrubbing_pool_resource =
+    basic_scrubbing_pool_resource<std::pmr::synchronized_pool_resource>;
+using unsynchronized_scrubbing_pool_resource =
+    basic_scrubbing_pool_resource<std::pmr::unsynchronized_pool_resource>;
+
+/**
+ * Drop-in replacement for std::allocator<T> scrubbing on deallocate.
+ */
+template <class T>
+class allocator {
+public:
+	using value_type = T;
+
+	allocator() noexcept = default;
+
+	template <class U>
+	allocator(const allocator<U> &) noexcept {
+	}
+
+	T *allocate(std::size_t n) {
+		if (n > (static_cast<std::size_t>(-1) / sizeof(T))) {
+			throw std::bad_array_new_length();
+		}
+		return static_cast<T *>(::operator new(n * sizeof(T),
+						       std::align_val_t
+						       (alignof(T))));
+	}
+
+	void deallocate(T *p, std::size_t n) noexcept {
+		scrub(p, n * sizeof(T));
+		::operator delete(p, std::align_val_t(alignof(T)));
+	}
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept
+{
+	return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept
+{
+	return false;
+}
+
+}				/* namespace clean */
+
+#endif /* CLEAN_PMR_HPP */
@@ -0,0 +1,378 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_scrub.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief memory scrubbing kernels shared by the interposing libraries.
+ *
+ * Changes:
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCRUB_HAVE_NT
+#endif
+
+#include "clean_scrub.h"
+
+#define SCRUB_NT_DEFAULT_LLC	(8 * 1024 * 1024)
+#define SCRUB_NT_MIN_THRESHOLD	(256 * 1024)
+#define SCRUB_LINE		64
+#define SCRUB_SMALL_MAX		64
+#define SCRUB_PREFETCH_AHEAD	4
+
+/**
+ * The glibc memset is already selected at load time for the running CPU
+ * (through an ifunc) so it is the fastest generic kernel we have.
+ * The empty asm statement tells the compiler the memory is used
+ * afterward so the memset cannot be optimized away as a dead store.
+ */
+void clean_scrub(void *ptr, size_t len)
+{
+	if (ptr && len) {
+		memset(ptr, 0, len);
+		__asm__ __volatile__(""::"r"(ptr):"memory");
+	}
+}
+
+/*
+ * Non-temporal scrubbing.
+ *
+ * Streaming stores write whole cache lines straight to memory without
+ * reading them first nor evicting the working set of the application
+ * from the cache. They only pay off for buffers too large to stay in
+ * the last level cache anyway, so below a threshold (half the LLC by
+ * default, CLEAN_SCRUB_NT_MIN to override, 0 to disable) the regular
+ * kernel is used. The widest store supported by the CPU is selected
+ * once at load time.
+ */
+static size_t nt_threshold = SIZE_MAX;
+static void (*nt_kernel) (char *ptr, size_t len);
+
+#ifdef SCRUB_HAVE_NT
+/* ptr is aligned on SCRUB_LINE and len is a multiple of it */
+__attribute__ ((target("sse2")))
+static void scrub_nt_sse2(char *ptr, size_t len)
+{
+	__m128i zero = _mm_setzero_si128();
+	char *end = ptr + len;
+
+	for (; ptr < end; ptr += SCRUB_LINE) {
+		_mm_stream_si128((__m128i *) ptr, zero);
+		_mm_stream_si128((__m128i *) (ptr + 16), zero);
+		_mm_stream_si128((__m128i *) (ptr + 32), zero);
+		_mm_stream_si128((__m128i *) (ptr + 48), zero);
+	}
+}
+
+__attribute__ ((target("avx2")))
+static void scrub_nt_avx2(char *ptr, size_t len)
+{
+	__m256i zero = _mm256_setzero_si256();
+	char *end = ptr + len;
+
+	for (; ptr < end; ptr += SCRUB_LINE) {
+		_mm256_stream_si256((__m256i *) ptr, zero);
+		_mm256_stream_si256((__m256i *) (ptr + 32), zero);
+	}
+}
+#endif
+
+/*
+ * Zero check.
+ *
+ * Reading memory known to be mostly 0 is cheaper than writing it again:
+ * loads do not dirty the cache lines so nothing is written back, and
+ * the CPU issues more loads than stores per cycle. The widest load is
+ * selected once at load time.
+ */
+static size_t zero_prefix_generic(const char *ptr, size_t len)
+{
+	const uint64_t *cur = (const uint64_t *)ptr;
+	size_t off;
+
+	for (off = 0; off < len; off += SCRUB_LINE, cur += 8) {
+		if (cur[0] | cur[1] | cur[2] | cur[3] |
+		    cur[4] | cur[5] | cur[6] | cur[7]) {
+			break;
+		}
+	}
+
+	return off;
+}
+
+static size_t (*zero_kernel) (const char *ptr, size_t len) =
+    zero_prefix_generic;
+
+#ifdef SCRUB_HAVE_NT
+__attribute__ ((target("sse2")))
+static size_t zero_prefix_sse2(const char *ptr, size_t len)
+{
+	size_t off;
+
+	for (off = 0; off < len; off += SCRUB_LINE) {
+		const __m128i *cur = (const __m128i *)(ptr + off);
+		__m128i v = _mm_or_si128(_mm_or_si128(_mm_load_si128(cur),
+						      _mm_load_si128(cur + 1)),
+					 _mm_or_si128(_mm_load_si128(cur + 2),
+						      _mm_load_si128(cur + 3)));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))
+		    != 0xffff) {
+			break;
+		}
+	}
+
+	return off;
+}
+
+__attribute__ ((target("avx2")))
+static size_t zero_prefix_avx2(const char *ptr, size_t len)
+{
+	size_t off;
+
+	for (off = 0; off < len; off += SCRUB_LINE) {
+		const __m256i *cur = (const __m256i *)(ptr + off);
+		__m256i v = _mm256_or_si256(_mm256_loadu_si256(cur),
+					    _mm256_loadu_si256(cur + 1));
+
+		if (!_mm256_testz_si256(v, v)) {
+			break;
+		}
+	}
+
+	return off;
+}
+#endif
+
+size_t clean_zero_prefix(const void *ptr, size_t len)
+{
+	return zero_kernel(ptr, len & ~((size_t)SCRUB_LINE - 1));
+}
+
+/**
+ * Size of the last level cache, from the C library or sysfs.
+ */
+static size_t scrub_llc_size(void)
+{
+	long size = 0;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (size <= 0) {
+		size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	}
+#endif
+
+	return (size > 0) ? (size_t)size : SCRUB_NT_DEFAULT_LLC;
+}
+
+CLEAN_CONSTRUCTOR void clean_scrub_init(void)
+{
+	size_t threshold;
+
+#ifdef SCRUB_HAVE_NT
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		nt_kernel = scrub_nt_avx2;
+		zero_kernel = zero_prefix_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		nt_kernel = scrub_nt_sse2;
+		zero_kernel = zero_prefix_sse2;
+	}
+#endif
+
+	threshold = clean_env_size("CLEAN_SCRUB_NT_MIN", scrub_llc_size() / 2);
+	if (!threshold || !nt_kernel) {
+		return;
+	}
+
+	nt_threshold = (threshold < SCRUB_NT_MIN_THRESHOLD) ?
+	    SCRUB_NT_MIN_THRESHOLD : threshold;
+}
+
+void clean_scrub_nt(void *ptr, size_t len)
+{
+	char *cur = ptr;
+	size_t head;
+	size_t body;
+
+	if (!ptr || (len < nt_threshold)) {
+		clean_scrub(ptr, len);
+		return;
+	}
+
+	/* partial lines at both ends go through the regular kernel */
+	head = (-(uintptr_t) cur) & (SCRUB_LINE - 1);
+	clean_scrub(cur, head);
+	cur += head;
+	len -= head;
+
+	body = len & ~((size_t)SCRUB_LINE - 1);
+	nt_kernel(cur, body);
+#ifdef SCRUB_HAVE_NT
+	/* streaming stores are weakly ordered */
+	_mm_sfence();
+#endif
+
+	clean_scrub(cur + body, len - body);
+}
+
+/*
+ * Small runs.
+ *
+ * Vectored writes often carry many tiny segments (headers, length
+ * prefixes) and a memset() call for each costs more than the stores
+ * themselves. Runs up to SCRUB_SMALL_MAX bytes are written inline with
+ * unaligned 16 bytes stores, the last one overlapping the previous if
+ * needed. SSE2 is always there on x86_64.
+ */
+static inline void scrub_small(char *ptr, size_t len)
+{
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	char *end = ptr + len;
+
+	uint32_t zero32 = 0;
+
+	if (len >= 16) {
+		for (; (ptr + 16) < end; ptr += 16) {
+			_mm_storeu_si128((__m128i *) ptr, zero);
+			/* or gcc turns the loop back into a memset() call */
+			__asm__("":"+r"(ptr));
+		}
+		_mm_storeu_si128((__m128i *) (end - 16), zero);
+	} else if (len >= 8) {
+		_mm_storel_epi64((__m128i *) ptr, zero);
+		_mm_storel_epi64((__m128i *) (end - 8), zero);
+	} else if (len >= 4) {
+		memcpy(ptr, &zero32, 4);
+		memcpy(end - 4, &zero32, 4);
+	} else if (len) {
+		ptr[0] = 0;
+		ptr[len / 2] = 0;
+		end[-1] = 0;
+	}
+	__asm__ __volatile__(""::"r"(end):"memory");
+#else
+	clean_scrub(ptr, len);
+#endif
+}
+
+/*
+ * Contiguous range accumulated across iovecs so that buffers laid out
+ * back to back are scrubbed with a single call.
+ */
+struct scrub_run {
+	char *base;
+	size_t len;
+};
+
+static inline void scrub_run_flush(struct scrub_run *run)
+{
+	if (run->len <= SCRUB_SMALL_MAX) {
+		scrub_small(run->base, run->len);
+	} else {
+		clean_scrub_nt(run->base, run->len);
+	}
+}
+
+static inline void scrub_run_add(struct scrub_run *run, void *base, size_t len)
+{
+	if ((run->base + run->len) == (char *)base) {
+		run->len += len;
+		return;
+	}
+
+	scrub_run_flush(run);
+	run->base = base;
+	run->len = len;
+}
+
+/**
+ * Add the first len bytes of an iovec array to the run. The segment
+ * SCRUB_PREFETCH_AHEAD places ahead is prefetched so that runs of small
+ * segments do not wait for each cache miss in turn.
+ */
+static void scrub_run_iov(struct scrub_run *run, const struct iovec *iov,
+			  size_t iovcnt, size_t len)
+{
+	size_t i;
+
+	if (!iov) {
+		return;
+	}
+
+	for (i = 1; (i < SCRUB_PREFETCH_AHEAD) && (i < iovcnt); i++) {
+		__builtin_prefetch(iov[i].iov_base, 1);
+	}
+
+	for (i = 0; (i < iovcnt) && len; i++) {
+		size_t n = (iov[i].iov_len < len) ? iov[i].iov_len : len;
+
+		if ((i + SCRUB_PREFETCH_AHEAD) < iovcnt) {
+			__builtin_prefetch(iov[i + SCRUB_PREFETCH_AHEAD].iov_base, 1);
+		}
+
+		len -= n;
+		if (!n || !iov[i].iov_base) {
+			continue;
+		}
+
+		scrub_run_add(run, iov[i].iov_base, n);
+	}
+}
+
+void clean_scrub_iov(const struct iovec *iov, int iovcnt, size_t len)
+{
+	struct scrub_run run = { NULL, 0 };
+
+	if (iovcnt > 0) {
+		scrub_run_iov(&run, iov, iovcnt, len);
+	}
+
+	scrub_run_flush(&run);
+}
+
+void clean_scrub_mmsg(const struct mmsghdr *vec, unsigned int vlen)
+{
+	struct scrub_run run = { NULL, 0 };
+	unsigned int i;
+
+	if (!vec) {
+		return;
+	}
+
+	for (i = 0; i < vlen; i++) {
+		const struct msghdr *msg = &vec[i].msg_hdr;
+
+		scrub_run_iov(&run, msg->msg_iov, msg->msg_iovlen,
+			      vec[i].msg_len);
+	}
+
+	scrub_run_flush(&run);
+}
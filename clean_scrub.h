@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_scrub.h
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief memory scrubbing kernels shared by the interposing libraries.
+ *
+ * These functions are internal to each library. They are compiled in
+ * every shared object that needs them and are not exported so that
+ * several of our libraries can be preloaded at the same time.
+ */
+
+#ifndef CLEAN_SCRUB_H
+#define CLEAN_SCRUB_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "clean_common.h"
+
+/**
+ * Select the kernels for the running CPU and read CLEAN_SCRUB_NT_MIN.
+ * The kernels can be used before, without non-temporal stores.
+ */
+CLEAN_HIDDEN void clean_scrub_init(void);
+
+/**
+ * Set len bytes at ptr to 0. Unlike a plain memset() the compiler is
+ * not allowed to drop the call even if the memory is never read again.
+ */
+CLEAN_HIDDEN void clean_scrub(void *ptr, size_t len);
+
+/**
+ * Same as clean_scrub() for memory that will not be read again soon.
+ * Large buffers are written with non-temporal (streaming) stores that
+ * bypass the cache, the others with clean_scrub().
+ */
+CLEAN_HIDDEN void clean_scrub_nt(void *ptr, size_t len);
+
+/**
+ * Return the length of the leading part of the first len bytes at ptr
+ * that is all 0, by steps of 64 bytes (a cache line). ptr is aligned on
+ * 16 bytes. The memory is only read.
+ */
+CLEAN_HIDDEN size_t clean_zero_prefix(const void *ptr, size_t len);
+
+/**
+ * Set to 0 the first len bytes described by an iovec array.
+ * Adjacent iovecs are merged into a single scrub and the segments a few
+ * places ahead are prefetched while the current one is written. Small
+ * merged runs are written with inline vector stores, the others with
+ * clean_scrub_nt().
+ */
+CLEAN_HIDDEN void clean_scrub_iov(const struct iovec *iov, int iovcnt,
+				  size_t len);
+
+/**
+ * Set to 0 the bytes sent by the first vlen messages of a sendmmsg()
+ * vector (msg_len bytes of each message) in a single pass over all
+ * their iovecs.
+ */
+struct mmsghdr;
+CLEAN_HIDDEN void clean_scrub_mmsg(const struct mmsghdr *vec,
+				   unsigned int vlen);
+
+#endif /* CLEAN_SCRUB_H */
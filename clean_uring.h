@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_uring.h
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief io_uring buffer scrubbing helpers exported by clean_write.so.
+ *
+ * Writes submitted through io_uring do not go through the interposed
+ * functions and their buffers must not be touched before the kernel
+ * posts their completion. A tracker records the buffers of write and
+ * send requests by user_data and scrubs them, in one batch, once their
+ * completions have been reaped.
+ *
+ * A tracker follows the threading rules of its ring: it is not thread
+ * safe.
+ *
+ * When liburing.h is included before this file, inline wrappers around
+ * the liburing prep and CQE reap functions are provided as well.
+ *
+ * Usage: link with clean_write.so.
+ */
+
+#ifndef CLEAN_URING_H
+#define CLEAN_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct clean_uring;
+
+/**
+ * Create a tracker sized for entries requests in flight (it grows if
+ * needed). Returns NULL on failure.
+ */
+struct clean_uring *clean_uring_create(unsigned int entries);
+
+/**
+ * Release a tracker. Buffers still in flight are scrubbed, so call it
+ * once the ring has been torn down.
+ */
+void clean_uring_destroy(struct clean_uring *cu);
+
+/**
+ * Record the buffer of a request written to fd (-1 for a registered
+ * file, the clean_write fd policy is then not applied). The buffer of a
+ * request with the same user_data still in flight is queued whole for
+ * the next scrub. Returns 0 or -1 if the buffer could not be recorded.
+ */
+int clean_uring_track(struct clean_uring *cu, uint64_t user_data, int fd,
+		      const void *buf, size_t len);
+
+int clean_uring_track_iov(struct clean_uring *cu, uint64_t user_data, int fd,
+			  const struct iovec *iov, int iovcnt);
+
+/**
+ * Report a completion (cqe->user_data, cqe->res, cqe->flags). The first
+ * res bytes of the request buffer are queued for scrubbing, nothing on
+ * error. For zerocopy sends the buffer is queued on the notification
+ * (IORING_CQE_F_NOTIF) that follows the IORING_CQE_F_MORE completion.
+ */
+void clean_uring_complete(struct clean_uring *cu, uint64_t user_data, int res,
+			  unsigned int flags);
+
+/**
+ * Scrub all the queued buffers in one pass.
+ */
+void clean_uring_scrub(struct clean_uring *cu);
+
+#ifdef LIB_URING_H
+/*
+ * liburing wrappers: prepare a request and track its buffer, or reap a
+ * batch of completions and scrub their buffers.
+ */
+static inline void clean_io_uring_prep_write(struct clean_uring *cu,
+					     struct io_uring_sqe *sqe, int fd,
+					     const void *buf, unsigned int nbytes,
+					     __u64 offset, __u64 user_data)
+{
+	io_uring_prep_write(sqe, fd, buf, nbytes, offset);
+	io_uring_sqe_set_data64(sqe, user_data);
+	clean_uring_track(cu, user_data, fd, buf, nbytes);
+}
+
+static inline void clean_io_uring_prep_writev(struct clean_uring *cu,
+					      struct io_uring_sqe *sqe, int fd,
+					      const struct iovec *iovecs,
+					      unsigned int nr_vecs,
+					      __u64 offset, __u64 user_data)
+{
+	io_uring_prep_writev(sqe, fd, iovecs, nr_vecs, offset);
+	io_uring_sqe_set_data64(sqe, user_data);
+	clean_uring_track_iov(cu, user_data, fd, iovecs, nr_vecs);
+}
+
+static inline void clean_io_uring_prep_send(struct clean_uring *cu,
+					    struct io_uring_sqe *sqe,
+					    int sockfd, const void *buf,
+					    size_t len, int flags,
+					    __u64 user_data)
+{
+	io_uring_prep_send(sqe, sockfd, buf, len, flags);
+	io_uring_sqe_set_data64(sqe, user_data);
+	clean_uring_track(cu, user_data, sockfd, buf, len);
+}
+
+static inline void clean_io_uring_prep_send_zc(struct clean_uring *cu,
+					       struct io_uring_sqe *sqe,
+					       int sockfd, const void *buf,
+					       size_t len, int flags,
+					       unsigned int zc_flags,
+					       __u64 user_data)
+{
+	io_uring_prep_send_zc(sqe, sockfd, buf, len, flags, zc_flags);
+	io_uring_sqe_set_data64(sqe, user_data);
+	clean_uring_track(cu, user_data, sockfd, buf, len);
+}
+
+static inline void clean_io_uring_prep_sendmsg(struct clean_uring *cu,
+					       struct io_uring_sqe *sqe,
+					       int sockfd,
+					       const struct msghdr *msg,
+					       unsigned int flags,
+					       __u64 user_data)
+{
+	io_uring_prep_sendmsg(sqe, sockfd, msg, flags);
+	io_uring_sqe_set_data64(sqe, user_data);
+	clean_uring_track_iov(cu, user_data, sockfd, msg->msg_iov,
+			      msg->msg_iovlen);
+}
+
+/**
+ * Same as io_uring_peek_batch_cqe() followed by io_uring_cq_advance():
+ * the CQEs are copied to cqes, their buffers scrubbed and the CQ ring
+ * advanced. Returns the number of CQEs reaped.
+ */
+static inline unsigned int clean_io_uring_reap(struct clean_uring *cu,
+					       struct io_uring *ring,
+					       struct io_uring_cqe *cqes,
+					       unsigned int count)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	unsigned int n = 0;
+
+	io_uring_for_each_cqe(ring, head, cqe) {
+		if (n == count) {
+			break;
+		}
+		cqes[n++] = *cqe;
+		clean_uring_complete(cu, cqe->user_data, cqe->res, cqe->flags);
+	}
+
+	io_uring_cq_advance(ring, n);
+	clean_uring_scrub(cu);
+
+	return n;
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLEAN_URING_H */
@@ -25,34 +25,175 @@
  * - send
  * - sendto
  * - sendmsg
+ * - writev
+ * - pwrite
+ * - pwritev
+ * - pwritev2
+ * - pwrite64, pwritev64, pwritev64v2 (64 bit systems)
+ * - sendmmsg
+ * - close
+ * - close_range
+ * - dup
+ * - dup2
+ * - dup3
+ * - fcntl, fcntl64 (64 bit systems)
+ * - socket
+ * - socketpair
+ * - accept
+ * - accept4
+ * - mmap, mmap64 (64 bit systems)
+ * - munmap
+ * - mprotect
+ * - mremap
+ * - pthread_create
+ * - recvmsg
+ * - vmsplice
+ * - aio_write
+ * - lio_listio
+ * - aio_return
+ * - aio_suspend
+ * - fflush
+ * - fclose
+ * - setvbuf
  *
  * In turn these functions will use the following functions from glibc.
  * - write
  * - send
  * - sendto
  * - sendmsg
+ * - writev
+ * - pwrite
+ * - pwritev
+ * - pwritev2
+ * - sendmmsg
+ * - close
+ * - dup2
+ * - dup3
+ * - socket
+ * - accept
+ * - accept4
+ * - mmap
+ * - munmap
+ * - mprotect
+ * - mremap
+ * - pthread_create
+ * - recvmsg
+ * - vmsplice
+ * - aio_write
+ * - lio_listio
+ * - aio_return
+ * - aio_suspend
+ * - aio_error
+ * - fflush
+ * - fclose
+ * - setvbuf
+ * - _IO_list_all, _IO_list_lock, _IO_list_unlock
  *
  * Usage: LD_PRELOAD=./clean_write.so command args ...
  *
+ * Environment:
+ * - CLEAN_WRITE_SCRUB: comma separated list of the fd classes whose
+ *   buffers are scrubbed among inet, inet6, unix, socket (any other
+ *   family), file, pipe, tty, other and all (default all).
+ * - CLEAN_WRITE_REGIONS: only scrub buffers in writable private
+ *   anonymous or heap memory (default 1).
+ * - CLEAN_WRITE_DEFERRED: scrub the blocks of clean_malloc from a helper
+ *   thread instead of the calling thread (default 0). See clean_write.h.
+ * - CLEAN_WRITE_DEFERRED_MIN: smaller buffers are still scrubbed by
+ *   the caller (default 4K).
+ * - CLEAN_WRITE_DEFERRED_DELAY_MS: helper thread period (default 1).
+ * - CLEAN_WRITE_STDIO: fd classes (same names as CLEAN_WRITE_SCRUB)
+ *   whose stdio stream buffers are scrubbed after each flush (default
+ *   none). See clean_write.h.
+ * - CLEAN_WRITE_ZEROCOPY_LINGER_MS: how long closing a socket waits for
+ *   the completions of its pending MSG_ZEROCOPY sends (default 100, 0
+ *   does not wait).
+ *
  * Changes:
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <aio.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
 
-#define __USE_GNU
 #include <dlfcn.h>
 
+#include "clean_write.h"
+#include "clean_uring.h"
+#include "clean_scrub.h"
+#include "clean_common.h"
+#include "clean_bg.h"
+
 static ssize_t default_write(int fd, const void *buf, size_t count);
 static ssize_t default_sendto(int sockfd, const void *buf, size_t len,
 			      int flags, const struct sockaddr *dest_addr,
 			      socklen_t addrlen);
 static ssize_t default_sendmsg(int sockfd, const struct msghdr *msg, int flags);
+static ssize_t default_writev(int fd, const struct iovec *iov, int iovcnt);
+static ssize_t default_pwrite(int fd, const void *buf, size_t count,
+			      off_t offset);
+static ssize_t default_pwritev(int fd, const struct iovec *iov, int iovcnt,
+			       off_t offset);
+static ssize_t default_pwritev2(int fd, const struct iovec *iov, int iovcnt,
+				off_t offset, int flags);
+static int default_sendmmsg(int sockfd, struct mmsghdr *msgvec,
+			    unsigned int vlen, int flags);
+static int default_close(int fd);
+static int default_close_range(unsigned int first, unsigned int last,
+			       int flags);
+static int default_dup(int oldfd);
+static int default_dup2(int oldfd, int newfd);
+static int default_dup3(int oldfd, int newfd, int flags);
+static int default_fcntl(int fd, int cmd, ...);
+static int default_socket(int domain, int type, int protocol);
+static int default_socketpair(int domain, int type, int protocol, int sv[2]);
+static int default_accept(int sockfd, struct sockaddr *addr,
+			  socklen_t * addrlen);
+static int default_accept4(int sockfd, struct sockaddr *addr,
+			   socklen_t * addrlen, int flags);
+static void *default_mmap(void *addr, size_t length, int prot, int flags,
+			  int fd, off_t offset);
+static int default_munmap(void *addr, size_t length);
+static int default_mprotect(void *addr, size_t len, int prot);
+static void *default_mremap(void *old_address, size_t old_size,
+			    size_t new_size, int flags, ...);
+static int default_pthread_create(pthread_t * thread,
+				  const pthread_attr_t * attr,
+				  void *(*start) (void *), void *arg);
+static ssize_t default_recvmsg(int sockfd, struct msghdr *msg, int flags);
+static ssize_t default_vmsplice(int fd, const struct iovec *iov,
+				size_t nr_segs, unsigned int flags);
+static int default_aio_write(struct aiocb *aiocbp);
+static int default_lio_listio(int mode, struct aiocb *const list[], int nent,
+			      struct sigevent *sevp);
+static ssize_t default_aio_return(struct aiocb *aiocbp);
+static int default_aio_suspend(const struct aiocb *const list[], int nent,
+			       const struct timespec *timeout);
+static int default_aio_error(const struct aiocb *aiocbp);
+static int default_fflush(FILE * stream);
+static int default_fclose(FILE * stream);
+static int default_setvbuf(FILE * stream, char *buf, int mode, size_t size);
 
 static ssize_t(*real_write) (int fd, const void *buf, size_t count) =
     default_write;
@@ -61,170 +202,4009 @@ static ssize_t(*real_sendto) (int sockfd, const void *buf, size_t len,
 			      socklen_t addrlen) = default_sendto;
 static ssize_t(*real_sendmsg) (int sockfd, const struct msghdr * msg,
 			       int flags) = default_sendmsg;
+static ssize_t(*real_writev) (int fd, const struct iovec * iov, int iovcnt) =
+    default_writev;
+static ssize_t(*real_pwrite) (int fd, const void *buf, size_t count,
+			      off_t offset) = default_pwrite;
+static ssize_t(*real_pwritev) (int fd, const struct iovec * iov, int iovcnt,
+			       off_t offset) = default_pwritev;
+static ssize_t(*real_pwritev2) (int fd, const struct iovec * iov, int iovcnt,
+				off_t offset, int flags) = default_pwritev2;
+static int (*real_sendmmsg) (int sockfd, struct mmsghdr * msgvec,
+			     unsigned int vlen, int flags) = default_sendmmsg;
+static int (*real_close) (int fd) = default_close;
+static int (*real_close_range) (unsigned int first, unsigned int last,
+				int flags) = default_close_range;
+static int (*real_dup) (int oldfd) = default_dup;
+static int (*real_dup2) (int oldfd, int newfd) = default_dup2;
+static int (*real_dup3) (int oldfd, int newfd, int flags) = default_dup3;
+static int (*real_fcntl) (int fd, int cmd, ...) = default_fcntl;
+static int (*real_socket) (int domain, int type, int protocol) =
+    default_socket;
+static int (*real_socketpair) (int domain, int type, int protocol,
+			       int sv[2]) = default_socketpair;
+static int (*real_accept) (int sockfd, struct sockaddr * addr,
+			   socklen_t * addrlen) = default_accept;
+static int (*real_accept4) (int sockfd, struct sockaddr * addr,
+			    socklen_t * addrlen, int flags) = default_accept4;
+static void *(*real_mmap) (void *addr, size_t length, int prot, int flags,
+			   int fd, off_t offset) = default_mmap;
+static int (*real_munmap) (void *addr, size_t length) = default_munmap;
+static int (*real_mprotect) (void *addr, size_t len, int prot) =
+    default_mprotect;
+static void *(*real_mremap) (void *old_address, size_t old_size,
+			     size_t new_size, int flags, ...) = default_mremap;
+static int (*real_pthread_create) (pthread_t * thread,
+				   const pthread_attr_t * attr,
+				   void *(*start) (void *), void *arg) =
+    default_pthread_create;
+static ssize_t(*real_recvmsg) (int sockfd, struct msghdr * msg, int flags) =
+    default_recvmsg;
+static ssize_t(*real_vmsplice) (int fd, const struct iovec * iov,
+				size_t nr_segs, unsigned int flags) =
+    default_vmsplice;
+static int (*real_aio_write) (struct aiocb * aiocbp) = default_aio_write;
+static int (*real_lio_listio) (int mode, struct aiocb * const list[], int nent,
+			       struct sigevent * sevp) = default_lio_listio;
+static ssize_t(*real_aio_return) (struct aiocb * aiocbp) = default_aio_return;
+static int (*real_aio_suspend) (const struct aiocb * const list[], int nent,
+				const struct timespec * timeout) =
+    default_aio_suspend;
+static int (*real_aio_error) (const struct aiocb * aiocbp) = default_aio_error;
+static int (*real_fflush) (FILE * stream) = default_fflush;
+static int (*real_fclose) (FILE * stream) = default_fclose;
+static int (*real_setvbuf) (FILE * stream, char *buf, int mode, size_t size) =
+    default_setvbuf;
 
-#define MIN(a,b)	((a>b) ? b : a)
+/*
+ * Per fd classification cache.
+ *
+ * Each fd below FD_CACHE_SIZE has one byte holding its class and
+ * whether the policy asks to scrub it, so the hot path is a single
+ * array load. 0 means not classified yet: the fd is then looked at
+ * with fstat() and getsockname() on its first use.
+ *
+ * An entry is reset when its fd is closed or replaced (close,
+ * close_range, dup2, dup3, fclose) and when a new fd is created (dup,
+ * fcntl F_DUPFD, socket, socketpair, accept, accept4) as the previous fd
+ * with that number may have been closed by the libc itself (freopen,
+ * popen, ...) without going through our close().
+ */
+#define FD_CACHE_SIZE		65536
 
-#ifdef DEBUG
-#define debug(fmt, ...) fprintf(stderr, "%s " fmt, __func__, ## __VA_ARGS__)
-#else
-#define debug(fmt, ...)
-#endif
+#define FD_CLASS_INET		1
+#define FD_CLASS_INET6		2
+#define FD_CLASS_UNIX		3
+#define FD_CLASS_SOCKET		4
+#define FD_CLASS_FILE		5
+#define FD_CLASS_PIPE		6
+#define FD_CLASS_TTY		7
+#define FD_CLASS_OTHER		8
+
+#define FD_STDIO		0x40
+#define FD_SCRUB		0x80
+
+static const struct {
+	const char *name;
+	unsigned int mask;
+} fd_class_names[] = {
+	{"inet", 1 << FD_CLASS_INET},
+	{"inet6", 1 << FD_CLASS_INET6},
+	{"unix", 1 << FD_CLASS_UNIX},
+	{"socket", 1 << FD_CLASS_SOCKET},
+	{"file", 1 << FD_CLASS_FILE},
+	{"pipe", 1 << FD_CLASS_PIPE},
+	{"tty", 1 << FD_CLASS_TTY},
+	{"other", 1 << FD_CLASS_OTHER},
+	{"all", ~0U},
+};
+
+static unsigned char fd_cache[FD_CACHE_SIZE];
+
+/* classes to scrub (bit n set for class n) */
+static unsigned int fd_policy = ~0U;
+
+/* classes whose stdio buffers are scrubbed on flush */
+static unsigned int fd_stdio_policy;
+
+/* set once any fd may have FD_STDIO */
+static int stdio_enabled;
+
+/* glibc stream list, walked by fflush(NULL) */
+static FILE **stdio_list_all;
+static void (*stdio_list_lock)(void);
+static void (*stdio_list_unlock)(void);
 
 /**
- * We use a constructor to lookup the write addresses
- * of the glibc functions.
- * However it might happen that our functions are called before the 
- * constructor is called. In such instance we setup some default versions
- * of these functions that will force the call to the constructor.
+ * Parse a comma separated list of class names, def is returned if the
+ * list is not set. Unknown names are ignored.
  */
-__attribute__ ((constructor))
-void init_write(void)
+static unsigned int fd_policy_parse(const char *str, unsigned int def)
 {
-	static int init_done;
-	void *ptr;
+	unsigned int policy = 0;
+	unsigned int i;
 
-	/*
-	 * TBD: We should protect init_done access/modification in case of
-	 * multithreaded application. But as it is mostly used by the 
-	 * dynamic linker it might not be necessary as we should not be 
-	 * in multithreaded mode a this time.
-	 */
-	if (init_done) {
-		return;
+	if (!str || !*str) {
+		return def;
 	}
 
-	init_done = 1;
+	while (*str) {
+		size_t len = strcspn(str, ",");
 
-	/* We resolve the various symbols we are going to overload and use */
+		for (i = 0; i < (sizeof(fd_class_names) /
+				 sizeof(fd_class_names[0])); i++) {
+			if ((strlen(fd_class_names[i].name) == len) &&
+			    !strncmp(str, fd_class_names[i].name, len)) {
+				policy |= fd_class_names[i].mask;
+				break;
+			}
+		}
 
-	ptr = dlsym(RTLD_NEXT, "write");
-	if (ptr) {
-		real_write = ptr;
-	} else {
-		debug("write %s\n", dlerror());
+		str += len;
+		if (*str) {
+			str++;
+		}
 	}
 
-	ptr = dlsym(RTLD_NEXT, "sendto");
-	if (ptr) {
-		real_sendto = ptr;
-	} else {
-		debug("sendto %s\n", dlerror());
+	return policy;
+}
+
+static unsigned char fd_class_of_family(int family)
+{
+	switch (family) {
+	case AF_INET:
+		return FD_CLASS_INET;
+	case AF_INET6:
+		return FD_CLASS_INET6;
+	case AF_UNIX:
+		return FD_CLASS_UNIX;
+	default:
+		return FD_CLASS_SOCKET;
 	}
+}
 
-	ptr = dlsym(RTLD_NEXT, "sendmsg");
-	if (ptr) {
-		real_sendmsg = ptr;
-	} else {
-		debug("sendmsg %s\n", dlerror());
+static unsigned char fd_entry(unsigned char class)
+{
+	return class | ((fd_policy & (1U << class)) ? FD_SCRUB : 0) |
+	    ((fd_stdio_policy & (1U << class)) ? FD_STDIO : 0);
+}
+
+static void fd_set_class(int fd, unsigned char class)
+{
+	if ((fd >= 0) && (fd < FD_CACHE_SIZE)) {
+		__atomic_store_n(&fd_cache[fd], class ? fd_entry(class) : 0,
+				 __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Slow path: find the class of fd and cache it.
+ */
+static unsigned char fd_classify(int fd)
+{
+	unsigned char class = FD_CLASS_OTHER;
+	struct stat st;
+
+	if (fstat(fd, &st)) {
+		/* do not cache anything for an invalid fd */
+		return fd_entry(FD_CLASS_OTHER);
+	}
+
+	if (S_ISSOCK(st.st_mode)) {
+		struct sockaddr_storage addr;
+		socklen_t len = sizeof(addr);
+
+		addr.ss_family = AF_UNSPEC;
+		if (!getsockname(fd, (struct sockaddr *)&addr, &len)) {
+			class = fd_class_of_family(addr.ss_family);
+		} else {
+			class = FD_CLASS_SOCKET;
+		}
+	} else if (S_ISREG(st.st_mode)) {
+		class = FD_CLASS_FILE;
+	} else if (S_ISFIFO(st.st_mode)) {
+		class = FD_CLASS_PIPE;
+	} else if (S_ISCHR(st.st_mode) && isatty(fd)) {
+		class = FD_CLASS_TTY;
+	}
+
+	fd_set_class(fd, class);
+
+	return fd_entry(class);
+}
+
+/**
+ * Return non zero if the policy asks to scrub the buffers written to fd.
+ */
+static inline int fd_scrub(int fd)
+{
+	unsigned char entry;
+
+	if (fd_policy == ~0U) {
+		return 1;
+	}
+
+	if ((fd < 0) || (fd >= FD_CACHE_SIZE)) {
+		return fd_classify(fd) & FD_SCRUB;
 	}
+
+	entry = __atomic_load_n(&fd_cache[fd], __ATOMIC_RELAXED);
+	if (!entry) {
+		entry = fd_classify(fd);
+	}
+
+	return entry & FD_SCRUB;
 }
 
 /*
+ * Deferred scrubbing.
+ *
+ * Instead of scrubbing in the request path, the written ranges are
+ * recorded in a ring owned by the calling thread. A helper thread
+ * scrubs the rings of all threads every few milliseconds (or earlier
+ * when a ring is half full). When a ring is full the calling thread
+ * scrubs its oldest range itself.
+ *
+ * Only blocks of clean_malloc are deferred, from their start: each
+ * pending range is counted in the header of its block (see
+ * clean_malloc_mark_deferred()) and free() or realloc() drop it with
+ * clean_write_forget() before the block is released. Any other buffer
+ * (a stack frame, static data, ...) may go away or be reused without us
+ * knowing, it is scrubbed right away.
+ *
+ * A range is scrubbed, and its block unmarked, under the lock of its
+ * ring, so once the lock of every ring has been taken by
+ * clean_write_barrier() or clean_write_forget() nothing is left pending
+ * nor in progress. The owner of a ring only tries the lock: a write()
+ * from a signal handler must not wait for the code it interrupted.
  */
-static ssize_t default_write(int fd, const void *buf, size_t count)
+#define DEFER_RING_SIZE		256
+
+struct defer_range {
+	char *base;		/* NULL once dropped */
+	size_t len;
+};
+
+struct defer_queue {
+	struct defer_queue *next;
+	pthread_mutex_t lock;
+	unsigned int head;	/* next range to scrub */
+	unsigned int tail;	/* next free slot */
+	struct defer_range ranges[DEFER_RING_SIZE];
+};
+
+static int defer_enabled;
+static size_t defer_min = 4096;
+static size_t defer_delay_ms = 1;
+
+static pthread_mutex_t defer_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct defer_queue *defer_list;
+static pthread_key_t defer_key;
+static __thread struct defer_queue *defer_self;
+/* set while scrubbing the completions of aio_return(), never deferred */
+static __thread int defer_off;
+
+/* defer_self once the ring of the thread has been released */
+#define DEFER_EXITED	((struct defer_queue *)1)
+
+/* helper thread job */
+static int defer_job_id = -1;
+
+/* clean_malloc.so (or clean.so), required by the deferred mode */
+static int (*mark_deferred) (void *ptr, size_t len);
+static int (*unmark_deferred) (void *ptr);
+
+/**
+ * Scrub a pending range. Called with the lock of its ring held.
+ */
+static void defer_scrub(struct defer_range *range)
 {
-	init_write();
+	if (range->base) {
+		clean_scrub_nt(range->base, range->len);
+		unmark_deferred(range->base);
+	}
+}
 
-	if (real_write == default_write) {
-		debug("Failed to resolve 'write', returning EINVAL\n");
-		errno = EINVAL;
-		return -1;
+/**
+ * Scrub all the pending ranges of a ring. The lock is dropped between
+ * ranges so the owner never waits for more than one of them.
+ */
+static void defer_drain(struct defer_queue *queue)
+{
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		if (queue->head == queue->tail) {
+			pthread_mutex_unlock(&queue->lock);
+			return;
+		}
+
+		defer_scrub(&queue->ranges[queue->head % DEFER_RING_SIZE]);
+		queue->head++;
+		pthread_mutex_unlock(&queue->lock);
 	}
+}
 
-	return real_write(fd, buf, count);
+static void defer_drain_all(void)
+{
+	struct defer_queue *queue;
+
+	pthread_mutex_lock(&defer_list_lock);
+	for (queue = defer_list; queue; queue = queue->next) {
+		defer_drain(queue);
+	}
+	pthread_mutex_unlock(&defer_list_lock);
 }
 
-static ssize_t default_sendto(int sockfd, const void *buf, size_t len,
-			      int flags, const struct sockaddr *dest_addr,
-			      socklen_t addrlen)
+/**
+ * Drop the pending ranges of a ring starting at ptr. Returns 0 once the
+ * block has no scrub pending anymore.
+ */
+static int defer_forget(struct defer_queue *queue, void *ptr)
 {
-	init_write();
+	unsigned int i;
+	int pending = 1;
 
-	if (real_sendto == default_sendto) {
-		debug("Failed to resolve 'sendto', returning EINVAL\n");
-		errno = EINVAL;
-		return -1;
+	pthread_mutex_lock(&queue->lock);
+	for (i = queue->head; pending && (i != queue->tail); i++) {
+		struct defer_range *range = &queue->ranges[i % DEFER_RING_SIZE];
+
+		if (range->base == ptr) {
+			range->base = NULL;
+			pending = unmark_deferred(ptr);
+		}
 	}
+	pthread_mutex_unlock(&queue->lock);
 
-	return real_sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+	return pending;
 }
 
-static ssize_t default_sendmsg(int sockfd, const struct msghdr *msg, int flags)
+/**
+ * Helper thread job (see clean_bg.h).
+ */
+static void defer_job(void)
 {
-	init_write();
+	defer_drain_all();
+}
 
-	if (real_sendmsg == default_sendmsg) {
-		debug("Failed to resolve 'sendmsg', returning EINVAL\n");
-		errno = EINVAL;
-		return -1;
+/**
+ * Thread exit: scrub what is left and forget the ring. Writes done
+ * later by other destructors of the thread are scrubbed right away.
+ */
+static void defer_thread_exit(void *arg)
+{
+	struct defer_queue *queue = arg;
+	struct defer_queue **prev;
+
+	defer_self = DEFER_EXITED;
+
+	defer_drain(queue);
+
+	pthread_mutex_lock(&defer_list_lock);
+	for (prev = &defer_list; *prev; prev = &(*prev)->next) {
+		if (*prev == queue) {
+			*prev = queue->next;
+			break;
+		}
 	}
+	pthread_mutex_unlock(&defer_list_lock);
 
-	return real_sendmsg(sockfd, msg, flags);
+	pthread_mutex_destroy(&queue->lock);
+	munmap(queue, sizeof(*queue));
 }
 
 /**
+ * Return the ring of the calling thread, creating it on first use, or
+ * NULL once the thread is exiting (or if the ring list is busy).
+ * It is not allocated with malloc() so that it does not depend on the
+ * allocator (which might be interposed as well).
  */
-ssize_t write(int fd, const void *buf, size_t count)
+static struct defer_queue *defer_queue_get(void)
 {
-	ssize_t rc = real_write(fd, buf, count);
+	struct defer_queue *queue = defer_self;
 
-	if (buf && count) {
-		/**
-		 * We violate the prototype here as buf is a const void 
-		 * We should not change the content of buf but ...
-		 * most of the time it is harmless and it allows to 
-		 * guaranty that the data is indeed zeroized as it is
-		 * not needed anymore
-		 * This might prevent some application to work if they do expect
-		 * their data to be still available after the write.
-		 */
+	if (queue == DEFER_EXITED) {
+		return NULL;
+	}
 
-		memset((void *)buf, 0, count);
+	if (queue) {
+		return queue;
 	}
 
-	return rc;
+	if (pthread_mutex_trylock(&defer_list_lock)) {
+		return NULL;
+	}
+
+	queue = mmap(NULL, sizeof(*queue), PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (queue == MAP_FAILED) {
+		pthread_mutex_unlock(&defer_list_lock);
+		return NULL;
+	}
+
+	pthread_mutex_init(&queue->lock, NULL);
+
+	queue->next = defer_list;
+	defer_list = queue;
+	pthread_mutex_unlock(&defer_list_lock);
+
+	pthread_setspecific(defer_key, queue);
+	defer_self = queue;
+
+	return queue;
 }
 
-ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
-	       const struct sockaddr * dest_addr, socklen_t addrlen)
+/**
+ * Record a range, already marked in its block, to be scrubbed later.
+ * Returns -1 if it could not be recorded.
+ */
+static int defer_push(void *base, size_t len)
 {
-	ssize_t rc = real_sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+	struct defer_queue *queue = defer_queue_get();
+	struct defer_range *range;
+	unsigned int pending;
 
-	if (buf && len) {
-		/**
-		 * We violate the prototype here as buf is a const void 
-		 * We should not change the content of buf but ...
-		 * most of the time it is harmless and it allows to 
-		 * guaranty that the data is indeed zeroized as it is
-		 * not needed anymore
-		 * This might prevent some application to work if they do expect
-		 * their data to be still available after the write.
-		 */
+	if (!queue) {
+		return -1;
+	}
 
-		memset((void *)buf, 0, len);
+	/* the helper thread does not survive a fork */
+	clean_bg_start();
+
+	if (pthread_mutex_trylock(&queue->lock)) {
+		return -1;
 	}
 
-	return rc;
+	/* the ring is full, scrub the oldest range ourself */
+	if ((queue->tail - queue->head) == DEFER_RING_SIZE) {
+		defer_scrub(&queue->ranges[queue->head % DEFER_RING_SIZE]);
+		queue->head++;
+	}
+
+	range = &queue->ranges[queue->tail % DEFER_RING_SIZE];
+	range->base = base;
+	range->len = len;
+	queue->tail++;
+	pending = queue->tail - queue->head;
+
+	pthread_mutex_unlock(&queue->lock);
+
+	if (pending == (DEFER_RING_SIZE / 2)) {
+		clean_bg_wake(defer_job_id);
+	}
+
+	return 0;
 }
 
-ssize_t sendmsg(int sockfd, const struct msghdr * msg, int flags)
+/*
+ * Take every ring lock around fork() so that the child does not inherit
+ * a lock held by a thread that does not exist anymore.
+ */
+static void defer_fork_prepare(void)
 {
-	ssize_t rc = real_sendmsg(sockfd, msg, flags);
-	int count = msg->msg_iovlen;
+	struct defer_queue *queue;
 
-	if (msg) {
-		while (count) {
-			count--;
-			memset(msg->msg_iov[count].iov_base, 0,
-			       msg->msg_iov[count].iov_len);
-		}
+	pthread_mutex_lock(&defer_list_lock);
+	for (queue = defer_list; queue; queue = queue->next) {
+		pthread_mutex_lock(&queue->lock);
 	}
+}
 
-	return rc;
+static void defer_fork_parent(void)
+{
+	struct defer_queue *queue;
 
+	for (queue = defer_list; queue; queue = queue->next) {
+		pthread_mutex_unlock(&queue->lock);
+	}
+	pthread_mutex_unlock(&defer_list_lock);
 }
 
-ssize_t send(int sockfd, const void *buf, size_t len, int flags)
+static void defer_fork_child(void)
 {
-	return sendto(sockfd, buf, len, flags, NULL, 0);
+	defer_fork_parent();
+}
+
+static void defer_init(void)
+{
+	defer_enabled = clean_env_size("CLEAN_WRITE_DEFERRED", defer_enabled);
+	defer_min = clean_env_size("CLEAN_WRITE_DEFERRED_MIN", defer_min);
+	defer_delay_ms = clean_env_size("CLEAN_WRITE_DEFERRED_DELAY_MS",
+					defer_delay_ms);
+
+	if (!defer_enabled) {
+		return;
+	}
+
+	if (!mark_deferred || !unmark_deferred) {
+		debug("deferred scrubbing needs clean_malloc\n");
+		defer_enabled = 0;
+		return;
+	}
+
+	if (!defer_delay_ms) {
+		defer_delay_ms = 1;
+	}
+
+	if (pthread_key_create(&defer_key, defer_thread_exit) ||
+	    pthread_atfork(defer_fork_prepare, defer_fork_parent,
+			   defer_fork_child)) {
+		debug("deferred scrubbing disabled\n");
+		defer_enabled = 0;
+		return;
+	}
+
+	defer_job_id = clean_bg_add(defer_job, defer_delay_ms);
+	if (defer_job_id < 0) {
+		debug("deferred scrubbing disabled\n");
+		defer_enabled = 0;
+	}
+}
+
+
+/*
+ * Memory region classifier.
+ *
+ * The buffers given to write() are const: they may be string literals
+ * in a read-only mapping, or belong to the stack or to a file mapping
+ * the application does not expect us to modify. Only writable private
+ * anonymous memory and the heap are scrubbed.
+ *
+ * The mappings of /proc/self/maps are kept in a sorted array searched
+ * with a binary search. Each thread remembers the last mapping it hit
+ * so that repeated writes from the same buffer cost a compare. The
+ * array is rebuilt (in the spare one of two buffers) when it is marked
+ * stale by an interposed call changing the mappings (munmap, mprotect,
+ * mremap, and mmap over an address the array knows), when a shared
+ * object was loaded or unloaded, or when an address is not found
+ * (mappings created by the libc itself).
+ *
+ * The stacks of the other threads are anonymous mappings too. They are
+ * recorded by the interposed pthread_create() when the thread starts
+ * and their mapping is never scrubbed. A stack given by the application
+ * (pthread_attr_setstack()) is not recorded, it may lie in the heap.
+ *
+ * The libc also unmaps memory without going through munmap() (free()
+ * of a large block, thread stacks), so the array may still describe a
+ * mapping that is gone. mmap() checks whether the new mapping overlaps
+ * one the array knows, whatever the flags: the address may have been
+ * reused. Readers are lock free and retry a few times if region_seq
+ * moved while they were looking.
+ *
+ * A lookup may run in a signal handler (write() is async-signal-safe),
+ * so it never waits: the rebuild only uses system calls and is skipped
+ * if another rebuild holds region_lock. A buffer whose mapping cannot
+ * be known for sure is not scrubbable.
+ *
+ * dlopen() is not interposed as the dynamic linker uses the caller
+ * address to select the RUNPATH and namespace of the new object. An
+ * object loaded over memory the table believes anonymous is caught by
+ * _dl_find_object() (lock free, glibc 2.35 and later) when it lands
+ * in a scrubbable mapping.
+ */
+struct region {
+	uintptr_t start;
+	uintptr_t end;
+	int scrub;
+};
+
+struct region_table {
+	size_t size;		/* capacity */
+	size_t count;
+	struct region regions[];
+};
+
+static int region_enabled = 1;
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct region_table *region_tables[2];
+static struct region_table *region_table;
+static unsigned int region_seq;
+static int region_stale = 1;
+
+static __thread struct region region_last;
+static __thread unsigned int region_last_seq = 1;
+
+static void region_invalidate(void)
+{
+	__atomic_store_n(&region_stale, 1, __ATOMIC_RELEASE);
+}
+
+/* consistent reads of the table attempted before giving up */
+#define REGION_RETRIES		4
+
+/*
+ * Stacks of the running threads. A slot is free when its end is 0.
+ * Writers hold region_stacks_lock, the rebuild reads them lock free.
+ */
+#define REGION_STACKS		1024
+
+static struct {
+	uintptr_t start;
+	uintptr_t end;
+} region_stacks[REGION_STACKS];
+static unsigned int region_stacks_used;
+static pthread_mutex_t region_stacks_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int region_stack_slot = -1;
+
+/**
+ * Return non zero if [start, end) overlaps the stack of a thread.
+ */
+static int region_on_stack(uintptr_t start, uintptr_t end)
+{
+	unsigned int used;
+	unsigned int i;
+
+	used = __atomic_load_n(&region_stacks_used, __ATOMIC_ACQUIRE);
+	for (i = 0; i < used; i++) {
+		uintptr_t stack_end = __atomic_load_n(&region_stacks[i].end,
+						      __ATOMIC_ACQUIRE);
+
+		if (stack_end && (start < stack_end) &&
+		    (__atomic_load_n(&region_stacks[i].start,
+				     __ATOMIC_RELAXED) < end)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Allocate a table with room for size regions. Tables are never
+ * unmapped as a slow reader might still look at an old one.
+ */
+static struct region_table *region_table_alloc(size_t size)
+{
+	struct region_table *table;
+
+	table = real_mmap(NULL, sizeof(*table) + size * sizeof(struct region),
+			  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			  -1, 0);
+	if (table == MAP_FAILED) {
+		return NULL;
+	}
+
+	table->size = size;
+
+	return table;
 }
+
+/**
+ * Append a region to a table with room for it, merging it with the
+ * previous one when they are contiguous and of the same kind.
+ */
+static void region_append(struct region_table *table, struct region region)
+{
+	if (table->count &&
+	    (table->regions[table->count - 1].end == region.start) &&
+	    (table->regions[table->count - 1].scrub == region.scrub)) {
+		table->regions[table->count - 1].end = region.end;
+	} else {
+		table->regions[table->count++] = region;
+	}
+}
+
+/**
+ * The table not being read, called with region_lock held.
+ */
+static struct region_table *region_spare(void)
+{
+	return (region_table == region_tables[0]) ? region_tables[1] :
+	    region_tables[0];
+}
+
+/**
+ * Make table, built in the spare slot (or replacing it), the current one.
+ * Called with region_lock held.
+ */
+static void region_publish(struct region_table *table)
+{
+	if (region_table == region_tables[0]) {
+		region_tables[1] = table;
+	} else {
+		region_tables[0] = table;
+	}
+
+	__atomic_fetch_add(&region_seq, 1, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&region_table, table, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&region_seq, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * strtoul(str, end, 16) without the locale, for the rebuild to stay
+ * async-signal-safe.
+ */
+static uintptr_t region_hex(const char *str, const char **end)
+{
+	uintptr_t value = 0;
+
+	for (;; str++) {
+		if ((*str >= '0') && (*str <= '9')) {
+			value = (value << 4) | (*str - '0');
+		} else if ((*str >= 'a') && (*str <= 'f')) {
+			value = (value << 4) | (*str - 'a' + 10);
+		} else {
+			break;
+		}
+	}
+
+	*end = str;
+
+	return value;
+}
+
+/**
+ * Add one line of /proc/self/maps to a table, growing it if needed:
+ * "start-end perms offset dev inode    path".
+ */
+static struct region_table *region_add_line(struct region_table *table,
+					    const char *line)
+{
+	struct region region;
+	const char *path;
+	const char *end;
+	int field;
+
+	region.start = region_hex(line, &end);
+	if (*end != '-') {
+		return table;
+	}
+	region.end = region_hex(end + 1, &end);
+	if ((*end != ' ') || (strlen(end) < 5)) {
+		return table;
+	}
+
+	/* skip perms, offset, dev and inode to get to the path */
+	path = end + 1;
+	for (field = 0; (field < 4) && *path; field++) {
+		path += strcspn(path, " ");
+		path += strspn(path, " ");
+	}
+
+	region.scrub = (end[2] == 'w') && (end[4] == 'p') &&
+	    (!*path || !strncmp(path, "[heap]", 6) ||
+	     !strncmp(path, "[anon:", 6)) &&
+	    !region_on_stack(region.start, region.end);
+
+	if (table->count == table->size) {
+		struct region_table *bigger;
+
+		bigger = region_table_alloc(table->size * 2);
+		if (!bigger) {
+			return table;
+		}
+		memcpy(bigger->regions, table->regions,
+		       table->count * sizeof(struct region));
+		bigger->count = table->count;
+		table = bigger;
+	}
+
+	region_append(table, region);
+
+	return table;
+}
+
+/**
+ * Parse /proc/self/maps into the spare table and publish it. Returns 0
+ * if the table is still stale: another thread (or the code this signal
+ * handler interrupted) is rebuilding it, or the file cannot be read.
+ * This only uses async-signal-safe calls as it can run from any context.
+ */
+static int region_rebuild(void)
+{
+	static char buf[4096];
+	struct region_table *table;
+	size_t fill = 0;
+	int skip = 0;
+	int done = 0;
+	ssize_t n;
+	int fd;
+
+	if (pthread_mutex_trylock(&region_lock)) {
+		return 0;
+	}
+
+	if (!__atomic_exchange_n(&region_stale, 0, __ATOMIC_ACQ_REL)) {
+		pthread_mutex_unlock(&region_lock);
+		return 1;
+	}
+
+	table = region_spare();
+	if (!table) {
+		table = region_table_alloc(256);
+		if (!table) {
+			goto out;
+		}
+	}
+	table->count = 0;
+
+	fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		goto out;
+	}
+
+	while ((n = read(fd, buf + fill, sizeof(buf) - 1 - fill)) > 0) {
+		char *line = buf;
+		char *eol;
+
+		fill += n;
+		buf[fill] = '\0';
+
+		while ((eol = memchr(line, '\n', fill - (line - buf)))) {
+			*eol = '\0';
+			if (!skip) {
+				table = region_add_line(table, line);
+			}
+			skip = 0;
+			line = eol + 1;
+		}
+
+		fill -= line - buf;
+		if (fill == (sizeof(buf) - 1)) {
+			/* very long path, the start of the line is enough */
+			table = region_add_line(table, buf);
+			skip = 1;
+			fill = 0;
+		} else {
+			memmove(buf, line, fill);
+		}
+	}
+
+	close(fd);
+
+	region_publish(table);
+	done = 1;
+
+ out:
+	if (!done) {
+		region_invalidate();
+	}
+	pthread_mutex_unlock(&region_lock);
+
+	return done;
+}
+
+/**
+ * Binary search of the table. Returns 0 if addr is not in any mapping
+ * or if the table kept changing under us. The sequence the result was
+ * read at is stored in seq_out.
+ */
+static int region_search(uintptr_t addr, struct region *out,
+			 unsigned int *seq_out)
+{
+	struct region_table *table;
+	struct region region;
+	size_t low = 0;
+	size_t high;
+	unsigned int seq;
+	int tries;
+	int found;
+
+	for (tries = 0; tries < REGION_RETRIES; tries++) {
+		seq = __atomic_load_n(&region_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			/* being published, maybe by the code we interrupted */
+			continue;
+		}
+		table = __atomic_load_n(&region_table, __ATOMIC_ACQUIRE);
+		found = 0;
+
+		if (table) {
+			low = 0;
+			high = MIN(table->count, table->size);
+			while (low < high) {
+				size_t mid = (low + high) / 2;
+
+				region = table->regions[mid];
+				if (addr < region.start) {
+					high = mid;
+				} else if (addr >= region.end) {
+					low = mid + 1;
+				} else {
+					*out = region;
+					found = 1;
+					break;
+				}
+			}
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n(&region_seq, __ATOMIC_RELAXED)) {
+			*seq_out = seq;
+			return found;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Return non zero if the table knows a mapping overlapping [start, end),
+ * or if it kept changing under us.
+ */
+static int region_known(uintptr_t start, uintptr_t end)
+{
+	struct region_table *table;
+	size_t count;
+	size_t low;
+	size_t high;
+	unsigned int seq;
+	int tries;
+	int found;
+
+	for (tries = 0; tries < REGION_RETRIES; tries++) {
+		seq = __atomic_load_n(&region_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		table = __atomic_load_n(&region_table, __ATOMIC_ACQUIRE);
+		found = 0;
+
+		if (table) {
+			count = MIN(table->count, table->size);
+			low = 0;
+			high = count;
+			/* first mapping ending after start */
+			while (low < high) {
+				size_t mid = (low + high) / 2;
+
+				if (table->regions[mid].end <= start) {
+					low = mid + 1;
+				} else {
+					high = mid;
+				}
+			}
+			found = (low < count) && (table->regions[low].start < end);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n(&region_seq, __ATOMIC_RELAXED)) {
+			return found;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Replace [start, end) in the table by a mapping of the given kind, or
+ * by nothing if scrub is negative, and publish the copy. This spares a
+ * rebuild for the mappings we create or remove ourselves, the blocks of
+ * clean_malloc among them. Returns 0 if the table is stale or busy: the
+ * next lookup will rebuild it.
+ */
+static int region_update(uintptr_t start, uintptr_t end, int scrub)
+{
+	struct region_table *from;
+	struct region_table *table;
+	struct region update = { start, end, scrub };
+	int pending = (scrub >= 0);
+	int done = 0;
+	size_t i;
+
+	if (pthread_mutex_trylock(&region_lock)) {
+		return 0;
+	}
+
+	from = region_table;
+	if (!from || __atomic_load_n(&region_stale, __ATOMIC_ACQUIRE)) {
+		goto out;
+	}
+
+	/* a split and the new mapping add at most two regions */
+	table = region_spare();
+	if (!table || (table->size < (from->count + 2))) {
+		table = region_table_alloc(from->size * 2);
+		if (!table) {
+			goto out;
+		}
+	}
+	table->count = 0;
+
+	for (i = 0; i < from->count; i++) {
+		struct region region = from->regions[i];
+
+		if (region.end <= start) {
+			region_append(table, region);
+			continue;
+		}
+
+		if (region.start < start) {
+			struct region head = { region.start, start, region.scrub };
+
+			region_append(table, head);
+		}
+
+		if (pending && (region.end > start)) {
+			region_append(table, update);
+			pending = 0;
+		}
+
+		if (region.end > end) {
+			if (region.start < end) {
+				region.start = end;
+			}
+			region_append(table, region);
+		}
+	}
+
+	if (pending) {
+		region_append(table, update);
+	}
+
+	region_publish(table);
+	done = 1;
+
+ out:
+	pthread_mutex_unlock(&region_lock);
+
+	return done;
+}
+
+/**
+ * Record the stack of the calling thread, which was allocated by the
+ * libc, and remove it from the scrubbable mappings.
+ */
+static void region_stack_add(void)
+{
+	pthread_attr_t attr;
+	uintptr_t start;
+	uintptr_t end;
+	void *stack;
+	size_t size;
+	unsigned int i;
+
+	if (pthread_getattr_np(pthread_self(), &attr)) {
+		return;
+	}
+	if (pthread_attr_getstack(&attr, &stack, &size)) {
+		pthread_attr_destroy(&attr);
+		return;
+	}
+	pthread_attr_destroy(&attr);
+
+	start = (uintptr_t) stack;
+	end = start + size;
+
+	pthread_mutex_lock(&region_stacks_lock);
+	for (i = 0; i < region_stacks_used; i++) {
+		if (!region_stacks[i].end) {
+			break;
+		}
+	}
+	if (i < REGION_STACKS) {
+		__atomic_store_n(&region_stacks[i].start, start,
+				 __ATOMIC_RELAXED);
+		__atomic_store_n(&region_stacks[i].end, end, __ATOMIC_RELEASE);
+		if (i == region_stacks_used) {
+			__atomic_store_n(&region_stacks_used, i + 1,
+					 __ATOMIC_RELEASE);
+		}
+		region_stack_slot = i;
+	}
+	pthread_mutex_unlock(&region_stacks_lock);
+
+	if (i == REGION_STACKS) {
+		debug("too many threads, stack at %p may be scrubbed\n", stack);
+		return;
+	}
+
+	if (!region_update(start, end, 0)) {
+		region_invalidate();
+	}
+}
+
+/**
+ * Forget the stack of the calling thread when it exits. The table keeps
+ * it as not scrubbable until the next rebuild.
+ */
+static void region_stack_remove(void *arg)
+{
+	(void)arg;
+
+	if (region_stack_slot < 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&region_stacks_lock);
+	__atomic_store_n(&region_stacks[region_stack_slot].end, 0,
+			 __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&region_stacks_lock);
+
+	region_stack_slot = -1;
+}
+
+#if defined(DLFO_STRUCT_HAS_EH_DBASE)
+/**
+ * Return 0 if addr belongs to a shared object loaded after the table
+ * was built, i.e. the first mapping of the object is not a file
+ * mapping of the table.
+ */
+static int region_dl_known(uintptr_t addr)
+{
+	struct dl_find_object object;
+	struct region region;
+	unsigned int seq;
+
+	if (_dl_find_object((void *)addr, &object)) {
+		return 1;
+	}
+
+	return region_search((uintptr_t) object.dlfo_map_start, &region,
+			     &seq) && !region.scrub;
+}
+#else
+static int region_dl_known(uintptr_t addr)
+{
+	(void)addr;
+
+	/* no lock free way to see the loads, a miss rebuilds the table */
+	return 1;
+}
+#endif
+
+/**
+ * Find the mapping holding addr, rebuilding the table once if it is
+ * stale or does not know the address yet. Returns 0 if the mapping
+ * cannot be known without waiting.
+ */
+static int region_lookup(uintptr_t addr, struct region *out)
+{
+	unsigned int seq;
+
+	if (__atomic_load_n(&region_stale, __ATOMIC_ACQUIRE) &&
+	    !region_rebuild()) {
+		return 0;
+	}
+
+	if ((region_last_seq == __atomic_load_n(&region_seq, __ATOMIC_ACQUIRE))
+	    && (addr >= region_last.start) && (addr < region_last.end)) {
+		*out = region_last;
+		return 1;
+	}
+
+	if (!region_search(addr, out, &seq)) {
+		/* a mapping made by the libc itself, or the table is busy */
+		region_invalidate();
+		if (!region_rebuild() || !region_search(addr, out, &seq)) {
+			return 0;
+		}
+	}
+
+	if (out->scrub && !region_dl_known(addr)) {
+		region_invalidate();
+		return 0;
+	}
+
+	region_last = *out;
+	region_last_seq = seq;
+
+	return 1;
+}
+
+/**
+ * Return non zero if the len bytes at ptr may be scrubbed.
+ */
+static int region_scrubbable(const void *ptr, size_t len)
+{
+	struct region region;
+
+	return !region_enabled ||
+	    (region_lookup((uintptr_t) ptr, &region) && region.scrub &&
+	     (((uintptr_t) ptr + len) <= region.end));
+}
+
+/*
+ * With clean_malloc loaded, the blocks we scrubbed entirely are marked
+ * so that free() checks the zeros instead of writing them again (see
+ * clean_malloc_mark_clean() in clean_malloc.h). Below 64K the block is
+ * still in the inner caches where writing is as fast as checking.
+ */
+#define MARK_CLEAN_MIN		(64 * 1024)
+
+static int (*mark_clean) (void *ptr, size_t len);
+
+static inline void write_mark_clean(void *buf, size_t len)
+{
+	if (mark_clean && (len >= MARK_CLEAN_MIN)) {
+		mark_clean(buf, len);
+	}
+}
+
+/*
+ * Scrub what the kernel accepted, now or later in deferred mode.
+ * The kernel has already copied the data so it will not be read again:
+ * large buffers are scrubbed with non-temporal stores so that they do
+ * not evict the working set of the application from the cache.
+ * Small buffers are always scrubbed right away as recording them would
+ * cost about as much, and so are the buffers that are not a block of
+ * clean_malloc.
+ */
+static void scrub_range(void *buf, size_t len)
+{
+	if (defer_enabled && !defer_off && (len >= defer_min) &&
+	    mark_deferred(buf, len)) {
+		if (!defer_push(buf, len)) {
+			return;
+		}
+		unmark_deferred(buf);
+	}
+
+	clean_scrub_nt(buf, len);
+	write_mark_clean(buf, len);
+}
+
+/**
+ * Scrub the parts of a buffer that lie in scrubbable mappings.
+ */
+static void write_scrub(const void *buf, size_t len)
+{
+	uintptr_t addr = (uintptr_t) buf;
+	struct region region;
+
+	if (region_scrubbable(buf, len)) {
+		scrub_range((void *)buf, len);
+		return;
+	}
+
+	/* the buffer spans several mappings, or none may be scrubbed */
+	while (len && region_lookup(addr, &region)) {
+		size_t n = MIN(len, region.end - addr);
+
+		if (region.scrub) {
+			scrub_range((void *)addr, n);
+		}
+		addr += n;
+		len -= n;
+	}
+}
+
+/**
+ * The iovec kernel is used when nothing is deferred and every segment
+ * may be scrubbed. Otherwise contiguous segments are merged and each
+ * run goes through write_scrub().
+ */
+static void write_scrub_iov(const struct iovec *iov, int iovcnt, size_t len)
+{
+	char *base = NULL;
+	size_t run = 0;
+	size_t left;
+	int fast = !defer_enabled || defer_off;
+	int i;
+
+	if (!iov) {
+		return;
+	}
+
+	for (i = 0, left = len; fast && (i < iovcnt) && left; i++) {
+		size_t n = MIN(iov[i].iov_len, left);
+
+		fast = !n || region_scrubbable(iov[i].iov_base, n);
+		left -= n;
+	}
+
+	if (fast) {
+		clean_scrub_iov(iov, iovcnt, len);
+		for (i = 0, left = len; mark_clean && (i < iovcnt) && left; i++) {
+			size_t n = MIN(iov[i].iov_len, left);
+
+			write_mark_clean(iov[i].iov_base, n);
+			left -= n;
+		}
+		return;
+	}
+
+	for (i = 0; (i < iovcnt) && len; i++) {
+		size_t n = MIN(iov[i].iov_len, len);
+
+		len -= n;
+		if (!iov[i].iov_base || !n) {
+			continue;
+		}
+
+		if ((base + run) == (char *)iov[i].iov_base) {
+			run += n;
+			continue;
+		}
+
+		write_scrub(base, run);
+		base = iov[i].iov_base;
+		run = n;
+	}
+
+	write_scrub(base, run);
+}
+
+static void write_scrub_mmsg(const struct mmsghdr *vec, unsigned int vlen)
+{
+	unsigned int i;
+
+	if (!defer_enabled && !region_enabled) {
+		clean_scrub_mmsg(vec, vlen);
+		return;
+	}
+
+	for (i = 0; vec && (i < vlen); i++) {
+		write_scrub_iov(vec[i].msg_hdr.msg_iov,
+				vec[i].msg_hdr.msg_iovlen, vec[i].msg_len);
+	}
+}
+
+/*
+ * MSG_ZEROCOPY support.
+ *
+ * With MSG_ZEROCOPY (on a socket with SO_ZEROCOPY set) the kernel sends
+ * straight from the application pages after the call has returned, so
+ * the buffer cannot be scrubbed yet. Each such send call accepting at
+ * least one byte gets the next 32 bit id of its socket and the kernel
+ * later reports ranges of completed ids on the socket error queue. The
+ * sent ranges are kept per socket with their id and scrubbed when
+ * recvmsg(MSG_ERRQUEUE) returns their completion.
+ *
+ * The ids are counted by the socket, not by the fd: the state is found
+ * from the device and inode of the socket (fstat()) and shared by all
+ * the fds referring to it (dup(), fcntl(F_DUPFD), ...).
+ *
+ * The kernel numbers the sends in the order it handles them, so a
+ * zerocopy send is made with the lock of its socket held: when several
+ * threads send on the same socket our ids follow the same order.
+ *
+ * Room for the ranges of a send is reserved before it is made. When that
+ * fails (no memory, fd beyond the cache) MSG_ZEROCOPY is cleared: the
+ * kernel then copies the data and the buffer is scrubbed on return, a
+ * send that cannot be tracked is never left unscrubbed.
+ *
+ * Before the last fd of a socket with pending ranges is closed or
+ * replaced, the completions are read from the error queue and scrubbed
+ * for up to zc_linger_ms: a completion tells the kernel no longer uses
+ * the pages. The state of a socket is never freed, a concurrent
+ * completion may be using it. Once the last fd is gone the state is
+ * reset, for another socket to reuse, and the ranges still pending are
+ * dropped without being scrubbed: the kernel may still be sending them.
+ */
+struct zc_range {
+	uint32_t id;
+	char *base;
+	size_t len;
+};
+
+struct zc_socket {
+	pthread_mutex_t lock;
+	dev_t dev;		/* the socket, */
+	ino_t ino;
+	unsigned int fds;	/* referred to by that many fds, 0 if free */
+	uint32_t next_id;
+	int enabled;
+	size_t count;
+	size_t size;
+	struct zc_range *ranges;
+	struct zc_socket *next;
+};
+
+/* the completed ranges scrubbed per pass, out of the socket lock */
+#define ZC_SCRUB_BATCH	64
+
+/* how long a close waits for the pending completions */
+static size_t zc_linger_ms = 100;
+
+/* by fd, all the states are in zc_list (protected by zc_list_lock) */
+static struct zc_socket *zc_sockets[FD_CACHE_SIZE];
+static struct zc_socket *zc_list;
+static pthread_mutex_t zc_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Return the state of the socket an fd refers to, creating it on first
+ * use or sharing the one of another fd of the same socket.
+ */
+static struct zc_socket *zc_get(int fd)
+{
+	struct zc_socket *zc;
+	struct zc_socket *spare = NULL;
+	struct stat st;
+
+	zc = __atomic_load_n(&zc_sockets[fd], __ATOMIC_ACQUIRE);
+	if (zc) {
+		return zc;
+	}
+
+	if (fstat(fd, &st) || !S_ISSOCK(st.st_mode)) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&zc_list_lock);
+
+	/* another thread may have done it meanwhile */
+	zc = zc_sockets[fd];
+	if (zc) {
+		goto out;
+	}
+
+	for (zc = zc_list; zc; zc = zc->next) {
+		if (zc->fds && (zc->dev == st.st_dev) &&
+		    (zc->ino == st.st_ino)) {
+			break;
+		}
+		if (!zc->fds && !spare) {
+			spare = zc;
+		}
+	}
+
+	if (!zc && spare) {
+		zc = spare;
+		zc->dev = st.st_dev;
+		zc->ino = st.st_ino;
+	} else if (!zc) {
+		zc = calloc(1, sizeof(*zc));
+		if (!zc) {
+			goto out;
+		}
+		pthread_mutex_init(&zc->lock, NULL);
+		zc->dev = st.st_dev;
+		zc->ino = st.st_ino;
+		zc->next = zc_list;
+		zc_list = zc;
+	}
+
+	zc->fds++;
+	__atomic_store_n(&zc_sockets[fd], zc, __ATOMIC_RELEASE);
+
+ out:
+	pthread_mutex_unlock(&zc_list_lock);
+
+	return zc;
+}
+
+/**
+ * The fd is closed. With its last fd, the socket is gone: drop the
+ * ranges zc_linger() did not see complete, their completion will not be
+ * read anymore and scrubbing them could corrupt data the kernel has not
+ * sent yet.
+ */
+static void zc_forget(int fd)
+{
+	struct zc_socket *zc;
+	struct zc_range *ranges = NULL;
+	size_t count = 0;
+
+	if ((fd < 0) || (fd >= FD_CACHE_SIZE) ||
+	    !__atomic_load_n(&zc_sockets[fd], __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&zc_list_lock);
+	zc = zc_sockets[fd];
+	if (!zc) {
+		pthread_mutex_unlock(&zc_list_lock);
+		return;
+	}
+	__atomic_store_n(&zc_sockets[fd], NULL, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&zc->lock);
+	if (!--zc->fds) {
+		ranges = zc->ranges;
+		count = zc->count;
+		zc->ranges = NULL;
+		zc->count = 0;
+		zc->size = 0;
+		zc->next_id = 0;
+		zc->enabled = 0;
+	}
+	pthread_mutex_unlock(&zc->lock);
+	pthread_mutex_unlock(&zc_list_lock);
+
+	if (count) {
+		debug("%zu zerocopy ranges left unscrubbed on fd %d\n", count,
+		      fd);
+	}
+	free(ranges);
+}
+
+/**
+ * Make room for count more ranges.
+ */
+static int zc_reserve(struct zc_socket *zc, size_t count)
+{
+	struct zc_range *ranges;
+	size_t size;
+
+	if (count <= zc->size - zc->count) {
+		return 0;
+	}
+
+	if (count > SIZE_MAX / sizeof(*ranges) - zc->count) {
+		return -1;
+	}
+
+	size = zc->size ? zc->size * 2 : 16;
+	if (size < zc->count + count) {
+		size = zc->count + count;
+	}
+
+	ranges = realloc(zc->ranges, size * sizeof(*ranges));
+	if (!ranges) {
+		return -1;
+	}
+	zc->ranges = ranges;
+	zc->size = size;
+
+	return 0;
+}
+
+/**
+ * Before a send with flags of at most count ranges: return the locked
+ * state of the socket if it is a zerocopy send we may have to track, NULL
+ * otherwise. If it cannot be tracked MSG_ZEROCOPY is cleared from flags.
+ */
+static struct zc_socket *zc_lock(int fd, int *flags, size_t count)
+{
+	struct zc_socket *zc = NULL;
+
+	if (!(*flags & MSG_ZEROCOPY) || (fd < 0) || !fd_scrub(fd)) {
+		return NULL;
+	}
+
+	if (fd < FD_CACHE_SIZE) {
+		zc = zc_get(fd);
+	}
+	if (zc) {
+		pthread_mutex_lock(&zc->lock);
+		if (!zc_reserve(zc, count)) {
+			return zc;
+		}
+		pthread_mutex_unlock(&zc->lock);
+	}
+
+	debug("zerocopy send on fd %d cannot be tracked, copied\n", fd);
+	*flags &= ~MSG_ZEROCOPY;
+
+	return NULL;
+}
+
+static void zc_unlock(struct zc_socket *zc)
+{
+	if (zc) {
+		pthread_mutex_unlock(&zc->lock);
+	}
+}
+
+/**
+ * Record a range, the room has been reserved by zc_lock().
+ */
+static void zc_add(struct zc_socket *zc, uint32_t id, void *base, size_t len)
+{
+	zc->ranges[zc->count].id = id;
+	zc->ranges[zc->count].base = base;
+	zc->ranges[zc->count].len = len;
+	zc->count++;
+}
+
+/**
+ * Record the first len bytes of a zerocopy send, zc being the state
+ * returned by zc_lock(). Returns 0 if the kernel copied the data
+ * (SO_ZEROCOPY is not set) and the buffer can be scrubbed right away,
+ * 1 if it must be left alone for now.
+ */
+static int zc_track(struct zc_socket *zc, int fd, const struct iovec *iov,
+		    size_t iovcnt, size_t len)
+{
+	uint32_t id;
+	size_t i;
+
+	if (!zc) {
+		return 0;
+	}
+
+	if (!zc->enabled) {
+		int val = 0;
+		socklen_t optlen = sizeof(val);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, &optlen) ||
+		    !val) {
+			return 0;
+		}
+		zc->enabled = 1;
+	}
+
+	if (!len) {
+		/* nothing accepted, the kernel did not use an id */
+		return 1;
+	}
+
+	id = zc->next_id++;
+	for (i = 0; iov && (i < iovcnt) && len; i++) {
+		size_t n = MIN(iov[i].iov_len, len);
+
+		len -= n;
+		if (iov[i].iov_base && n) {
+			zc_add(zc, id, iov[i].iov_base, n);
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Scrub the ranges of the ids between lo and hi (inclusive, modulo 2^32).
+ * The ranges are taken out in batches and scrubbed without the socket lock:
+ * the scrub may rebuild the region table, which closes a file and so takes
+ * zc_list_lock.
+ */
+static void zc_complete(int fd, uint32_t lo, uint32_t hi)
+{
+	struct zc_range done[ZC_SCRUB_BATCH];
+	struct zc_socket *zc;
+	size_t i;
+	size_t n;
+	size_t kept;
+
+	if ((fd < 0) || (fd >= FD_CACHE_SIZE)) {
+		return;
+	}
+
+	/* the sends may have been made through another fd of the socket */
+	zc = zc_get(fd);
+	if (!zc) {
+		return;
+	}
+
+	do {
+		n = 0;
+		kept = 0;
+
+		pthread_mutex_lock(&zc->lock);
+		for (i = 0; i < zc->count; i++) {
+			struct zc_range range = zc->ranges[i];
+
+			if ((n < ZC_SCRUB_BATCH) &&
+			    ((uint32_t)(range.id - lo) <= (uint32_t)(hi - lo))) {
+				done[n++] = range;
+			} else {
+				zc->ranges[kept++] = range;
+			}
+		}
+		zc->count = kept;
+		pthread_mutex_unlock(&zc->lock);
+
+		for (i = 0; i < n; i++) {
+			write_scrub(done[i].base, done[i].len);
+		}
+	} while (n == ZC_SCRUB_BATCH);
+}
+
+/**
+ * Look for zerocopy completions in the control messages returned by
+ * recvmsg(MSG_ERRQUEUE).
+ */
+static void zc_errqueue(int fd, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		struct sock_extended_err serr;
+
+		if (!(((cmsg->cmsg_level == SOL_IP) &&
+		       (cmsg->cmsg_type == IP_RECVERR)) ||
+		      ((cmsg->cmsg_level == SOL_IPV6) &&
+		       (cmsg->cmsg_type == IPV6_RECVERR))) ||
+		    (cmsg->cmsg_len < CMSG_LEN(sizeof(serr)))) {
+			continue;
+		}
+
+		memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+		if ((serr.ee_errno == 0) &&
+		    (serr.ee_origin == SO_EE_ORIGIN_ZEROCOPY)) {
+			zc_complete(fd, serr.ee_info, serr.ee_data);
+		}
+	}
+}
+
+/**
+ * fd is about to be closed or replaced. If it is the last fd of a socket
+ * with pending zerocopy sends, read and scrub their completions for up
+ * to zc_linger_ms: once the socket is closed they cannot be read anymore.
+ */
+static void zc_linger(int fd)
+{
+	struct zc_socket *zc;
+	struct timespec end;
+	char control[256];
+	int saved_errno = errno;
+	int polled = 0;
+
+	if ((fd < 0) || (fd >= FD_CACHE_SIZE) || !zc_linger_ms) {
+		return;
+	}
+
+	zc = __atomic_load_n(&zc_sockets[fd], __ATOMIC_ACQUIRE);
+	if (!zc) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += zc_linger_ms / 1000;
+	end.tv_nsec += (zc_linger_ms % 1000) * 1000000;
+	if (end.tv_nsec >= 1000000000) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000;
+	}
+
+	for (;;) {
+		struct pollfd pfd = { fd, 0, 0 };
+		struct msghdr msg;
+		struct timespec now;
+		long timeout;
+		int pending;
+
+		pthread_mutex_lock(&zc->lock);
+		pending = (zc->fds == 1) && zc->count;
+		pthread_mutex_unlock(&zc->lock);
+		if (!pending) {
+			break;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (real_recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0) {
+			zc_errqueue(fd, &msg);
+			polled = 0;
+			continue;
+		}
+
+		/* POLLERR may also come from a socket error, do not spin */
+		if (((errno != EAGAIN) && (errno != EWOULDBLOCK)) || polled) {
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = (end.tv_sec - now.tv_sec) * 1000 +
+		    (end.tv_nsec - now.tv_nsec) / 1000000;
+		if ((timeout <= 0) || (poll(&pfd, 1, timeout) <= 0) ||
+		    (pfd.revents & POLLNVAL)) {
+			break;
+		}
+		polled = 1;
+	}
+
+	errno = saved_errno;
+}
+
+/*
+ * vmsplice() support.
+ *
+ * vmsplice() does not copy the data: the pipe keeps references to the
+ * application pages until its reader consumes them, so they cannot be
+ * scrubbed when the call returns. Whole pages of private anonymous
+ * memory are dropped right away with madvise(MADV_DONTNEED): the pipe
+ * keeps the old pages (which a SPLICE_F_GIFT reader may then steal)
+ * and the application gets new zero pages, without any memset.
+ *
+ * The partial pages at both ends of a buffer also hold other data of
+ * the application and cannot be dropped. Their part of the buffer is
+ * copied to bounce pages mapped for the call and given to the pipe
+ * instead. The bounce pages are unmapped on return (the pipe keeps its
+ * own references to them) and the application bytes are scrubbed right
+ * away: nothing is kept past the call.
+ *
+ * The segments are handled in batches so that the rewritten iovec
+ * array fits on the stack. A batch is only sent if the previous one
+ * was entirely accepted.
+ */
+#define VS_BATCH_SEGS		16
+
+/* what to do with an entry of the rewritten iovec array once sent */
+#define VS_PASS			0	/* nothing, it is not scrubbed */
+#define VS_BOUNCE		1	/* scrub the application bytes */
+#define VS_PAGES		2	/* drop the whole pages */
+
+struct vs_entry {
+	int kind;
+	char *user;
+	size_t bounce_off;
+};
+
+static ssize_t vs_batch(int fd, const struct iovec *iov, size_t nr_segs,
+			unsigned int flags, size_t *want)
+{
+	struct iovec out[3 * VS_BATCH_SEGS];
+	struct vs_entry entry[3 * VS_BATCH_SEGS];
+	uintptr_t page_mask = getpagesize() - 1;
+	size_t bounce_len = 0;
+	char *bounce = NULL;
+	size_t count = 0;
+	size_t left;
+	ssize_t rc;
+	size_t i;
+	int err;
+
+	*want = 0;
+
+	for (i = 0; i < nr_segs; i++) {
+		uintptr_t start = (uintptr_t) iov[i].iov_base;
+		size_t n = iov[i].iov_len;
+		uintptr_t end = start + n;
+		uintptr_t first = (start + page_mask) & ~page_mask;
+		uintptr_t last = end & ~page_mask;
+		struct region region;
+
+		*want += n;
+
+		/* the pages must be private anonymous memory to be dropped */
+		if (!n || !region_lookup(start, &region) || !region.scrub ||
+		    (end > region.end)) {
+			out[count].iov_base = iov[i].iov_base;
+			out[count].iov_len = n;
+			entry[count++].kind = VS_PASS;
+			continue;
+		}
+
+		if (first >= last) {
+			/* no whole page, bounce it all */
+			first = last = end;
+		}
+
+		if (start < first) {
+			out[count].iov_len = first - start;
+			entry[count].kind = VS_BOUNCE;
+			entry[count].user = (char *)start;
+			entry[count++].bounce_off = bounce_len;
+			bounce_len += first - start;
+		}
+
+		if (first < last) {
+			out[count].iov_base = (void *)first;
+			out[count].iov_len = last - first;
+			entry[count].kind = VS_PAGES;
+			entry[count++].user = (char *)first;
+		}
+
+		if (last < end) {
+			out[count].iov_len = end - last;
+			entry[count].kind = VS_BOUNCE;
+			entry[count].user = (char *)last;
+			entry[count++].bounce_off = bounce_len;
+			bounce_len += end - last;
+		}
+	}
+
+	if (bounce_len) {
+		bounce = real_mmap(NULL, bounce_len, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bounce == MAP_FAILED) {
+			/* not scrubbed, but the pipe gets the right data */
+			return real_vmsplice(fd, iov, nr_segs, flags);
+		}
+
+		for (i = 0; i < count; i++) {
+			if (entry[i].kind == VS_BOUNCE) {
+				out[i].iov_base = bounce + entry[i].bounce_off;
+				memcpy(out[i].iov_base, entry[i].user,
+				       out[i].iov_len);
+			}
+		}
+	}
+
+	rc = real_vmsplice(fd, out, count, flags);
+	err = errno;
+
+	for (i = 0, left = (rc > 0) ? rc : 0; (i < count) && left; i++) {
+		size_t n = MIN(out[i].iov_len, left);
+
+		left -= n;
+
+		if (entry[i].kind == VS_BOUNCE) {
+			clean_scrub(entry[i].user, n);
+		} else if ((entry[i].kind == VS_PAGES) && (n & ~page_mask) &&
+			   madvise(entry[i].user, n & ~page_mask,
+				   MADV_DONTNEED)) {
+			debug("pages left in the pipe not scrubbed\n");
+		}
+	}
+
+	if (bounce) {
+		real_munmap(bounce, bounce_len);
+	}
+
+	errno = err;
+
+	return rc;
+}
+
+/**
+ * Called for the write end of a pipe whose buffers are scrubbed.
+ */
+static ssize_t vs_splice(int fd, const struct iovec *iov, size_t nr_segs,
+			 unsigned int flags)
+{
+	ssize_t total = 0;
+	ssize_t rc;
+	size_t want;
+	size_t n;
+
+	if (!iov) {
+		return real_vmsplice(fd, iov, nr_segs, flags);
+	}
+
+	do {
+		n = MIN(nr_segs, VS_BATCH_SEGS);
+		rc = vs_batch(fd, iov, n, flags, &want);
+		if (rc < 0) {
+			return total ? total : rc;
+		}
+		total += rc;
+		iov += n;
+		nr_segs -= n;
+	} while (nr_segs && ((size_t)rc == want));
+
+	return total;
+}
+
+/**
+ * An fd was closed or now refers to something else.
+ */
+static void fd_reset(int fd, unsigned char class)
+{
+	fd_set_class(fd, class);
+	zc_forget(fd);
+}
+
+/**
+ * We use a constructor to lookup the write addresses
+ * of the glibc functions.
+ * However it might happen that our functions are called before the 
+ * constructor is called. In such instance we setup some default versions
+ * of these functions that will force the call to the constructor.
+ */
+CLEAN_CONSTRUCTOR void init_write(void)
+{
+	static int init_done;
+	void *ptr;
+
+	/*
+	 * TBD: We should protect init_done access/modification in case of
+	 * multithreaded application. But as it is mostly used by the 
+	 * dynamic linker it might not be necessary as we should not be 
+	 * in multithreaded mode a this time.
+	 */
+	if (init_done) {
+		return;
+	}
+
+	init_done = 1;
+
+	fd_policy = fd_policy_parse(getenv("CLEAN_WRITE_SCRUB"), ~0U);
+	fd_stdio_policy = fd_policy_parse(getenv("CLEAN_WRITE_STDIO"), 0);
+	if (fd_stdio_policy) {
+		stdio_enabled = 1;
+	}
+	region_enabled = clean_env_size("CLEAN_WRITE_REGIONS", region_enabled);
+	zc_linger_ms = clean_env_size("CLEAN_WRITE_ZEROCOPY_LINGER_MS",
+				      zc_linger_ms);
+
+	/* We resolve the various symbols we are going to overload and use */
+
+	ptr = dlsym(RTLD_NEXT, "write");
+	if (ptr) {
+		real_write = ptr;
+	} else {
+		debug("write %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "sendto");
+	if (ptr) {
+		real_sendto = ptr;
+	} else {
+		debug("sendto %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "sendmsg");
+	if (ptr) {
+		real_sendmsg = ptr;
+	} else {
+		debug("sendmsg %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "writev");
+	if (ptr) {
+		real_writev = ptr;
+	} else {
+		debug("writev %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "pwrite");
+	if (ptr) {
+		real_pwrite = ptr;
+	} else {
+		debug("pwrite %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "pwritev");
+	if (ptr) {
+		real_pwritev = ptr;
+	} else {
+		debug("pwritev %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "pwritev2");
+	if (ptr) {
+		real_pwritev2 = ptr;
+	} else {
+		debug("pwritev2 %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "sendmmsg");
+	if (ptr) {
+		real_sendmmsg = ptr;
+	} else {
+		debug("sendmmsg %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "close");
+	if (ptr) {
+		real_close = ptr;
+	} else {
+		debug("close %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "close_range");
+	if (ptr) {
+		real_close_range = ptr;
+	} else {
+		debug("close_range %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "dup");
+	if (ptr) {
+		real_dup = ptr;
+	} else {
+		debug("dup %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "dup2");
+	if (ptr) {
+		real_dup2 = ptr;
+	} else {
+		debug("dup2 %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "dup3");
+	if (ptr) {
+		real_dup3 = ptr;
+	} else {
+		debug("dup3 %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "fcntl");
+	if (ptr) {
+		real_fcntl = ptr;
+	} else {
+		debug("fcntl %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "socket");
+	if (ptr) {
+		real_socket = ptr;
+	} else {
+		debug("socket %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "socketpair");
+	if (ptr) {
+		real_socketpair = ptr;
+	} else {
+		debug("socketpair %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "accept");
+	if (ptr) {
+		real_accept = ptr;
+	} else {
+		debug("accept %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "accept4");
+	if (ptr) {
+		real_accept4 = ptr;
+	} else {
+		debug("accept4 %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "mmap");
+	if (ptr) {
+		real_mmap = ptr;
+	} else {
+		debug("mmap %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "munmap");
+	if (ptr) {
+		real_munmap = ptr;
+	} else {
+		debug("munmap %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "mprotect");
+	if (ptr) {
+		real_mprotect = ptr;
+	} else {
+		debug("mprotect %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "mremap");
+	if (ptr) {
+		real_mremap = ptr;
+	} else {
+		debug("mremap %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "pthread_create");
+	if (ptr) {
+		real_pthread_create = ptr;
+	} else {
+		debug("pthread_create %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "recvmsg");
+	if (ptr) {
+		real_recvmsg = ptr;
+	} else {
+		debug("recvmsg %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "vmsplice");
+	if (ptr) {
+		real_vmsplice = ptr;
+	} else {
+		debug("vmsplice %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "aio_write");
+	if (ptr) {
+		real_aio_write = ptr;
+	} else {
+		debug("aio_write %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "lio_listio");
+	if (ptr) {
+		real_lio_listio = ptr;
+	} else {
+		debug("lio_listio %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "aio_return");
+	if (ptr) {
+		real_aio_return = ptr;
+	} else {
+		debug("aio_return %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "aio_suspend");
+	if (ptr) {
+		real_aio_suspend = ptr;
+	} else {
+		debug("aio_suspend %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "aio_error");
+	if (ptr) {
+		real_aio_error = ptr;
+	} else {
+		debug("aio_error %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "fflush");
+	if (ptr) {
+		real_fflush = ptr;
+	} else {
+		debug("fflush %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "fclose");
+	if (ptr) {
+		real_fclose = ptr;
+	} else {
+		debug("fclose %s\n", dlerror());
+	}
+
+	ptr = dlsym(RTLD_NEXT, "setvbuf");
+	if (ptr) {
+		real_setvbuf = ptr;
+	} else {
+		debug("setvbuf %s\n", dlerror());
+	}
+
+	/* optional, only used by fflush(NULL) */
+	stdio_list_all = dlsym(RTLD_NEXT, "_IO_list_all");
+	stdio_list_lock = dlsym(RTLD_NEXT, "_IO_list_lock");
+	stdio_list_unlock = dlsym(RTLD_NEXT, "_IO_list_unlock");
+	if (!stdio_list_all || !stdio_list_lock || !stdio_list_unlock) {
+		stdio_list_all = NULL;
+		debug("_IO_list_all %s\n", dlerror());
+	}
+
+	/* optional, clean_malloc.so (or clean.so) */
+	mark_clean = dlsym(RTLD_DEFAULT, "clean_malloc_mark_clean");
+	mark_deferred = dlsym(RTLD_DEFAULT, "clean_malloc_mark_deferred");
+	unmark_deferred = dlsym(RTLD_DEFAULT, "clean_malloc_unmark_deferred");
+
+	/*
+	 * Last: starting the helper thread allocates memory, which may call
+	 * our mmap() through an interposed allocator.
+	 */
+	defer_init();
+
+}
+
+/*
+ */
+static ssize_t default_write(int fd, const void *buf, size_t count)
+{
+	init_write();
+
+	if (real_write == default_write) {
+		debug("Failed to resolve 'write', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_write(fd, buf, count);
+}
+
+static ssize_t default_sendto(int sockfd, const void *buf, size_t len,
+			      int flags, const struct sockaddr *dest_addr,
+			      socklen_t addrlen)
+{
+	init_write();
+
+	if (real_sendto == default_sendto) {
+		debug("Failed to resolve 'sendto', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+}
+
+static ssize_t default_sendmsg(int sockfd, const struct msghdr *msg, int flags)
+{
+	init_write();
+
+	if (real_sendmsg == default_sendmsg) {
+		debug("Failed to resolve 'sendmsg', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_sendmsg(sockfd, msg, flags);
+}
+
+static ssize_t default_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	init_write();
+
+	if (real_writev == default_writev) {
+		debug("Failed to resolve 'writev', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_writev(fd, iov, iovcnt);
+}
+
+static ssize_t default_pwrite(int fd, const void *buf, size_t count,
+			      off_t offset)
+{
+	init_write();
+
+	if (real_pwrite == default_pwrite) {
+		debug("Failed to resolve 'pwrite', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_pwrite(fd, buf, count, offset);
+}
+
+static ssize_t default_pwritev(int fd, const struct iovec *iov, int iovcnt,
+			       off_t offset)
+{
+	init_write();
+
+	if (real_pwritev == default_pwritev) {
+		debug("Failed to resolve 'pwritev', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_pwritev(fd, iov, iovcnt, offset);
+}
+
+static ssize_t default_pwritev2(int fd, const struct iovec *iov, int iovcnt,
+				off_t offset, int flags)
+{
+	init_write();
+
+	if (real_pwritev2 == default_pwritev2) {
+		debug("Failed to resolve 'pwritev2', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_pwritev2(fd, iov, iovcnt, offset, flags);
+}
+
+static int default_sendmmsg(int sockfd, struct mmsghdr *msgvec,
+			    unsigned int vlen, int flags)
+{
+	init_write();
+
+	if (real_sendmmsg == default_sendmmsg) {
+		debug("Failed to resolve 'sendmmsg', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_sendmmsg(sockfd, msgvec, vlen, flags);
+}
+
+static int default_close(int fd)
+{
+	init_write();
+
+	if (real_close == default_close) {
+		debug("Failed to resolve 'close', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_close(fd);
+}
+
+static int default_close_range(unsigned int first, unsigned int last,
+			       int flags)
+{
+	init_write();
+
+	if (real_close_range == default_close_range) {
+		debug("Failed to resolve 'close_range', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_close_range(first, last, flags);
+}
+
+static int default_dup(int oldfd)
+{
+	init_write();
+
+	if (real_dup == default_dup) {
+		debug("Failed to resolve 'dup', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_dup(oldfd);
+}
+
+static int default_dup2(int oldfd, int newfd)
+{
+	init_write();
+
+	if (real_dup2 == default_dup2) {
+		debug("Failed to resolve 'dup2', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_dup2(oldfd, newfd);
+}
+
+static int default_dup3(int oldfd, int newfd, int flags)
+{
+	init_write();
+
+	if (real_dup3 == default_dup3) {
+		debug("Failed to resolve 'dup3', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_dup3(oldfd, newfd, flags);
+}
+
+static int default_fcntl(int fd, int cmd, ...)
+{
+	void *arg;
+	va_list ap;
+
+	init_write();
+
+	if (real_fcntl == default_fcntl) {
+		debug("Failed to resolve 'fcntl', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	return real_fcntl(fd, cmd, arg);
+}
+
+static int default_socket(int domain, int type, int protocol)
+{
+	init_write();
+
+	if (real_socket == default_socket) {
+		debug("Failed to resolve 'socket', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_socket(domain, type, protocol);
+}
+
+static int default_socketpair(int domain, int type, int protocol, int sv[2])
+{
+	init_write();
+
+	if (real_socketpair == default_socketpair) {
+		debug("Failed to resolve 'socketpair', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_socketpair(domain, type, protocol, sv);
+}
+
+static int default_accept(int sockfd, struct sockaddr *addr,
+			  socklen_t * addrlen)
+{
+	init_write();
+
+	if (real_accept == default_accept) {
+		debug("Failed to resolve 'accept', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_accept(sockfd, addr, addrlen);
+}
+
+static int default_accept4(int sockfd, struct sockaddr *addr,
+			   socklen_t * addrlen, int flags)
+{
+	init_write();
+
+	if (real_accept4 == default_accept4) {
+		debug("Failed to resolve 'accept4', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_accept4(sockfd, addr, addrlen, flags);
+}
+
+static void *default_mmap(void *addr, size_t length, int prot, int flags,
+			  int fd, off_t offset)
+{
+	init_write();
+
+	if (real_mmap == default_mmap) {
+		debug("Failed to resolve 'mmap', returning EINVAL\n");
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+static int default_munmap(void *addr, size_t length)
+{
+	init_write();
+
+	if (real_munmap == default_munmap) {
+		debug("Failed to resolve 'munmap', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_munmap(addr, length);
+}
+
+static int default_mprotect(void *addr, size_t len, int prot)
+{
+	init_write();
+
+	if (real_mprotect == default_mprotect) {
+		debug("Failed to resolve 'mprotect', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_mprotect(addr, len, prot);
+}
+
+static void *default_mremap(void *old_address, size_t old_size,
+			    size_t new_size, int flags, ...)
+{
+	void *new_address;
+	va_list ap;
+
+	init_write();
+
+	if (real_mremap == default_mremap) {
+		debug("Failed to resolve 'mremap', returning EINVAL\n");
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	va_start(ap, flags);
+	new_address = va_arg(ap, void *);
+	va_end(ap);
+
+	return real_mremap(old_address, old_size, new_size, flags,
+			   new_address);
+}
+
+static int default_pthread_create(pthread_t * thread,
+				  const pthread_attr_t * attr,
+				  void *(*start) (void *), void *arg)
+{
+	init_write();
+
+	if (real_pthread_create == default_pthread_create) {
+		debug("Failed to resolve 'pthread_create', returning EINVAL\n");
+		return EINVAL;
+	}
+
+	return real_pthread_create(thread, attr, start, arg);
+}
+
+static ssize_t default_recvmsg(int sockfd, struct msghdr *msg, int flags)
+{
+	init_write();
+
+	if (real_recvmsg == default_recvmsg) {
+		debug("Failed to resolve 'recvmsg', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_recvmsg(sockfd, msg, flags);
+}
+
+static ssize_t default_vmsplice(int fd, const struct iovec *iov,
+				size_t nr_segs, unsigned int flags)
+{
+	init_write();
+
+	if (real_vmsplice == default_vmsplice) {
+		debug("Failed to resolve 'vmsplice', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_vmsplice(fd, iov, nr_segs, flags);
+}
+
+static int default_aio_write(struct aiocb *aiocbp)
+{
+	init_write();
+
+	if (real_aio_write == default_aio_write) {
+		debug("Failed to resolve 'aio_write', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_aio_write(aiocbp);
+}
+
+static int default_lio_listio(int mode, struct aiocb *const list[], int nent,
+			      struct sigevent *sevp)
+{
+	init_write();
+
+	if (real_lio_listio == default_lio_listio) {
+		debug("Failed to resolve 'lio_listio', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_lio_listio(mode, list, nent, sevp);
+}
+
+static ssize_t default_aio_return(struct aiocb *aiocbp)
+{
+	init_write();
+
+	if (real_aio_return == default_aio_return) {
+		debug("Failed to resolve 'aio_return', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_aio_return(aiocbp);
+}
+
+static int default_aio_suspend(const struct aiocb *const list[], int nent,
+			       const struct timespec *timeout)
+{
+	init_write();
+
+	if (real_aio_suspend == default_aio_suspend) {
+		debug("Failed to resolve 'aio_suspend', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_aio_suspend(list, nent, timeout);
+}
+
+static int default_aio_error(const struct aiocb *aiocbp)
+{
+	init_write();
+
+	if (real_aio_error == default_aio_error) {
+		debug("Failed to resolve 'aio_error', returning EINVAL\n");
+		return EINVAL;
+	}
+
+	return real_aio_error(aiocbp);
+}
+
+static int default_fflush(FILE * stream)
+{
+	init_write();
+
+	if (real_fflush == default_fflush) {
+		debug("Failed to resolve 'fflush', returning EOF\n");
+		errno = EINVAL;
+		return EOF;
+	}
+
+	return real_fflush(stream);
+}
+
+static int default_fclose(FILE * stream)
+{
+	init_write();
+
+	if (real_fclose == default_fclose) {
+		debug("Failed to resolve 'fclose', returning EOF\n");
+		errno = EINVAL;
+		return EOF;
+	}
+
+	return real_fclose(stream);
+}
+
+static int default_setvbuf(FILE * stream, char *buf, int mode, size_t size)
+{
+	init_write();
+
+	if (real_setvbuf == default_setvbuf) {
+		debug("Failed to resolve 'setvbuf', returning EINVAL\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return real_setvbuf(stream, buf, mode, size);
+}
+
+/**
+ * All the functions below only scrub the bytes accepted by the kernel
+ * (the prefix given by the return value). Nothing is scrubbed on error
+ * and the rest of a partial write is left untouched so that an
+ * application using non-blocking I/O can still retry it.
+ */
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	ssize_t rc = real_write(fd, buf, count);
+
+	if (buf && (rc > 0) && fd_scrub(fd)) {
+		/**
+		 * We violate the prototype here as buf is a const void 
+		 * We should not change the content of buf but ...
+		 * most of the time it is harmless and it allows to 
+		 * guaranty that the data is indeed zeroized as it is
+		 * not needed anymore
+		 * This might prevent some application to work if they do expect
+		 * their data to be still available after the write.
+		 */
+
+		write_scrub(buf, rc);
+	}
+
+	return rc;
+}
+
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
+	       const struct sockaddr * dest_addr, socklen_t addrlen)
+{
+	struct zc_socket *zc = zc_lock(sockfd, &flags, 1);
+	ssize_t rc = real_sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+
+	if (buf && (rc > 0) && fd_scrub(sockfd)) {
+		struct iovec iov = { (void *)buf, len };
+
+		if ((flags & MSG_ZEROCOPY) &&
+		    zc_track(zc, sockfd, &iov, 1, rc)) {
+			zc_unlock(zc);
+			return rc;
+		}
+		zc_unlock(zc);
+
+		/**
+		 * We violate the prototype here as buf is a const void 
+		 * We should not change the content of buf but ...
+		 * most of the time it is harmless and it allows to 
+		 * guaranty that the data is indeed zeroized as it is
+		 * not needed anymore
+		 * This might prevent some application to work if they do expect
+		 * their data to be still available after the write.
+		 */
+
+		write_scrub(buf, rc);
+		return rc;
+	}
+
+	zc_unlock(zc);
+
+	return rc;
+}
+
+ssize_t sendmsg(int sockfd, const struct msghdr * msg, int flags)
+{
+	struct zc_socket *zc = zc_lock(sockfd, &flags,
+				       msg ? msg->msg_iovlen : 0);
+	ssize_t rc = real_sendmsg(sockfd, msg, flags);
+
+	if (msg && (rc > 0) && fd_scrub(sockfd)) {
+		if ((flags & MSG_ZEROCOPY) &&
+		    zc_track(zc, sockfd, msg->msg_iov, msg->msg_iovlen, rc)) {
+			zc_unlock(zc);
+			return rc;
+		}
+		zc_unlock(zc);
+		write_scrub_iov(msg->msg_iov, msg->msg_iovlen, rc);
+		return rc;
+	}
+
+	zc_unlock(zc);
+
+	return rc;
+}
+
+ssize_t send(int sockfd, const void *buf, size_t len, int flags)
+{
+	return sendto(sockfd, buf, len, flags, NULL, 0);
+}
+
+ssize_t writev(int fd, const struct iovec * iov, int iovcnt)
+{
+	ssize_t rc = real_writev(fd, iov, iovcnt);
+
+	if ((rc > 0) && fd_scrub(fd)) {
+		write_scrub_iov(iov, iovcnt, rc);
+	}
+
+	return rc;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	ssize_t rc = real_pwrite(fd, buf, count, offset);
+
+	if (buf && (rc > 0) && fd_scrub(fd)) {
+		write_scrub(buf, rc);
+	}
+
+	return rc;
+}
+
+ssize_t pwritev(int fd, const struct iovec * iov, int iovcnt, off_t offset)
+{
+	ssize_t rc = real_pwritev(fd, iov, iovcnt, offset);
+
+	if ((rc > 0) && fd_scrub(fd)) {
+		write_scrub_iov(iov, iovcnt, rc);
+	}
+
+	return rc;
+}
+
+ssize_t pwritev2(int fd, const struct iovec * iov, int iovcnt, off_t offset,
+		 int flags)
+{
+	ssize_t rc = real_pwritev2(fd, iov, iovcnt, offset, flags);
+
+	if ((rc > 0) && fd_scrub(fd)) {
+		write_scrub_iov(iov, iovcnt, rc);
+	}
+
+	return rc;
+}
+
+#if __WORDSIZE == 64
+/*
+ * Programs built with _FILE_OFFSET_BITS=64 call the LFS variants. On 64
+ * bit systems off64_t is off_t and glibc implements both names with the
+ * same functions.
+ */
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+	return pwrite(fd, buf, count, offset);
+}
+
+ssize_t pwritev64(int fd, const struct iovec * iov, int iovcnt,
+		  off64_t offset)
+{
+	return pwritev(fd, iov, iovcnt, offset);
+}
+
+ssize_t pwritev64v2(int fd, const struct iovec * iov, int iovcnt,
+		    off64_t offset, int flags)
+{
+	return pwritev2(fd, iov, iovcnt, offset, flags);
+}
+#endif
+
+/**
+ * The kernel returns the number of messages sent and stores in msg_len
+ * the number of bytes sent for each of them. Only these bytes are
+ * scrubbed, in a single pass over the iovecs of all the sent messages.
+ */
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	struct zc_socket *zc;
+	size_t count = 0;
+	int rc;
+	int i;
+
+	for (i = 0; msgvec && (i < (int)MIN(vlen, UIO_MAXIOV)); i++) {
+		count += msgvec[i].msg_hdr.msg_iovlen;
+	}
+
+	zc = zc_lock(sockfd, &flags, count);
+	rc = real_sendmmsg(sockfd, msgvec, vlen, flags);
+
+	if ((rc > 0) && fd_scrub(sockfd)) {
+		/* with MSG_ZEROCOPY each message sent gets its own id */
+		if ((flags & MSG_ZEROCOPY) &&
+		    zc_track(zc, sockfd, msgvec[0].msg_hdr.msg_iov,
+			     msgvec[0].msg_hdr.msg_iovlen, msgvec[0].msg_len)) {
+			for (i = 1; i < rc; i++) {
+				zc_track(zc, sockfd, msgvec[i].msg_hdr.msg_iov,
+					 msgvec[i].msg_hdr.msg_iovlen,
+					 msgvec[i].msg_len);
+			}
+			zc_unlock(zc);
+			return rc;
+		}
+		zc_unlock(zc);
+		write_scrub_mmsg(msgvec, rc);
+		return rc;
+	}
+
+	zc_unlock(zc);
+
+	return rc;
+}
+
+/**
+ * Zerocopy completions are read from the error queue.
+ */
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
+{
+	ssize_t rc = real_recvmsg(sockfd, msg, flags);
+
+	if ((rc >= 0) && (flags & MSG_ERRQUEUE) && msg) {
+		zc_errqueue(sockfd, msg);
+	}
+
+	return rc;
+}
+
+/**
+ * sendfile() and splice() move data between fds without going through
+ * a user buffer so there is nothing to scrub. vmsplice() on the read
+ * end of a pipe copies data into iov.
+ */
+ssize_t vmsplice(int fd, const struct iovec * iov, size_t nr_segs,
+		 unsigned int flags)
+{
+	if (!fd_scrub(fd) || ((fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDONLY)) {
+		return real_vmsplice(fd, iov, nr_segs, flags);
+	}
+
+	return vs_splice(fd, iov, nr_segs, flags);
+}
+
+/*
+ * The functions below only keep the per fd state in sync.
+ */
+int close(int fd)
+{
+	int rc;
+
+	zc_linger(fd);
+	rc = real_close(fd);
+
+	/* reset after the close so a concurrent write cannot cache it again */
+	fd_reset(fd, 0);
+
+	return rc;
+}
+
+/**
+ * With CLOSE_RANGE_CLOEXEC nothing is closed yet. Only the fds we cache
+ * are reset.
+ */
+int close_range(unsigned int first, unsigned int last, int flags)
+{
+	unsigned int fd;
+	int rc;
+
+	if (!(flags & CLOSE_RANGE_CLOEXEC)) {
+		for (fd = first; (fd <= last) && (fd < FD_CACHE_SIZE); fd++) {
+			zc_linger(fd);
+		}
+	}
+
+	rc = real_close_range(first, last, flags);
+
+	if (!rc && !(flags & CLOSE_RANGE_CLOEXEC)) {
+		for (fd = first; (fd <= last) && (fd < FD_CACHE_SIZE); fd++) {
+			fd_reset(fd, 0);
+		}
+	}
+
+	return rc;
+}
+
+int dup(int oldfd)
+{
+	int rc = real_dup(oldfd);
+
+	if (rc >= 0) {
+		fd_reset(rc, 0);
+	}
+
+	return rc;
+}
+
+int dup2(int oldfd, int newfd)
+{
+	int rc;
+
+	if (oldfd != newfd) {
+		zc_linger(newfd);
+	}
+	rc = real_dup2(oldfd, newfd);
+
+	if (rc >= 0) {
+		fd_reset(rc, 0);
+	}
+
+	return rc;
+}
+
+int dup3(int oldfd, int newfd, int flags)
+{
+	int rc;
+
+	if (oldfd != newfd) {
+		zc_linger(newfd);
+	}
+	rc = real_dup3(oldfd, newfd, flags);
+
+	if (rc >= 0) {
+		fd_reset(rc, 0);
+	}
+
+	return rc;
+}
+
+/**
+ * Only F_DUPFD and F_DUPFD_CLOEXEC create an fd. The argument is passed
+ * on as a pointer, as the libc does, whatever the command.
+ */
+int fcntl(int fd, int cmd, ...)
+{
+	void *arg;
+	va_list ap;
+	int rc;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	rc = real_fcntl(fd, cmd, arg);
+
+	if ((rc >= 0) && ((cmd == F_DUPFD) || (cmd == F_DUPFD_CLOEXEC))) {
+		fd_reset(rc, 0);
+	}
+
+	return rc;
+}
+
+#if __WORDSIZE == 64
+/*
+ * fcntl64 is what programs built with _FILE_OFFSET_BITS=64 call. On 64
+ * bit systems it is the same function as fcntl.
+ */
+int fcntl64(int fd, int cmd, ...)
+{
+	void *arg;
+	va_list ap;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	return fcntl(fd, cmd, arg);
+}
+#endif
+
+int socket(int domain, int type, int protocol)
+{
+	int rc = real_socket(domain, type, protocol);
+
+	if (rc >= 0) {
+		fd_reset(rc, fd_class_of_family(domain));
+	}
+
+	return rc;
+}
+
+int socketpair(int domain, int type, int protocol, int sv[2])
+{
+	int rc = real_socketpair(domain, type, protocol, sv);
+
+	if (!rc) {
+		fd_reset(sv[0], fd_class_of_family(domain));
+		fd_reset(sv[1], fd_class_of_family(domain));
+	}
+
+	return rc;
+}
+
+int accept(int sockfd, struct sockaddr *addr, socklen_t * addrlen)
+{
+	int rc = real_accept(sockfd, addr, addrlen);
+
+	if (rc >= 0) {
+		fd_reset(rc, 0);
+	}
+
+	return rc;
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t * addrlen, int flags)
+{
+	int rc = real_accept4(sockfd, addr, addrlen, flags);
+
+	if (rc >= 0) {
+		fd_reset(rc, 0);
+	}
+
+	return rc;
+}
+
+/*
+ * The functions below keep the region classifier up to date. A new
+ * mapping at an unknown address and an unmapped range are written into
+ * a copy of the table. A mapping replacing one the table knows (MAP_FIXED,
+ * or an address the libc unmapped behind our back), a protection change
+ * and a remap mark it stale instead.
+ */
+void *mmap(void *addr, size_t length, int prot, int flags, int fd,
+	   off_t offset)
+{
+	void *rc = real_mmap(addr, length, prot, flags, fd, offset);
+	uintptr_t start = (uintptr_t) rc;
+	uintptr_t end;
+
+	if (rc == MAP_FAILED) {
+		return rc;
+	}
+
+	end = (start + length + getpagesize() - 1) & ~(getpagesize() - 1);
+	if (region_known(start, end)) {
+		region_invalidate();
+	} else {
+		region_update(start, end, (prot & PROT_WRITE) &&
+			      ((flags & MAP_TYPE) == MAP_PRIVATE) &&
+			      (flags & MAP_ANONYMOUS));
+	}
+
+	return rc;
+}
+
+#if __WORDSIZE == 64
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd,
+	     off64_t offset)
+{
+	return mmap(addr, length, prot, flags, fd, offset);
+}
+#endif
+
+int munmap(void *addr, size_t length)
+{
+	uintptr_t start = (uintptr_t) addr;
+	uintptr_t end;
+	int rc = real_munmap(addr, length);
+
+	end = (start + length + getpagesize() - 1) & ~(getpagesize() - 1);
+	if (!rc && !region_update(start, end, -1)) {
+		region_invalidate();
+	}
+
+	return rc;
+}
+
+int mprotect(void *addr, size_t len, int prot)
+{
+	int rc = real_mprotect(addr, len, prot);
+
+	region_invalidate();
+
+	return rc;
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags,
+	     ...)
+{
+	void *new_address;
+	void *rc;
+	va_list ap;
+
+	va_start(ap, flags);
+	new_address = va_arg(ap, void *);
+	va_end(ap);
+
+	rc = real_mremap(old_address, old_size, new_size, flags, new_address);
+
+	region_invalidate();
+
+	return rc;
+}
+
+/*
+ * New threads record their stack before running the application code
+ * so that the region classifier leaves it alone.
+ */
+struct region_thread {
+	void *(*start) (void *);
+	void *arg;
+};
+
+static void *region_thread_start(void *data)
+{
+	struct region_thread thread = *(struct region_thread *)data;
+	void *rc;
+
+	free(data);
+
+	region_stack_add();
+
+	pthread_cleanup_push(region_stack_remove, NULL);
+	rc = thread.start(thread.arg);
+	pthread_cleanup_pop(1);
+
+	return rc;
+}
+
+int pthread_create(pthread_t * thread, const pthread_attr_t * attr,
+		   void *(*start) (void *), void *arg)
+{
+	struct region_thread *data;
+	void *stack = NULL;
+	size_t size;
+	int rc;
+
+	if (attr && pthread_attr_getstack(attr, &stack, &size)) {
+		stack = NULL;
+	}
+
+	/* a stack given by the application is not recorded */
+	if (!region_enabled || stack ||
+	    !(data = malloc(sizeof(struct region_thread)))) {
+		return real_pthread_create(thread, attr, start, arg);
+	}
+
+	data->start = start;
+	data->arg = arg;
+
+	rc = real_pthread_create(thread, attr, region_thread_start, data);
+	if (rc) {
+		free(data);
+	}
+
+	return rc;
+}
+
+/*
+ * stdio stream buffers.
+ *
+ * Data written with fwrite(), fprintf() and the like is copied to the
+ * stream buffer and written by the libc internally, without going
+ * through our write(). Scrubbing the user buffer of each call would be
+ * far too costly, instead the whole stream buffer is scrubbed once it
+ * has been flushed: by fflush(), fclose() and setvbuf() (which may
+ * replace it). Buffers flushed because they were full, or at exit(),
+ * are scrubbed by the next of these calls.
+ *
+ * This relies on the glibc FILE layout (struct _IO_FILE). Only byte
+ * oriented streams on an fd with FD_STDIO, whose buffer holds neither
+ * pending output nor unread input, are scrubbed.
+ */
+
+/* glibc libio flags, not exported by the public headers */
+#define STDIO_NO_READS		0x0004
+#define STDIO_IN_BACKUP		0x0100
+#define STDIO_CURRENTLY_PUTTING	0x0800
+
+/**
+ * Return non zero if the buffers of stream shall be scrubbed.
+ */
+static int stdio_scrub_enabled(FILE * stream)
+{
+	int fd;
+	unsigned char entry;
+
+	if (!__atomic_load_n(&stdio_enabled, __ATOMIC_RELAXED) || !stream) {
+		return 0;
+	}
+
+	fd = stream->_fileno;
+	if ((fd < 0) || (fd >= FD_CACHE_SIZE)) {
+		return 0;
+	}
+
+	entry = __atomic_load_n(&fd_cache[fd], __ATOMIC_RELAXED);
+	if (!entry) {
+		entry = fd_classify(fd);
+	}
+
+	return entry & FD_STDIO;
+}
+
+/**
+ * Scrub the buffer of a locked stream if it holds no data any more.
+ */
+static void stdio_scrub(FILE * stream)
+{
+	if (!stream->_IO_buf_base || (stream->_mode > 0) ||
+	    (stream->_flags & STDIO_IN_BACKUP) ||
+	    !(stream->_flags & (STDIO_NO_READS | STDIO_CURRENTLY_PUTTING)) ||
+	    (stream->_IO_write_ptr != stream->_IO_write_base) ||
+	    (stream->_IO_read_ptr != stream->_IO_read_end)) {
+		return;
+	}
+
+	clean_scrub(stream->_IO_buf_base,
+		    stream->_IO_buf_end - stream->_IO_buf_base);
+}
+
+/**
+ * fflush(NULL): scrub every enabled stream that is not in use.
+ */
+static void stdio_scrub_all(void)
+{
+	FILE *stream;
+
+	if (!stdio_list_all) {
+		return;
+	}
+
+	stdio_list_lock();
+	for (stream = *stdio_list_all; stream; stream = stream->_chain) {
+		if (stdio_scrub_enabled(stream) && !ftrylockfile(stream)) {
+			stdio_scrub(stream);
+			funlockfile(stream);
+		}
+	}
+	stdio_list_unlock();
+}
+
+int fflush(FILE * stream)
+{
+	int rc;
+
+	if (!stream) {
+		rc = real_fflush(NULL);
+		if (__atomic_load_n(&stdio_enabled, __ATOMIC_RELAXED)) {
+			stdio_scrub_all();
+		}
+		return rc;
+	}
+
+	if (!stdio_scrub_enabled(stream)) {
+		return real_fflush(stream);
+	}
+
+	flockfile(stream);
+	rc = real_fflush(stream);
+	if (!rc) {
+		stdio_scrub(stream);
+	}
+	funlockfile(stream);
+
+	return rc;
+}
+
+int fclose(FILE * stream)
+{
+	int fd = stream->_fileno;
+	int rc;
+
+	if (stdio_scrub_enabled(stream)) {
+		flockfile(stream);
+		if (!real_fflush(stream)) {
+			stdio_scrub(stream);
+		}
+		funlockfile(stream);
+	}
+
+	rc = real_fclose(stream);
+
+	/* the libc closed the fd without going through our close() */
+	if (fd >= 0) {
+		fd_reset(fd, 0);
+	}
+
+	return rc;
+}
+
+int setvbuf(FILE * stream, char *buf, int mode, size_t size)
+{
+	int rc;
+
+	if (!stdio_scrub_enabled(stream)) {
+		return real_setvbuf(stream, buf, mode, size);
+	}
+
+	/* the current buffer may be released or left to the application */
+	flockfile(stream);
+	if (!real_fflush(stream)) {
+		stdio_scrub(stream);
+	}
+	rc = real_setvbuf(stream, buf, mode, size);
+	funlockfile(stream);
+
+	return rc;
+}
+
+int clean_write_stdio_enable(FILE * stream, int enable)
+{
+	int fd = stream ? stream->_fileno : -1;
+
+	if ((fd < 0) || (fd >= FD_CACHE_SIZE)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!__atomic_load_n(&fd_cache[fd], __ATOMIC_RELAXED)) {
+		fd_classify(fd);
+	}
+
+	if (enable) {
+		__atomic_store_n(&stdio_enabled, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_or(&fd_cache[fd], FD_STDIO, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_and(&fd_cache[fd], ~FD_STDIO, __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+void clean_write_barrier(void)
+{
+	if (defer_enabled) {
+		defer_drain_all();
+	}
+}
+
+void clean_write_forget(void *ptr)
+{
+	struct defer_queue *queue = defer_self;
+
+	if (!defer_enabled || !ptr) {
+		return;
+	}
+
+	/* the block is most often freed by the thread that wrote it */
+	if (queue && (queue != DEFER_EXITED) && !defer_forget(queue, ptr)) {
+		return;
+	}
+
+	pthread_mutex_lock(&defer_list_lock);
+	for (queue = defer_list; queue; queue = queue->next) {
+		if (!defer_forget(queue, ptr)) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&defer_list_lock);
+}
+
+/*
+ * io_uring buffer tracker (see clean_uring.h).
+ *
+ * Requests in flight are kept in an open addressing hash table keyed
+ * by user_data. Completed requests move their (res bytes long) ranges
+ * to the done array, scrubbed in one pass by clean_uring_scrub().
+ */
+#define CU_FREE		0
+#define CU_USED		1
+#define CU_DELETED	2
+
+struct cu_entry {
+	uint64_t user_data;
+	int state;
+	int sent;		/* res of a IORING_CQE_F_MORE completion */
+	int iovcnt;
+	struct iovec one;
+	struct iovec *iov;	/* &one or an allocated copy */
+};
+
+struct clean_uring {
+	size_t size;		/* power of 2 */
+	size_t used;
+	size_t deleted;
+	struct cu_entry *entries;
+	size_t done_count;
+	size_t done_size;
+	struct iovec *done;
+};
+
+static size_t cu_hash(uint64_t user_data, size_t size)
+{
+	return (size_t)((user_data * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+/**
+ * Return the entry of user_data, or the slot where it can be added.
+ */
+static struct cu_entry *cu_find(struct clean_uring *cu, uint64_t user_data)
+{
+	struct cu_entry *slot = NULL;
+	size_t i = cu_hash(user_data, cu->size);
+
+	for (;;) {
+		struct cu_entry *entry = &cu->entries[i];
+
+		if (entry->state == CU_FREE) {
+			return slot ? slot : entry;
+		}
+		if ((entry->state == CU_USED) &&
+		    (entry->user_data == user_data)) {
+			return entry;
+		}
+		if (!slot && (entry->state == CU_DELETED)) {
+			slot = entry;
+		}
+		i = (i + 1) & (cu->size - 1);
+	}
+}
+
+static void cu_release(struct clean_uring *cu, struct cu_entry *entry)
+{
+	if (entry->iov != &entry->one) {
+		free(entry->iov);
+	}
+	entry->iov = NULL;
+	entry->state = CU_DELETED;
+	cu->used--;
+	cu->deleted++;
+}
+
+/**
+ * Queue the first len bytes of the buffer of entry for scrubbing.
+ */
+static void cu_queue(struct clean_uring *cu, struct cu_entry *entry,
+		     size_t len)
+{
+	int i;
+
+	for (i = 0; (i < entry->iovcnt) && len; i++) {
+		size_t n = MIN(entry->iov[i].iov_len, len);
+
+		len -= n;
+		if (!n || !entry->iov[i].iov_base) {
+			continue;
+		}
+
+		if (cu->done_count == cu->done_size) {
+			size_t size = cu->done_size ? cu->done_size * 2 : 64;
+			struct iovec *done;
+
+			done = realloc(cu->done, size * sizeof(*done));
+			if (!done) {
+				/* scrub what we have to make room */
+				clean_uring_scrub(cu);
+				if (!cu->done_size) {
+					break;
+				}
+			} else {
+				cu->done = done;
+				cu->done_size = size;
+			}
+		}
+
+		cu->done[cu->done_count].iov_base = entry->iov[i].iov_base;
+		cu->done[cu->done_count].iov_len = n;
+		cu->done_count++;
+	}
+}
+
+/**
+ * Make room in the done array for one range per request in flight, so
+ * that completing single buffer requests does not allocate.
+ */
+static int cu_reserve(struct clean_uring *cu)
+{
+	size_t size = cu->done_size ? cu->done_size : 64;
+	struct iovec *done;
+
+	while (size < cu->used) {
+		size *= 2;
+	}
+
+	if (size == cu->done_size) {
+		return 0;
+	}
+
+	done = realloc(cu->done, size * sizeof(*done));
+	if (!done) {
+		return -1;
+	}
+	cu->done = done;
+	cu->done_size = size;
+
+	return 0;
+}
+
+/**
+ * Grow (or clean the tombstones of) the table so that at least one
+ * quarter of it stays free.
+ */
+static int cu_resize(struct clean_uring *cu)
+{
+	struct cu_entry *old = cu->entries;
+	size_t old_size = cu->size;
+	size_t size = old_size;
+	size_t i;
+
+	if (((cu->used + cu->deleted + 1) * 4) <= (size * 3)) {
+		return 0;
+	}
+
+	if (((cu->used + 1) * 2) > size) {
+		size *= 2;
+	}
+
+	cu->entries = calloc(size, sizeof(*cu->entries));
+	if (!cu->entries) {
+		cu->entries = old;
+		return -1;
+	}
+	cu->size = size;
+	cu->deleted = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].state == CU_USED) {
+			struct cu_entry *entry = cu_find(cu, old[i].user_data);
+
+			*entry = old[i];
+			if (old[i].iov == &old[i].one) {
+				entry->iov = &entry->one;
+			}
+		}
+	}
+
+	free(old);
+
+	return 0;
+}
+
+struct clean_uring *clean_uring_create(unsigned int entries)
+{
+	struct clean_uring *cu = calloc(1, sizeof(*cu));
+	size_t size = 16;
+
+	if (!cu) {
+		return NULL;
+	}
+
+	while (size < ((size_t)entries * 2)) {
+		size *= 2;
+	}
+
+	cu->entries = calloc(size, sizeof(*cu->entries));
+	if (!cu->entries) {
+		free(cu);
+		return NULL;
+	}
+	cu->size = size;
+
+	return cu;
+}
+
+void clean_uring_destroy(struct clean_uring *cu)
+{
+	size_t i;
+
+	if (!cu) {
+		return;
+	}
+
+	for (i = 0; i < cu->size; i++) {
+		if (cu->entries[i].state == CU_USED) {
+			cu_queue(cu, &cu->entries[i], SIZE_MAX);
+			cu_release(cu, &cu->entries[i]);
+		}
+	}
+	clean_uring_scrub(cu);
+
+	free(cu->entries);
+	free(cu->done);
+	free(cu);
+}
+
+int clean_uring_track_iov(struct clean_uring *cu, uint64_t user_data, int fd,
+			  const struct iovec *iov, int iovcnt)
+{
+	struct cu_entry *entry;
+
+	if (!cu || !iov || (iovcnt <= 0) || ((fd >= 0) && !fd_scrub(fd))) {
+		return -1;
+	}
+
+	if (cu_resize(cu)) {
+		return -1;
+	}
+
+	entry = cu_find(cu, user_data);
+	if (entry->state == CU_USED) {
+		debug("user_data %llu reused while in flight\n",
+		      (unsigned long long)user_data);
+		/* its completion cannot be told apart, scrub it all */
+		cu_queue(cu, entry, SIZE_MAX);
+		cu_release(cu, entry);
+	}
+
+	if (iovcnt == 1) {
+		entry->one = iov[0];
+		entry->iov = &entry->one;
+	} else {
+		/* the array may not live until the completion */
+		entry->iov = malloc(iovcnt * sizeof(*iov));
+		if (!entry->iov) {
+			return -1;
+		}
+		memcpy(entry->iov, iov, iovcnt * sizeof(*iov));
+	}
+
+	if (entry->state == CU_DELETED) {
+		cu->deleted--;
+	}
+	entry->user_data = user_data;
+	entry->state = CU_USED;
+	entry->sent = 0;
+	entry->iovcnt = iovcnt;
+	cu->used++;
+
+	return 0;
+}
+
+int clean_uring_track(struct clean_uring *cu, uint64_t user_data, int fd,
+		      const void *buf, size_t len)
+{
+	struct iovec iov = { (void *)buf, len };
+
+	return clean_uring_track_iov(cu, user_data, fd, &iov, 1);
+}
+
+void clean_uring_complete(struct clean_uring *cu, uint64_t user_data, int res,
+			  unsigned int flags)
+{
+	struct cu_entry *entry;
+
+	if (!cu) {
+		return;
+	}
+
+	entry = cu_find(cu, user_data);
+	if (entry->state != CU_USED) {
+		return;
+	}
+
+	if (flags & IORING_CQE_F_MORE) {
+		/* zerocopy send, the buffer is in use until the notification */
+		entry->sent = res;
+		return;
+	}
+
+	if (flags & IORING_CQE_F_NOTIF) {
+		res = entry->sent;
+	}
+
+	cu_queue(cu, entry, (res > 0) ? (size_t)res : 0);
+	cu_release(cu, entry);
+}
+
+void clean_uring_scrub(struct clean_uring *cu)
+{
+	if (!cu || !cu->done_count) {
+		return;
+	}
+
+	write_scrub_iov(cu->done, cu->done_count, SIZE_MAX);
+	cu->done_count = 0;
+}
+
+/*
+ * POSIX AIO.
+ *
+ * The buffer of an aio_write() (or of a LIO_WRITE of lio_listio()) is
+ * in use until the operation completes. It is recorded, keyed by its
+ * aiocb, in an io_uring tracker and scrubbed (up to the number of bytes
+ * written) when the application gets the result: in aio_return(), for
+ * the completed operations of the list given to aio_suspend(), and for
+ * the whole list after a LIO_WAIT lio_listio(). The scrubs found
+ * completed by one call are done in a single batch.
+ *
+ * The glibc aio_return() can be called more than once, so it is used
+ * to read the result of operations completed under aio_suspend().
+ *
+ * aio_return() is async-signal-safe: it neither waits for aio_lock nor
+ * allocates. Its result is recorded in a free slot of aio_done, and the
+ * slots are drained under aio_lock, by aio_return() itself when the
+ * lock is free or else by the holder of the lock before releasing it.
+ * The tracker reserves the room of the completions when the buffers
+ * are recorded, so draining does not allocate either. The buffers are
+ * scrubbed right away, never deferred (the rings of the deferred mode
+ * may allocate), and the region lookup does not wait either.
+ */
+#define AIO_DONE_SLOTS	64
+#define AIO_CLAIMED	((struct aiocb *)1)
+
+struct aio_done {
+	struct aiocb *aiocbp;	/* NULL, AIO_CLAIMED or a completed aiocb */
+	ssize_t res;
+};
+
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct clean_uring *aio_tracker;
+static struct aio_done aio_done[AIO_DONE_SLOTS];
+static unsigned int aio_done_count;	/* slots recorded */
+
+/**
+ * Record the result of an operation in a free slot without locking.
+ * Returns -1 if all the slots are in use.
+ */
+static int aio_record(struct aiocb *aiocbp, ssize_t res)
+{
+	int i;
+
+	for (i = 0; i < AIO_DONE_SLOTS; i++) {
+		struct aiocb *expected = NULL;
+
+		if (__atomic_compare_exchange_n(&aio_done[i].aiocbp, &expected,
+						AIO_CLAIMED, 0,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED)) {
+			aio_done[i].res = res;
+			__atomic_store_n(&aio_done[i].aiocbp, aiocbp,
+					 __ATOMIC_RELEASE);
+			__atomic_add_fetch(&aio_done_count, 1, __ATOMIC_SEQ_CST);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Move the recorded results to the tracker. Called with aio_lock held.
+ */
+static void aio_drain(void)
+{
+	int i;
+
+	if (!__atomic_load_n(&aio_done_count, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	for (i = 0; i < AIO_DONE_SLOTS; i++) {
+		struct aiocb *aiocbp = __atomic_load_n(&aio_done[i].aiocbp,
+						       __ATOMIC_ACQUIRE);
+		ssize_t res;
+
+		if (!aiocbp || (aiocbp == AIO_CLAIMED)) {
+			continue;
+		}
+
+		res = aio_done[i].res;
+		__atomic_store_n(&aio_done[i].aiocbp, NULL, __ATOMIC_RELEASE);
+		__atomic_sub_fetch(&aio_done_count, 1, __ATOMIC_SEQ_CST);
+
+		clean_uring_complete(aio_tracker, (uintptr_t) aiocbp, res, 0);
+	}
+}
+
+/**
+ * Drain the recorded results, scrub and release aio_lock. A result
+ * recorded after the last drain, while the lock was still held, is
+ * taken care of here as its aio_return() could not get the lock.
+ */
+static void aio_unlock(void)
+{
+	do {
+		aio_drain();
+		defer_off++;
+		clean_uring_scrub(aio_tracker);
+		defer_off--;
+		pthread_mutex_unlock(&aio_lock);
+	} while (__atomic_load_n(&aio_done_count, __ATOMIC_SEQ_CST) &&
+		 !pthread_mutex_trylock(&aio_lock));
+}
+
+static void aio_track(struct aiocb *aiocbp)
+{
+	pthread_mutex_lock(&aio_lock);
+	if (!aio_tracker) {
+		aio_tracker = clean_uring_create(64);
+	}
+	/* a result of a previous use of the aiocb may still be recorded */
+	aio_drain();
+	if (!clean_uring_track(aio_tracker, (uintptr_t) aiocbp,
+			       aiocbp->aio_fildes,
+			       (const void *)aiocbp->aio_buf,
+			       aiocbp->aio_nbytes) &&
+	    cu_reserve(aio_tracker)) {
+		debug("aio completion may allocate\n");
+	}
+	aio_unlock();
+}
+
+/**
+ * Scrub the buffers of the completed operations of a list.
+ * If all is set every operation of the list is known to be complete.
+ */
+static void aio_complete_list(const struct aiocb *const list[], int nent,
+			      int all)
+{
+	int i;
+
+	if (!__atomic_load_n(&aio_tracker, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&aio_lock);
+	for (i = 0; i < nent; i++) {
+		struct aiocb *aiocbp = (struct aiocb *)list[i];
+
+		if (!aiocbp || (!all && (real_aio_error(aiocbp) == EINPROGRESS))) {
+			continue;
+		}
+
+		clean_uring_complete(aio_tracker, (uintptr_t) aiocbp,
+				     real_aio_return(aiocbp), 0);
+	}
+	aio_unlock();
+}
+
+/**
+ * The buffer is recorded before the operation is queued as it may
+ * complete before we get the control back.
+ */
+int aio_write(struct aiocb *aiocbp)
+{
+	int rc;
+
+	aio_track(aiocbp);
+
+	rc = real_aio_write(aiocbp);
+	if (rc) {
+		/* not queued, forget it */
+		pthread_mutex_lock(&aio_lock);
+		clean_uring_complete(aio_tracker, (uintptr_t) aiocbp, -1, 0);
+		aio_unlock();
+	}
+
+	return rc;
+}
+
+int lio_listio(int mode, struct aiocb *const list[], int nent,
+	       struct sigevent *sevp)
+{
+	int rc;
+	int i;
+
+	for (i = 0; i < nent; i++) {
+		if (list[i] && (list[i]->aio_lio_opcode == LIO_WRITE)) {
+			aio_track(list[i]);
+		}
+	}
+
+	rc = real_lio_listio(mode, list, nent, sevp);
+
+	if (mode == LIO_WAIT) {
+		/* on EIO some operations failed, the others completed */
+		aio_complete_list((const struct aiocb * const *)list, nent,
+				  !rc);
+	}
+
+	return rc;
+}
+
+ssize_t aio_return(struct aiocb * aiocbp)
+{
+	ssize_t rc = real_aio_return(aiocbp);
+
+	if (!__atomic_load_n(&aio_tracker, __ATOMIC_ACQUIRE)) {
+		return rc;
+	}
+
+	while (aio_record(aiocbp, rc)) {
+		/* no free slot, drain them if the lock is free */
+		if (pthread_mutex_trylock(&aio_lock)) {
+			debug("aio result not recorded\n");
+			return rc;
+		}
+		aio_unlock();
+	}
+
+	if (!pthread_mutex_trylock(&aio_lock)) {
+		aio_unlock();
+	}
+
+	return rc;
+}
+
+int aio_suspend(const struct aiocb *const list[], int nent,
+		const struct timespec *timeout)
+{
+	int rc = real_aio_suspend(list, nent, timeout);
+
+	if (!rc) {
+		aio_complete_list(list, nent, 0);
+	}
+
+	return rc;
+}
+
+#if __WORDSIZE == 64
+/*
+ * Programs built with _FILE_OFFSET_BITS=64 call the LFS variants. On 64
+ * bit systems struct aiocb64 is struct aiocb and glibc implements both
+ * names with the same functions.
+ */
+int aio_write64(struct aiocb64 *aiocbp)
+{
+	return aio_write((struct aiocb *)aiocbp);
+}
+
+int lio_listio64(int mode, struct aiocb64 *const list[], int nent,
+		 struct sigevent *sevp)
+{
+	return lio_listio(mode, (struct aiocb * const *)list, nent, sevp);
+}
+
+ssize_t aio_return64(struct aiocb64 * aiocbp)
+{
+	return aio_return((struct aiocb *)aiocbp);
+}
+
+int aio_suspend64(const struct aiocb64 *const list[], int nent,
+		  const struct timespec *timeout)
+{
+	return aio_suspend((const struct aiocb * const *)list, nent, timeout);
+}
+#endif
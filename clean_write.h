@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file clean_write.h
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief public API exported by clean_write.so.
+ *
+ * Applications that only rely on LD_PRELOAD do not need this file.
+ * It is meant for applications that want to use the extra services
+ * provided by the library (link with clean_write.so).
+ */
+
+#ifndef CLEAN_WRITE_H
+#define CLEAN_WRITE_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * With CLEAN_WRITE_DEFERRED=1 the blocks allocated by clean_malloc.so
+ * (preloaded too, or clean.so) given whole to write(), send() and the
+ * like are scrubbed some time after the call returns. Other buffers
+ * (stack, static data, parts of a block, ...) are still scrubbed right
+ * away. free() and realloc() drop the pending scrub of a block, but a
+ * block written to again by the application before it is scrubbed may
+ * lose its new content: call clean_write_forget() or
+ * clean_write_barrier() first.
+ *
+ * clean_write_barrier() returns once every buffer written so far, by
+ * any thread, has been scrubbed. It does nothing in the default mode.
+ */
+void clean_write_barrier(void);
+
+/**
+ * Drop the pending deferred scrubs of the block ptr (as returned by
+ * malloc()): its content is kept, and is scrubbed when it is freed.
+ * clean_malloc.so calls it from free() and realloc().
+ */
+void clean_write_forget(void *ptr);
+
+/**
+ * Data written to a stdio stream is copied to its buffer and written by
+ * the libc without going through write(). For the enabled streams the
+ * whole buffer is scrubbed after fflush(), before fclose() releases it
+ * and before setvbuf() replaces it, so the cost is one scrub per flush
+ * rather than one per fwrite() or fprintf().
+ *
+ * clean_write_stdio_enable() enables (or disables) it for the fd of
+ * stream until that fd is closed. CLEAN_WRITE_STDIO enables it for
+ * whole fd classes. Returns 0 or -1 if stream has no fd.
+ */
+int clean_write_stdio_enable(FILE * stream, int enable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLEAN_WRITE_H */
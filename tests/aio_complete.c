@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file aio_complete.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that POSIX AIO write buffers are scrubbed on completion.
+ *
+ * The buffer of an aio_write() must stay intact while the request is in
+ * flight, and be scrubbed up to the number of bytes written once the
+ * application collects the result: by aio_return(), by an aio_suspend()
+ * that finds the request completed, or by a LIO_WAIT lio_listio(). The
+ * file size limit makes a request stop in the middle of its buffer, and
+ * a request that fails must leave its buffer alone.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/aio_complete
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <aio.h>
+#include <sys/resource.h>
+
+#define BUF_SIZE	(64 * 1024)
+#define REQUESTS	8
+#define FILE_LIMIT	(REQUESTS * BUF_SIZE)
+#define PARTIAL_SIZE	1000
+
+static char *buf[REQUESTS];
+static struct aiocb cb[REQUESTS];
+static const struct aiocb *list[REQUESTS];
+
+static void setup(int fd, int count)
+{
+	int i;
+
+	memset(cb, 0, sizeof(cb));
+	for (i = 0; i < count; i++) {
+		memset(buf[i], 'a', BUF_SIZE);
+		cb[i].aio_fildes = fd;
+		cb[i].aio_buf = buf[i];
+		cb[i].aio_nbytes = BUF_SIZE;
+		cb[i].aio_offset = (off_t)i * BUF_SIZE;
+		cb[i].aio_lio_opcode = LIO_WRITE;
+		list[i] = &cb[i];
+	}
+}
+
+/* the first len bytes of buf[i] are expected to be 0, the rest 'a' */
+static int check(const char *what, int i, size_t len)
+{
+	size_t j;
+
+	for (j = 0; j < BUF_SIZE; j++) {
+		if ((buf[i][j] == 0) != (j < len)) {
+			fprintf(stderr, "aio_complete: %s request %d byte %zu "
+				"is %s\n", what, i, j,
+				buf[i][j] ? "not scrubbed" : "scrubbed");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void wait_done(int i)
+{
+	while (aio_error(&cb[i]) == EINPROGRESS) {
+		usleep(1000);
+	}
+}
+
+int main(void)
+{
+	char name[] = "/tmp/aio_completeXXXXXX";
+	struct rlimit limit;
+	ssize_t rc;
+	int fd;
+	int i;
+
+	for (i = 0; i < REQUESTS; i++) {
+		buf[i] = malloc(BUF_SIZE);
+		if (!buf[i]) {
+			perror("aio_complete");
+			return 1;
+		}
+	}
+	fd = mkstemp(name);
+	if (fd < 0) {
+		perror("aio_complete");
+		return 1;
+	}
+	unlink(name);
+
+	/* writes beyond the limit stop short instead of raising a signal */
+	signal(SIGXFSZ, SIG_IGN);
+	getrlimit(RLIMIT_FSIZE, &limit);
+	limit.rlim_cur = FILE_LIMIT;
+	if (setrlimit(RLIMIT_FSIZE, &limit)) {
+		perror("aio_complete: setrlimit");
+		return 1;
+	}
+
+	/* completed but not collected: the buffer is still intact */
+	setup(fd, 1);
+	if (aio_write(&cb[0])) {
+		perror("aio_complete: aio_write");
+		return 1;
+	}
+	wait_done(0);
+	if (check("uncollected", 0, 0)) {
+		return 1;
+	}
+	rc = aio_return(&cb[0]);
+	if ((rc != BUF_SIZE) || check("aio_return", 0, BUF_SIZE)) {
+		fprintf(stderr, "aio_complete: aio_return %zd\n", rc);
+		return 1;
+	}
+
+	/* the completed requests of the list are scrubbed by aio_suspend */
+	setup(fd, REQUESTS);
+	for (i = 0; i < REQUESTS; i++) {
+		if (aio_write(&cb[i])) {
+			perror("aio_complete: aio_write");
+			return 1;
+		}
+	}
+	for (i = 0; i < REQUESTS; i++) {
+		wait_done(i);
+	}
+	if (aio_suspend(list, REQUESTS, NULL)) {
+		perror("aio_complete: aio_suspend");
+		return 1;
+	}
+	for (i = 0; i < REQUESTS; i++) {
+		if (check("aio_suspend", i, BUF_SIZE) ||
+		    (aio_return(&cb[i]) != BUF_SIZE) ||
+		    check("aio_return after aio_suspend", i, BUF_SIZE)) {
+			return 1;
+		}
+	}
+
+	/* the whole list, the last request stops at the file size limit */
+	setup(fd, REQUESTS);
+	cb[REQUESTS - 1].aio_offset = FILE_LIMIT - PARTIAL_SIZE;
+	if (lio_listio(LIO_WAIT, (struct aiocb *const *)list, REQUESTS,
+		       NULL)) {
+		perror("aio_complete: lio_listio");
+		return 1;
+	}
+	for (i = 0; i < REQUESTS - 1; i++) {
+		if (check("lio_listio", i, BUF_SIZE)) {
+			return 1;
+		}
+	}
+	if (check("lio_listio short", REQUESTS - 1, PARTIAL_SIZE)) {
+		return 1;
+	}
+	for (i = 0; i < REQUESTS; i++) {
+		aio_return(&cb[i]);
+	}
+
+	/* beyond the limit the request fails: nothing is scrubbed */
+	setup(fd, 1);
+	cb[0].aio_offset = FILE_LIMIT;
+	if (aio_write(&cb[0])) {
+		perror("aio_complete: aio_write");
+		return 1;
+	}
+	wait_done(0);
+	rc = aio_return(&cb[0]);
+	if ((rc != -1) || check("failed", 0, 0)) {
+		fprintf(stderr, "aio_complete: failed request returned %zd\n",
+			rc);
+		return 1;
+	}
+
+	close(fd);
+	for (i = 0; i < REQUESTS; i++) {
+		free(buf[i]);
+	}
+
+	printf("aio_complete: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file deferred_free.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that a deferred scrub does not outlive its block.
+ *
+ * A block written in deferred mode is scrubbed by the helper thread
+ * some time later. Once the block has been freed and handed to another
+ * allocation, the helper thread must leave the new content alone.
+ *
+ * Usage: CLEAN_WRITE_DEFERRED=1 LD_PRELOAD=./clean.so tests/deferred_free
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE	(64 * 1024)
+#define ROUNDS		64
+#define HELPER_DELAY_US	50000
+
+static int all_equal(const char *buf, char c, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != c) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int main(void)
+{
+	char *blocks[ROUNDS];
+	char *buf;
+	int fd;
+	int i;
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0) {
+		perror("deferred_free: /dev/null");
+		return 1;
+	}
+
+	/* the deferred mode is active: a written block is scrubbed later */
+	buf = malloc(BLOCK_SIZE);
+	memset(buf, 'a', BLOCK_SIZE);
+	if (write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE) {
+		perror("deferred_free: write");
+		return 1;
+	}
+	usleep(HELPER_DELAY_US);
+	if (!all_equal(buf, 0, BLOCK_SIZE)) {
+		fprintf(stderr, "deferred_free: written block not scrubbed\n");
+		return 1;
+	}
+	free(buf);
+
+	/* written then freed at once, the blocks are reused right away */
+	for (i = 0; i < ROUNDS; i++) {
+		buf = malloc(BLOCK_SIZE);
+		memset(buf, 'a', BLOCK_SIZE);
+		if (write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE) {
+			perror("deferred_free: write");
+			return 1;
+		}
+		free(buf);
+
+		blocks[i] = malloc(BLOCK_SIZE);
+		memset(blocks[i], 'b', BLOCK_SIZE);
+	}
+
+	usleep(HELPER_DELAY_US);
+
+	for (i = 0; i < ROUNDS; i++) {
+		if (!all_equal(blocks[i], 'b', BLOCK_SIZE)) {
+			fprintf(stderr, "deferred_free: block %d clobbered by "
+				"a scrub of its previous use\n", i);
+			return 1;
+		}
+		free(blocks[i]);
+	}
+
+	close(fd);
+
+	printf("deferred_free: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file fd_policy.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that only the fd classes listed in CLEAN_WRITE_SCRUB scrub.
+ *
+ * With pipes and unix sockets selected, writes to a file, /dev/null or
+ * a UDP socket leave their buffer alone. The class of an fd is cached by
+ * number, so each number is reused for another class after dup2(),
+ * fcntl(F_DUPFD), close(), close_range() and socket() to check that the
+ * cache follows.
+ *
+ * Usage: CLEAN_WRITE_SCRUB=pipe,unix LD_PRELOAD=./clean_write.so \
+ *        tests/fd_policy
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define BUF_SIZE	4096
+#define FD_NUMBER	100
+
+static char *buf;
+static char sink[BUF_SIZE];
+
+static int check(const char *what, int fd, int peer, int scrubbed)
+{
+	ssize_t rc;
+	size_t i;
+
+	memset(buf, 'a', BUF_SIZE);
+	rc = write(fd, buf, BUF_SIZE);
+	if (rc != BUF_SIZE) {
+		fprintf(stderr, "fd_policy: %s write returned %zd\n", what,
+			rc);
+		return 1;
+	}
+	if (peer >= 0) {
+		while (read(peer, sink, sizeof(sink)) > 0) {
+		}
+	}
+
+	for (i = 0; i < BUF_SIZE; i++) {
+		if ((buf[i] == 0) != scrubbed) {
+			fprintf(stderr, "fd_policy: %s byte %zu is %s\n", what,
+				i, buf[i] ? "not scrubbed" : "scrubbed");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* the lowest free fd number, the one the next open() returns */
+static int lowest_free(void)
+{
+	int fd = dup(0);
+
+	close(fd);
+
+	return fd;
+}
+
+int main(void)
+{
+	char name[] = "/tmp/fd_policyXXXXXX";
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int file, null, udp, low;
+	int p[2], sv[2];
+
+	buf = malloc(BUF_SIZE);
+	file = mkstemp(name);
+	null = open("/dev/null", O_WRONLY);
+	if (!buf || (file < 0) || (null < 0) || pipe2(p, O_NONBLOCK) ||
+	    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) {
+		perror("fd_policy");
+		return 1;
+	}
+	unlink(name);
+
+	/* UDP to a socket of our own */
+	udp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((udp < 0) || bind(udp, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(udp, (struct sockaddr *)&addr, &len) ||
+	    connect(udp, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("fd_policy: udp");
+		return 1;
+	}
+
+	if (check("pipe", p[1], p[0], 1) ||
+	    check("unix socket", sv[0], sv[1], 1) ||
+	    check("file", file, -1, 0) ||
+	    check("/dev/null", null, -1, 0) ||
+	    check("udp socket", udp, udp, 0)) {
+		return 1;
+	}
+
+	/* one fd number, a new class each time */
+	if ((dup2(p[1], FD_NUMBER) != FD_NUMBER) ||
+	    check("dup2 of a pipe", FD_NUMBER, p[0], 1)) {
+		return 1;
+	}
+	if ((dup2(file, FD_NUMBER) != FD_NUMBER) ||
+	    check("dup2 of a file over a pipe", FD_NUMBER, -1, 0)) {
+		return 1;
+	}
+	if ((dup3(sv[0], FD_NUMBER, O_CLOEXEC) != FD_NUMBER) ||
+	    check("dup3 of a unix socket over a file", FD_NUMBER, sv[1], 1)) {
+		return 1;
+	}
+	close(FD_NUMBER);
+	if ((fcntl(null, F_DUPFD, FD_NUMBER) != FD_NUMBER) ||
+	    check("F_DUPFD of /dev/null after close", FD_NUMBER, -1, 0)) {
+		return 1;
+	}
+
+	/* the next fd from open() or socket() reuses a cached number */
+	low = lowest_free();
+	if ((dup2(p[1], low) != low) || check("pipe", low, p[0], 1)) {
+		return 1;
+	}
+	close_range(low, low, 0);
+	if ((open("/dev/null", O_WRONLY) != low) ||
+	    check("/dev/null after close_range", low, -1, 0)) {
+		return 1;
+	}
+	close(low);
+	if ((dup2(sv[0], low) != low) || check("unix socket", low, sv[1], 1)) {
+		return 1;
+	}
+	close(low);
+	if ((socket(AF_INET, SOCK_DGRAM, 0) != low) ||
+	    (connect(low, (struct sockaddr *)&addr, sizeof(addr))) ||
+	    check("udp socket after close", low, udp, 0)) {
+		return 1;
+	}
+
+	close(low);
+	close(udp);
+	close(null);
+	close(file);
+	close(p[0]);
+	close(p[1]);
+	close(sv[0]);
+	close(sv[1]);
+	free(buf);
+
+	printf("fd_policy: ok\n");
+
+	return 0;
+}
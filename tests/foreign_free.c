@@ -0,0 +1,137 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file foreign_free.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that blocks from the C library are freed as foreign ones.
+ *
+ * Blocks obtained from __libc_malloc() or __libc_memalign() have no
+ * header of ours in front of them. free() and realloc() must recognize
+ * them from the ownership index, scrub them and give them back to the C
+ * library without looking for a header.
+ *
+ * Usage: LD_PRELOAD=./clean_malloc.so tests/foreign_free
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+
+#define BLOCK_SIZE	(16 * 1024)
+#define BLOCK_ALIGN	4096
+#define ROUNDS		16
+
+/*
+ * Once released, the C library stores its bin links in the first bytes
+ * of the block and the size of the block in its last word.
+ */
+#define LINKS_SIZE	(4 * sizeof(void *))
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static int check_scrubbed(const char *what, uintptr_t addr, size_t size)
+{
+	const char *buf = (const char *)addr;
+	size_t i;
+
+	for (i = LINKS_SIZE; i < (size - sizeof(size_t)); i++) {
+		if (buf[i]) {
+			fprintf(stderr, "foreign_free: %s byte %zu not "
+				"scrubbed\n", what, i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int run(const char *what, char *buf)
+{
+	uintptr_t freed = (uintptr_t)buf;
+	size_t size;
+
+	if (!buf) {
+		fprintf(stderr, "foreign_free: %s failed\n", what);
+		return 1;
+	}
+
+	size = malloc_usable_size(buf);
+	if (size < BLOCK_SIZE) {
+		fprintf(stderr, "foreign_free: %s usable size %zu\n", what,
+			size);
+		return 1;
+	}
+	memset(buf, 'a', size);
+
+	free(buf);
+
+	return check_scrubbed(what, freed, size);
+}
+
+int main(void)
+{
+	char *guard[3 * ROUNDS];
+	char *buf;
+	size_t i;
+	int r;
+
+	for (r = 0; r < ROUNDS; r++) {
+		/* the guards keep the blocks away from the top of the heap */
+		buf = __libc_malloc(BLOCK_SIZE);
+		guard[3 * r] = __libc_malloc(64);
+		if (run("__libc_malloc", buf)) {
+			return 1;
+		}
+
+		buf = __libc_memalign(BLOCK_ALIGN, BLOCK_SIZE);
+		guard[(3 * r) + 1] = __libc_malloc(64);
+		if (run("__libc_memalign", buf)) {
+			return 1;
+		}
+
+		/* realloc() moves a foreign block into one of ours */
+		buf = __libc_malloc(BLOCK_SIZE);
+		guard[(3 * r) + 2] = __libc_malloc(64);
+		for (i = 0; i < BLOCK_SIZE; i++) {
+			buf[i] = (char)((i % 251) + 1);
+		}
+		buf = realloc(buf, 2 * BLOCK_SIZE);
+		for (i = 0; buf && (i < BLOCK_SIZE); i++) {
+			if (buf[i] != (char)((i % 251) + 1)) {
+				break;
+			}
+		}
+		if (i != BLOCK_SIZE) {
+			fprintf(stderr, "foreign_free: realloc lost byte "
+				"%zu\n", i);
+			return 1;
+		}
+		free(buf);
+	}
+
+	for (r = 0; r < (3 * ROUNDS); r++) {
+		free(guard[r]);
+	}
+
+	printf("foreign_free: ok\n");
+
+	return 0;
+}
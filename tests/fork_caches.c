@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file fork_caches.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that fork() does not leave a cache lock held in the child.
+ *
+ * Worker threads keep allocating and freeing blocks of every cache
+ * while the main thread forks. Each child allocates and frees the same
+ * sizes and must exit before its alarm goes off.
+ *
+ * Usage: CLEAN_MALLOC_HUGEPAGE=1 LD_PRELOAD=./clean_malloc.so \
+ *        tests/fork_caches
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#define WORKERS		4
+#define FORKS		200
+#define CHILD_TIMEOUT_S	10
+
+static volatile int stop;
+
+/* zero pool (calloc), large mappings and hugepage classes */
+static void churn(void)
+{
+	free(calloc(1, 8192));
+	free(malloc(2 * 1024 * 1024));
+	free(malloc(1024));
+}
+
+static void *worker(void *arg)
+{
+	(void)arg;
+
+	while (!stop) {
+		churn();
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[WORKERS];
+	int i;
+
+	for (i = 0; i < WORKERS; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL)) {
+			fprintf(stderr, "fork_caches: pthread_create failed\n");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < FORKS; i++) {
+		int status;
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork_caches: fork");
+			return 1;
+		}
+
+		if (!pid) {
+			alarm(CHILD_TIMEOUT_S);
+			churn();
+			_exit(0);
+		}
+
+		if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) ||
+		    WEXITSTATUS(status)) {
+			fprintf(stderr, "fork_caches: child %d %s\n", i,
+				(WIFSIGNALED(status) &&
+				 (WTERMSIG(status) == SIGALRM)) ?
+				"deadlocked" : "failed");
+			stop = 1;
+			return 1;
+		}
+	}
+
+	stop = 1;
+	for (i = 0; i < WORKERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	printf("fork_caches: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file free_release.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that free() gives the blocks back to the real allocator.
+ *
+ * free() scrubs the header of a block with its content. The real block
+ * must still be released: after many malloc/free rounds the memory in
+ * use in the glibc arena must not have grown.
+ *
+ * Usage: LD_PRELOAD=./clean_malloc.so tests/free_release
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#define ROUNDS		100000
+#define BLOCK_SIZE	1000
+#define MAX_GROWTH	(1024 * 1024)
+
+int main(void)
+{
+	struct mallinfo2 before;
+	struct mallinfo2 after;
+	int i;
+
+	/* let the arena and the library set themselves up first */
+	free(malloc(BLOCK_SIZE));
+
+	before = mallinfo2();
+
+	for (i = 0; i < ROUNDS; i++) {
+		char *ptr = malloc(BLOCK_SIZE);
+
+		if (!ptr) {
+			fprintf(stderr, "free_release: malloc failed\n");
+			return 1;
+		}
+		memset(ptr, 0xa5, BLOCK_SIZE);
+		free(ptr);
+	}
+
+	after = mallinfo2();
+
+	if (after.uordblks > (before.uordblks + MAX_GROWTH)) {
+		fprintf(stderr, "free_release: %zu bytes still in use after "
+			"%d malloc/free\n", after.uordblks - before.uordblks,
+			ROUNDS);
+		return 1;
+	}
+
+	printf("free_release: ok\n");
+
+	return 0;
+}
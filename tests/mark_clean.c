@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file mark_clean.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that a block written again after its write is scrubbed.
+ *
+ * A block scrubbed by write() is marked clean and free() only reads it
+ * up to the first byte that is not 0. Data stored into the block after
+ * the write, at its start, in its middle or at its end, must still be
+ * scrubbed by free(). The freed block is read where it lies: a block
+ * allocated after it keeps it from being merged into the top of the
+ * heap and given back.
+ *
+ * A block marked clean and kept by the zero pool or the large mapping
+ * cache is handed out again unmarked: its next free() has nothing to
+ * skip.
+ *
+ * Usage: LD_PRELOAD=./clean.so tests/mark_clean
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "../clean_malloc.h"
+
+/* above the size clean_write marks, below the glibc mmap threshold */
+#define BLOCK_SIZE	(100 * 1024)
+/* a zero pool class and a size above the large mapping threshold */
+#define ZPOOL_SIZE	(128 * 1024)
+#define LARGE_SIZE	(2 * 1024 * 1024)
+
+static void (*get_stats) (struct clean_malloc_stats *stats);
+
+static int all_zero(const char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int check(const char *what, int fd, size_t offset, size_t len)
+{
+	struct clean_malloc_stats before;
+	struct clean_malloc_stats after;
+	char *buf = malloc(BLOCK_SIZE);
+	char *guard = malloc(64);
+	uintptr_t freed = (uintptr_t)buf;
+
+	if (!buf || !guard) {
+		perror("mark_clean");
+		return 1;
+	}
+
+	memset(buf, 'a', BLOCK_SIZE);
+	get_stats(&before);
+	if (write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE) {
+		perror("mark_clean: write");
+		return 1;
+	}
+	get_stats(&after);
+	if ((after.clean_marked == before.clean_marked) ||
+	    !all_zero(buf, BLOCK_SIZE)) {
+		fprintf(stderr, "mark_clean: %s, block not scrubbed and marked "
+			"by write()\n", what);
+		return 1;
+	}
+
+	memset(buf + offset, 'b', len);
+	free(buf);
+
+	/* the block is still mapped, only its header was reused */
+	if (!all_zero((const char *)freed, BLOCK_SIZE)) {
+		fprintf(stderr, "mark_clean: %s, not scrubbed by free()\n",
+			what);
+		return 1;
+	}
+
+	free(guard);
+
+	return 0;
+}
+
+static int check_reuse(const char *what, int fd, size_t size)
+{
+	struct clean_malloc_stats before;
+	struct clean_malloc_stats after;
+	char *buf = calloc(1, size);
+	char *again;
+
+	if (!buf || (write(fd, buf, size) != (ssize_t)size)) {
+		perror("mark_clean: reuse");
+		return 1;
+	}
+	free(buf);
+
+	/* the block just freed is the one handed out */
+	again = calloc(1, size);
+	if (again != buf) {
+		fprintf(stderr, "mark_clean: %s block not reused\n", what);
+		return 1;
+	}
+
+	memset(again + (size / 2), 'b', 100);
+	get_stats(&before);
+	free(again);
+	get_stats(&after);
+	if (after.clean_skipped_bytes != before.clean_skipped_bytes) {
+		fprintf(stderr, "mark_clean: %s block still marked clean when "
+			"reused\n", what);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int fd;
+
+	get_stats = (void (*)(struct clean_malloc_stats *))
+	    dlsym(RTLD_DEFAULT, "clean_malloc_get_stats");
+	fd = open("/dev/null", O_WRONLY);
+	if (!get_stats || (fd < 0)) {
+		fprintf(stderr, "mark_clean: needs clean.so preloaded\n");
+		return 1;
+	}
+
+	if (check("untouched", fd, 0, 0) ||
+	    check("written at the start", fd, 0, 100) ||
+	    check("written in the middle", fd, BLOCK_SIZE / 2, 100) ||
+	    check("written at the end", fd, BLOCK_SIZE - 1, 1) ||
+	    check("written all over", fd, 0, BLOCK_SIZE) ||
+	    check_reuse("zero pool", fd, ZPOOL_SIZE) ||
+	    check_reuse("large", fd, LARGE_SIZE)) {
+		return 1;
+	}
+
+	close(fd);
+
+	printf("mark_clean: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file nonblock_partial.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that a non-blocking socket write scrubs only what it sent.
+ *
+ * A non-blocking socket accepts what fits in its send buffer and returns
+ * a short count, then fails with EAGAIN once the buffer is full. The
+ * application retries the rest, so write(), send() and sendmsg() may
+ * only scrub the accepted prefix, walked across the iovecs, and must
+ * not touch anything when they fail.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/nonblock_partial
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define BUF_SIZE	(1024 * 1024)
+#define SEG_COUNT	8
+#define SEG_SIZE	(64 * 1024)
+#define SEG_STRIDE	(80 * 1024)
+#define SNDBUF_SIZE	(64 * 1024)
+
+static char *buf;
+static char expect[BUF_SIZE];
+static struct iovec iov[SEG_COUNT];
+
+static void setup(void)
+{
+	int i;
+
+	memset(buf, 'a', BUF_SIZE);
+	memset(expect, 'a', BUF_SIZE);
+
+	/* segments with a gap after each */
+	for (i = 0; i < SEG_COUNT; i++) {
+		iov[i].iov_base = buf + (i * SEG_STRIDE);
+		iov[i].iov_len = SEG_SIZE;
+	}
+}
+
+/* the first len bytes of the iovecs are expected to be scrubbed */
+static void expect_sent(const struct iovec *vec, int count, size_t len)
+{
+	int i;
+
+	for (i = 0; (i < count) && len; i++) {
+		size_t n = (vec[i].iov_len < len) ? vec[i].iov_len : len;
+
+		memset(expect + ((char *)vec[i].iov_base - buf), 0, n);
+		len -= n;
+	}
+}
+
+static int check(const char *what, ssize_t rc, size_t count)
+{
+	size_t i;
+
+	if ((rc <= 0) || ((size_t)rc >= count)) {
+		fprintf(stderr, "nonblock_partial: %s returned %zd (%s), "
+			"expected a short count\n", what, rc,
+			(rc < 0) ? strerror(errno) : "");
+		return 1;
+	}
+
+	for (i = 0; i < BUF_SIZE; i++) {
+		if (buf[i] != expect[i]) {
+			fprintf(stderr, "nonblock_partial: %s (%zd of %zu) "
+				"byte %zu is %s\n", what, rc, count, i,
+				buf[i] ? "not scrubbed" : "scrubbed");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_eagain(const char *what, ssize_t rc)
+{
+	size_t i;
+
+	if ((rc != -1) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+		fprintf(stderr, "nonblock_partial: %s returned %zd (%s), "
+			"expected EAGAIN\n", what, rc,
+			(rc < 0) ? strerror(errno) : "");
+		return 1;
+	}
+
+	for (i = 0; i < BUF_SIZE; i++) {
+		if (buf[i] != 'a') {
+			fprintf(stderr, "nonblock_partial: %s failed but "
+				"byte %zu is scrubbed\n", what, i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void drain(int fd)
+{
+	static char sink[64 * 1024];
+
+	while (read(fd, sink, sizeof(sink)) > 0) {
+	}
+}
+
+int main(void)
+{
+	struct msghdr msg;
+	size_t total = SEG_COUNT * SEG_SIZE;
+	int size = SNDBUF_SIZE;
+	int sv[2];
+	ssize_t rc;
+
+	buf = malloc(BUF_SIZE);
+	if (!buf || socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		perror("nonblock_partial");
+		return 1;
+	}
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = SEG_COUNT;
+
+	/* the send buffer takes part of the block */
+	setup();
+	rc = write(sv[0], buf, BUF_SIZE);
+	expect_sent(&(struct iovec){ buf, BUF_SIZE }, 1, (rc > 0) ? rc : 0);
+	if (check("write", rc, BUF_SIZE)) {
+		return 1;
+	}
+
+	/* fill what is left until the socket refuses more */
+	do {
+		setup();
+		rc = write(sv[0], buf, BUF_SIZE);
+	} while (rc > 0);
+
+	/* the buffer is full: nothing is sent and nothing is scrubbed */
+	setup();
+	if (check_eagain("write", write(sv[0], buf, BUF_SIZE)) ||
+	    check_eagain("send", send(sv[0], buf, BUF_SIZE, 0)) ||
+	    check_eagain("sendto", sendto(sv[0], buf, BUF_SIZE, 0, NULL, 0)) ||
+	    check_eagain("sendmsg", sendmsg(sv[0], &msg, 0))) {
+		return 1;
+	}
+
+	/* an empty buffer again, the accepted prefix spans the iovecs */
+	drain(sv[1]);
+	setup();
+	rc = sendmsg(sv[0], &msg, 0);
+	expect_sent(iov, SEG_COUNT, (rc > 0) ? rc : 0);
+	if (check("sendmsg", rc, total)) {
+		return 1;
+	}
+
+	drain(sv[1]);
+	setup();
+	rc = send(sv[0], buf, BUF_SIZE, 0);
+	expect_sent(&(struct iovec){ buf, BUF_SIZE }, 1, (rc > 0) ? rc : 0);
+	if (check("send", rc, BUF_SIZE)) {
+		return 1;
+	}
+
+	close(sv[0]);
+	close(sv[1]);
+	free(buf);
+
+	printf("nonblock_partial: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,310 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file pmr.cpp
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that the C++ resources scrub what they give back.
+ *
+ * Each block is filled, given back and checked where it is still
+ * readable: in the upstream resource (scrubbing_resource), in the
+ * aligned operator delete (clean::allocator), in the pool
+ * (scrubbing_pool_resource) and in the arena chunks after release()
+ * (scrubbing_monotonic_resource, clean_arena_reset() with and without
+ * CLEAN_ARENA_DONTNEED). Blocks from
+ * clean_arena_memalign() must honour the requested alignment.
+ *
+ * Usage: tests/pmr (linked with clean_pmr.so, run without preload)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "../clean_pmr.hpp"
+
+extern "C" {
+#include "../clean_malloc.h"
+}
+
+#define BLOCK_SIZE	4096
+
+static int failed;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok) {
+		fprintf(stderr, "pmr: %s\n", what);
+		failed = 1;
+	}
+}
+
+static bool all_equal(const void *p, char c, std::size_t len)
+{
+	const char *buf = static_cast<const char *>(p);
+
+	for (std::size_t i = 0; i < len; i++) {
+		if (buf[i] != c) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * clean::allocator gives its blocks back through the aligned operator
+ * delete, which sees them scrubbed before they reach the heap.
+ */
+#define ALIGNED_BLOCKS	16
+
+static struct {
+	void *p;
+	std::size_t n;
+} aligned_blocks[ALIGNED_BLOCKS];
+static int aligned_dirty;
+
+void *operator new(std::size_t n, std::align_val_t al)
+{
+	std::size_t align = static_cast<std::size_t>(al);
+	void *p = std::aligned_alloc(align, (n + align - 1) & ~(align - 1));
+	int i;
+
+	if (!p) {
+		throw std::bad_alloc();
+	}
+
+	for (i = 0; i < ALIGNED_BLOCKS; i++) {
+		if (!aligned_blocks[i].p) {
+			aligned_blocks[i].p = p;
+			aligned_blocks[i].n = n;
+			break;
+		}
+	}
+
+	return p;
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+	int i;
+
+	for (i = 0; p && (i < ALIGNED_BLOCKS); i++) {
+		if (aligned_blocks[i].p == p) {
+			if (!all_equal(p, 0, aligned_blocks[i].n)) {
+				aligned_dirty++;
+			}
+			aligned_blocks[i].p = nullptr;
+			break;
+		}
+	}
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t al) noexcept
+{
+	operator delete(p, al);
+}
+
+/*
+ * Upstream of scrubbing_resource, checks what it is given back.
+ */
+class checking_resource : public std::pmr::memory_resource {
+public:
+	int dirty = 0;
+
+protected:
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+		return std::pmr::new_delete_resource()->allocate(bytes,
+								 alignment);
+	}
+
+	void do_deallocate(void *p, std::size_t bytes,
+			   std::size_t alignment) override {
+		if (!all_equal(p, 0, bytes)) {
+			dirty++;
+		}
+		std::pmr::new_delete_resource()->deallocate(p, bytes,
+							    alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other)
+	    const noexcept override {
+		return this == &other;
+	}
+};
+
+static void test_resource(void)
+{
+	checking_resource upstream;
+	clean::scrubbing_resource res(&upstream);
+	std::size_t sizes[] = { 1, 17, 64, 1000, BLOCK_SIZE, 100000 };
+
+	for (std::size_t size : sizes) {
+		void *p = res.allocate(size, 16);
+
+		memset(p, 'a', size);
+		res.deallocate(p, size, 16);
+	}
+	check(!upstream.dirty, "scrubbing_resource gave back dirty blocks");
+
+	{
+		std::pmr::vector<char> v(&res);
+
+		v.assign(100000, 'a');
+		v.assign(200000, 'b');
+	}
+	check(!upstream.dirty, "pmr::vector storage given back dirty");
+}
+
+static void test_allocator(void)
+{
+	{
+		std::vector<char, clean::allocator<char>> v(BLOCK_SIZE, 'a');
+
+		v.resize(4 * BLOCK_SIZE, 'b');
+	}
+	check(!aligned_dirty, "clean::allocator gave back dirty blocks");
+}
+
+template <class Pool>
+static void test_pool(const char *name)
+{
+	Pool pool;
+	std::size_t sizes[] = { 8, 48, 256, 1024 };
+
+	for (std::size_t size : sizes) {
+		void *p = pool.allocate(size, 8);
+
+		memset(p, 'a', size);
+		pool.deallocate(p, size, 8);
+		/* the pool keeps the block mapped for its next allocation */
+		if (!all_equal(p, 0, size)) {
+			fprintf(stderr, "pmr: %s block of %zu not scrubbed\n",
+				name, size);
+			failed = 1;
+		}
+	}
+}
+
+static void test_monotonic(void)
+{
+	clean::scrubbing_monotonic_resource res(64 * 1024);
+	std::vector<std::pair<void *, std::size_t>> blocks;
+	std::size_t align;
+
+	for (align = 1; align <= BLOCK_SIZE; align *= 2) {
+		std::size_t size = 3 * align + 5;
+		void *p = res.allocate(size, align);
+
+		check(!(reinterpret_cast<uintptr_t>(p) & (align - 1)),
+		      "monotonic block misaligned");
+		memset(p, 'a', size);
+		blocks.push_back(std::make_pair(p, size));
+	}
+
+	/* more than a chunk, the arena grows */
+	for (int i = 0; i < 64; i++) {
+		void *p = res.allocate(BLOCK_SIZE, 16);
+
+		memset(p, 'a', BLOCK_SIZE);
+		blocks.push_back(std::make_pair(p, (std::size_t)BLOCK_SIZE));
+	}
+
+	res.release();
+	for (auto &block : blocks) {
+		if (!all_equal(block.first, 0, block.second)) {
+			check(false, "monotonic block not scrubbed by release()");
+			break;
+		}
+	}
+}
+
+static void test_arena(unsigned int flags)
+{
+	struct clean_arena *arena = clean_arena_create(0, flags);
+	std::vector<std::pair<void *, std::size_t>> blocks;
+	std::size_t align;
+
+	check(arena != nullptr, "clean_arena_create failed");
+	if (!arena) {
+		return;
+	}
+
+	for (align = 16; align <= 64 * 1024; align *= 2) {
+		/* an odd sized block first so the next one needs padding */
+		void *q = clean_arena_alloc(arena, 7);
+		void *p = clean_arena_memalign(arena, align, align + 1);
+
+		check(q && p, "clean_arena allocation failed");
+		if (!q || !p) {
+			break;
+		}
+		check(!(reinterpret_cast<uintptr_t>(q) & 15),
+		      "clean_arena_alloc block misaligned");
+		check(!(reinterpret_cast<uintptr_t>(p) & (align - 1)),
+		      "clean_arena_memalign block misaligned");
+		memset(q, 'a', 7);
+		memset(p, 'a', align + 1);
+		blocks.push_back(std::make_pair(q, (std::size_t)7));
+		blocks.push_back(std::make_pair(p, align + 1));
+	}
+
+	/* larger than a chunk */
+	void *big = clean_arena_memalign(arena, 4096, 3 * 1024 * 1024);
+
+	check(big && !(reinterpret_cast<uintptr_t>(big) & 4095),
+	      "clean_arena_memalign large block misaligned");
+	if (big) {
+		memset(big, 'a', 3 * 1024 * 1024);
+		blocks.push_back(std::make_pair(big,
+						(std::size_t)3 * 1024 * 1024));
+	}
+
+	clean_arena_reset(arena);
+	for (auto &block : blocks) {
+		if (!all_equal(block.first, 0, block.second)) {
+			check(false, "arena block not scrubbed by reset");
+			break;
+		}
+	}
+
+	clean_arena_destroy(arena);
+}
+
+int main(void)
+{
+	test_resource();
+	test_allocator();
+	test_pool<clean::scrubbing_pool_resource>("scrubbing_pool_resource");
+	test_pool<clean::unsynchronized_scrubbing_pool_resource>
+	    ("unsynchronized_scrubbing_pool_resource");
+	test_monotonic();
+	test_arena(0);
+	test_arena(CLEAN_ARENA_DONTNEED);
+
+	if (failed) {
+		return 1;
+	}
+
+	printf("pmr: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file sendmmsg_partial.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that sendmmsg() scrubs only the msg_len bytes sent.
+ *
+ * The messages are sent on a non blocking stream socketpair that is
+ * never read: the kernel fills the socket buffer, the last message it
+ * takes is usually sent in part and the following ones not at all. Only
+ * the first msg_len bytes of each message counted by the return value
+ * may be scrubbed, the gaps between the iovecs must be left alone, and
+ * once the socket is full a call failing with EAGAIN must not touch
+ * anything.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/sendmmsg_partial
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define MESSAGES	8
+#define SEGMENTS	2
+#define SEG_SIZE	(64 * 1024)
+#define SEG_STRIDE	(SEG_SIZE + 100)
+#define BUF_SIZE	(MESSAGES * SEGMENTS * SEG_STRIDE)
+
+static char *buf;
+static char *expect;
+static struct mmsghdr msgvec[MESSAGES];
+static struct iovec iov[MESSAGES * SEGMENTS];
+
+static void setup(void)
+{
+	int i;
+
+	memset(buf, 'a', BUF_SIZE);
+	memset(expect, 'a', BUF_SIZE);
+	memset(msgvec, 0, sizeof(msgvec));
+
+	for (i = 0; i < MESSAGES * SEGMENTS; i++) {
+		iov[i].iov_base = buf + (i * SEG_STRIDE);
+		iov[i].iov_len = SEG_SIZE;
+	}
+
+	for (i = 0; i < MESSAGES; i++) {
+		msgvec[i].msg_hdr.msg_iov = &iov[i * SEGMENTS];
+		msgvec[i].msg_hdr.msg_iovlen = SEGMENTS;
+	}
+}
+
+/**
+ * The bytes the kernel took, from the msg_len of the messages sent.
+ */
+static void expect_sent(int rc)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < rc; i++) {
+		size_t len = msgvec[i].msg_len;
+
+		for (j = 0; (j < SEGMENTS) && len; j++) {
+			struct iovec *seg = &msgvec[i].msg_hdr.msg_iov[j];
+			size_t n = (seg->iov_len < len) ? seg->iov_len : len;
+
+			memset(expect + ((char *)seg->iov_base - buf), 0, n);
+			len -= n;
+		}
+	}
+}
+
+static int check(const char *what)
+{
+	size_t i;
+
+	for (i = 0; i < BUF_SIZE; i++) {
+		if (buf[i] != expect[i]) {
+			fprintf(stderr, "sendmmsg_partial: %s byte %zu "
+				"(message %zu) is %s\n", what, i,
+				i / (SEGMENTS * SEG_STRIDE),
+				buf[i] ? "not scrubbed" : "scrubbed");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	int sv[2];
+	int rc;
+
+	buf = malloc(BUF_SIZE);
+	expect = malloc(BUF_SIZE);
+	if (!buf || !expect ||
+	    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) {
+		perror("sendmmsg_partial");
+		return 1;
+	}
+
+	setup();
+	rc = sendmmsg(sv[0], msgvec, MESSAGES, 0);
+	if (rc <= 0) {
+		perror("sendmmsg_partial: sendmmsg");
+		return 1;
+	}
+	if (rc == MESSAGES) {
+		fprintf(stderr, "sendmmsg_partial: all the messages were "
+			"sent, the socket buffer is too large\n");
+		return 1;
+	}
+	expect_sent(rc);
+	if (check("sendmmsg")) {
+		return 1;
+	}
+
+	/* the socket is full now */
+	setup();
+	rc = sendmmsg(sv[0], msgvec, MESSAGES, 0);
+	if ((rc != -1) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+		fprintf(stderr, "sendmmsg_partial: sendmmsg on a full socket "
+			"returned %d\n", rc);
+		return 1;
+	}
+	if (check("sendmmsg on a full socket")) {
+		return 1;
+	}
+
+	close(sv[0]);
+	close(sv[1]);
+	free(expect);
+	free(buf);
+
+	printf("sendmmsg_partial: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file stdio_flush.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that stdio stream buffers are scrubbed once flushed.
+ *
+ * Each stream is given a buffer of ours with setvbuf() so that its
+ * content can be checked. With file streams enabled, the buffer must be
+ * scrubbed by fflush(), fflush(NULL), fclose() and by setvbuf() when it
+ * is replaced, without losing what was written. Output not flushed yet
+ * and input not read yet must be left alone. A pipe stream is only
+ * scrubbed once enabled with clean_write_stdio_enable().
+ *
+ * Usage: CLEAN_WRITE_STDIO=file LD_PRELOAD=./clean_write.so \
+ *        tests/stdio_flush
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#define BUF_SIZE	4096
+#define TEXT		"a secret written through stdio\n"
+#define TEXT_LEN	(sizeof(TEXT) - 1)
+#define ROUNDS		8
+
+static int (*stdio_enable) (FILE *stream, int enable);
+
+static int check(const char *what, const char *buf, int scrubbed)
+{
+	size_t i;
+
+	for (i = 0; i < BUF_SIZE; i++) {
+		if (buf[i]) {
+			break;
+		}
+	}
+
+	if ((i == BUF_SIZE) != scrubbed) {
+		fprintf(stderr, "stdio_flush: %s buffer %s\n", what,
+			scrubbed ? "not scrubbed" : "scrubbed");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the stream wrote TEXT rounds times from the start of the file */
+static int check_file(const char *what, FILE *stream, int rounds)
+{
+	char line[TEXT_LEN + 1];
+	int fd = dup(fileno(stream));
+	FILE *in;
+	int i;
+
+	lseek(fd, 0, SEEK_SET);
+	in = fdopen(fd, "r");
+	for (i = 0; in && (i < rounds); i++) {
+		if (!fgets(line, sizeof(line), in) || strcmp(line, TEXT)) {
+			break;
+		}
+	}
+	if (in) {
+		fclose(in);
+	}
+
+	if (i != rounds) {
+		fprintf(stderr, "stdio_flush: %s lost line %d\n", what, i);
+		return 1;
+	}
+
+	return 0;
+}
+
+static FILE *open_file(char *buf)
+{
+	FILE *stream = tmpfile();
+
+	if (stream) {
+		setvbuf(stream, buf, _IOFBF, BUF_SIZE);
+	}
+
+	return stream;
+}
+
+int main(void)
+{
+	char *buf = malloc(BUF_SIZE);
+	char *other = malloc(BUF_SIZE);
+	char line[TEXT_LEN + 1];
+	FILE *stream;
+	int p[2];
+	int i;
+
+	stdio_enable = (int (*)(FILE *, int))
+	    dlsym(RTLD_DEFAULT, "clean_write_stdio_enable");
+	stream = open_file(buf);
+	if (!buf || !other || !stdio_enable || !stream || pipe(p)) {
+		fprintf(stderr, "stdio_flush: setup failed\n");
+		return 1;
+	}
+
+	/* pending output stays, flushed output is scrubbed */
+	for (i = 0; i < ROUNDS; i++) {
+		fputs(TEXT, stream);
+	}
+	if (check("pending", buf, 0) || fflush(stream) ||
+	    check("fflush", buf, 1) || check_file("fflush", stream, ROUNDS)) {
+		return 1;
+	}
+
+	fputs(TEXT, stream);
+	if (fflush(NULL) || check("fflush(NULL)", buf, 1) ||
+	    check_file("fflush(NULL)", stream, ROUNDS + 1)) {
+		return 1;
+	}
+
+	/* the old buffer is flushed and scrubbed before being replaced */
+	fputs(TEXT, stream);
+	if (setvbuf(stream, other, _IOFBF, BUF_SIZE) ||
+	    check("setvbuf", buf, 1) ||
+	    check_file("setvbuf", stream, ROUNDS + 2)) {
+		return 1;
+	}
+
+	/* unread input stays in the buffer across fflush(NULL) */
+	rewind(stream);
+	if (!fgets(line, sizeof(line), stream) || fflush(NULL) ||
+	    check("unread input", other, 0)) {
+		return 1;
+	}
+	for (i = 1; i < (ROUNDS + 2); i++) {
+		if (!fgets(line, sizeof(line), stream) || strcmp(line, TEXT)) {
+			fprintf(stderr, "stdio_flush: input line %d lost\n",
+				i);
+			return 1;
+		}
+	}
+
+	fseek(stream, 0, SEEK_END);
+	fputs(TEXT, stream);
+	if (fclose(stream) || check("fclose", other, 1)) {
+		return 1;
+	}
+
+	/* pipes are not enabled, until clean_write_stdio_enable() */
+	stream = fdopen(p[1], "w");
+	if (!stream || setvbuf(stream, buf, _IOFBF, BUF_SIZE)) {
+		fprintf(stderr, "stdio_flush: fdopen failed\n");
+		return 1;
+	}
+	fputs(TEXT, stream);
+	if (fflush(stream) || check("pipe", buf, 0)) {
+		return 1;
+	}
+	if (stdio_enable(stream, 1)) {
+		fprintf(stderr, "stdio_flush: clean_write_stdio_enable "
+			"failed\n");
+		return 1;
+	}
+	fputs(TEXT, stream);
+	if (fflush(stream) || check("enabled pipe", buf, 1)) {
+		return 1;
+	}
+	if ((read(p[0], line, TEXT_LEN) != TEXT_LEN) ||
+	    strncmp(line, TEXT, TEXT_LEN) ||
+	    (read(p[0], line, TEXT_LEN) != TEXT_LEN) ||
+	    strncmp(line, TEXT, TEXT_LEN)) {
+		fprintf(stderr, "stdio_flush: pipe data lost\n");
+		return 1;
+	}
+	fclose(stream);
+	close(p[0]);
+
+	free(other);
+	free(buf);
+
+	printf("stdio_flush: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file thread_stack.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that the stack of a thread is not scrubbed by write().
+ *
+ * The stack of a thread is an anonymous mapping like the heap. A buffer
+ * on it must be left intact after write(), before and after the region
+ * table is rebuilt, while a heap buffer is still scrubbed.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/thread_stack
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define BUF_SIZE	(16 * 1024)
+
+static int fd;
+
+static int all_equal(const char *buf, char c, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != c) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static const char *write_stack(void)
+{
+	char buf[BUF_SIZE];
+
+	memset(buf, 'x', BUF_SIZE);
+	if (write(fd, buf, BUF_SIZE) != BUF_SIZE) {
+		return "write failed";
+	}
+	if (!all_equal(buf, 'x', BUF_SIZE)) {
+		return "stack buffer scrubbed";
+	}
+
+	return NULL;
+}
+
+static void *worker(void *arg)
+{
+	const char *error;
+	char *heap;
+	char *page;
+
+	(void)arg;
+
+	error = write_stack();
+	if (error) {
+		return (void *)error;
+	}
+
+	/* mprotect() makes the next write rebuild the region table */
+	page = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((page == MAP_FAILED) || mprotect(page, 4096, PROT_READ)) {
+		return "mmap failed";
+	}
+
+	error = write_stack();
+	if (error) {
+		return (void *)error;
+	}
+
+	heap = malloc(BUF_SIZE);
+	memset(heap, 'x', BUF_SIZE);
+	if (write(fd, heap, BUF_SIZE) != BUF_SIZE) {
+		return "write failed";
+	}
+	if (!all_equal(heap, 0, BUF_SIZE)) {
+		return "heap buffer not scrubbed";
+	}
+	free(heap);
+
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t thread;
+	void *error;
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0) {
+		perror("thread_stack: /dev/null");
+		return 1;
+	}
+
+	if (pthread_create(&thread, NULL, worker, NULL) ||
+	    pthread_join(thread, &error)) {
+		fprintf(stderr, "thread_stack: pthread failed\n");
+		return 1;
+	}
+
+	if (error) {
+		fprintf(stderr, "thread_stack: %s\n", (char *)error);
+		return 1;
+	}
+
+	close(fd);
+
+	printf("thread_stack: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,231 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file uring_tracker.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check the io_uring tracker without a ring.
+ *
+ * The completions a ring would post are given to the tracker directly:
+ * - many requests in flight so that the table grows, completed in
+ *   another order with tombstones left behind,
+ * - a user_data tracked again while in flight,
+ * - a zerocopy send (IORING_CQE_F_MORE then IORING_CQE_F_NOTIF),
+ * - failed and unknown completions, a vectored request,
+ * - requests still in flight when the tracker is destroyed.
+ * Nothing may be scrubbed before clean_uring_scrub() and then exactly
+ * the bytes each completion reported.
+ *
+ * Usage: tests/uring_tracker (linked with clean_write.so)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+
+#include "../clean_uring.h"
+
+#define REQUESTS	1000
+#define BUF_SIZE	256
+
+static int failed;
+
+/**
+ * Check that buf holds len bytes of 0 followed by 'a' up to size.
+ */
+static void check(const char *what, int n, const char *buf, size_t len,
+		  size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (buf[i] != ((i < len) ? 0 : 'a')) {
+			fprintf(stderr, "uring_tracker: %s %d byte %zu is %s\n",
+				what, n, i, buf[i] ? "not scrubbed" :
+				"scrubbed");
+			failed = 1;
+			return;
+		}
+	}
+}
+
+static char *buffer(void)
+{
+	char *buf = malloc(BUF_SIZE);
+
+	if (!buf) {
+		perror("uring_tracker");
+		exit(1);
+	}
+	memset(buf, 'a', BUF_SIZE);
+
+	return buf;
+}
+
+static void test_resize(void)
+{
+	struct clean_uring *cu = clean_uring_create(1);
+	static char *bufs[REQUESTS];
+	int i;
+
+	for (i = 0; i < REQUESTS; i++) {
+		bufs[i] = buffer();
+		/* user_data values sharing their low bits */
+		if (clean_uring_track(cu, (uint64_t)i << 32, -1, bufs[i],
+				      BUF_SIZE)) {
+			fprintf(stderr, "uring_tracker: track %d failed\n", i);
+			failed = 1;
+			return;
+		}
+	}
+
+	/* the odd ones first, then new requests in their tombstones */
+	for (i = 1; i < REQUESTS; i += 2) {
+		clean_uring_complete(cu, (uint64_t)i << 32, i % BUF_SIZE, 0);
+	}
+	for (i = 0; i < REQUESTS; i++) {
+		check("before the scrub, request", i, bufs[i], 0, BUF_SIZE);
+	}
+	clean_uring_scrub(cu);
+	for (i = 1; i < REQUESTS; i += 2) {
+		check("odd request", i, bufs[i], i % BUF_SIZE, BUF_SIZE);
+		memset(bufs[i], 'a', BUF_SIZE);
+		clean_uring_track(cu, ((uint64_t)i << 32) + 1, -1, bufs[i],
+				  BUF_SIZE);
+	}
+
+	for (i = REQUESTS - 1; i >= 0; i--) {
+		uint64_t user_data = ((uint64_t)i << 32) + (i & 1);
+
+		clean_uring_complete(cu, user_data, BUF_SIZE - (i % 100), 0);
+	}
+	clean_uring_scrub(cu);
+	for (i = 0; i < REQUESTS; i++) {
+		check("request", i, bufs[i], BUF_SIZE - (i % 100), BUF_SIZE);
+		free(bufs[i]);
+	}
+
+	clean_uring_destroy(cu);
+}
+
+static void test_reuse(void)
+{
+	struct clean_uring *cu = clean_uring_create(8);
+	char *first = buffer();
+	char *second = buffer();
+
+	clean_uring_track(cu, 7, -1, first, BUF_SIZE);
+	/* the first request is still in flight, it is scrubbed whole */
+	clean_uring_track(cu, 7, -1, second, BUF_SIZE);
+	clean_uring_complete(cu, 7, 10, 0);
+	clean_uring_scrub(cu);
+	check("reused user_data, first request", 0, first, BUF_SIZE,
+	      BUF_SIZE);
+	check("reused user_data, second request", 0, second, 10, BUF_SIZE);
+
+	/* a second completion finds nothing */
+	memset(second, 'a', BUF_SIZE);
+	clean_uring_complete(cu, 7, BUF_SIZE, 0);
+	clean_uring_scrub(cu);
+	check("completed twice", 0, second, 0, BUF_SIZE);
+
+	clean_uring_destroy(cu);
+	free(second);
+	free(first);
+}
+
+static void test_zerocopy(void)
+{
+	struct clean_uring *cu = clean_uring_create(8);
+	char *buf = buffer();
+
+	clean_uring_track(cu, 9, -1, buf, BUF_SIZE);
+	clean_uring_complete(cu, 9, 100, IORING_CQE_F_MORE);
+	clean_uring_scrub(cu);
+	check("zerocopy send before its notification", 0, buf, 0, BUF_SIZE);
+
+	clean_uring_complete(cu, 9, 0, IORING_CQE_F_NOTIF);
+	clean_uring_scrub(cu);
+	check("zerocopy send", 0, buf, 100, BUF_SIZE);
+
+	clean_uring_destroy(cu);
+	free(buf);
+}
+
+static void test_others(void)
+{
+	struct clean_uring *cu = clean_uring_create(8);
+	char *failed_buf = buffer();
+	char *vec = buffer();
+	char *pending = buffer();
+	struct iovec iov[3] = {
+		{ vec, 50 },
+		{ vec + 100, 50 },
+		{ vec + 200, 50 },
+	};
+	size_t i;
+
+	clean_uring_track(cu, 1, -1, failed_buf, BUF_SIZE);
+	clean_uring_complete(cu, 1, -EAGAIN, 0);
+	clean_uring_complete(cu, 12345, BUF_SIZE, 0);
+
+	clean_uring_track_iov(cu, 2, -1, iov, 3);
+	/* the array may be gone by the completion */
+	memset(iov, 0, sizeof(iov));
+	clean_uring_complete(cu, 2, 75, 0);
+
+	clean_uring_scrub(cu);
+	check("failed request", 0, failed_buf, 0, BUF_SIZE);
+	for (i = 0; i < BUF_SIZE; i++) {
+		char c = ((i < 50) || ((i >= 100) && (i < 125))) ? 0 : 'a';
+
+		if (vec[i] != c) {
+			fprintf(stderr, "uring_tracker: vectored request byte "
+				"%zu is %s\n", i,
+				vec[i] ? "not scrubbed" : "scrubbed");
+			failed = 1;
+			break;
+		}
+	}
+
+	clean_uring_track(cu, 3, -1, pending, BUF_SIZE);
+	clean_uring_destroy(cu);
+	check("request in flight at destroy", 0, pending, BUF_SIZE,
+	      BUF_SIZE);
+
+	free(pending);
+	free(vec);
+	free(failed_buf);
+}
+
+int main(void)
+{
+	test_resize();
+	test_reuse();
+	test_zerocopy();
+	test_others();
+
+	if (failed) {
+		return 1;
+	}
+
+	printf("uring_tracker: ok\n");
+
+	return 0;
+}
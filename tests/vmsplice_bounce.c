@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file vmsplice_bounce.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that vmsplice() scrubs the buffer, not the pipe data.
+ *
+ * Buffers with partial pages at both ends, without any whole page, and
+ * spread over more iovecs than a batch are given to a pipe. When the
+ * call returns the buffers must read back as 0 and the bytes around
+ * them must be intact, while the data then read from the pipe must be
+ * what the buffers held.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/vmsplice_bounce
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#define PAGES		8
+#define PIPE_SIZE	(1024 * 1024)
+#define SEGMENTS	40
+
+static char *area;
+static size_t area_size;
+static int pipefd[2];
+
+/* never 0 so that a scrubbed byte stands out */
+static char pattern(size_t i)
+{
+	return (char)((i % 251) + 1);
+}
+
+static void fill(void)
+{
+	size_t i;
+
+	for (i = 0; i < area_size; i++) {
+		area[i] = pattern(i);
+	}
+}
+
+/**
+ * Send the iovecs, then check the area and the data read from the pipe.
+ */
+static int check(const char *what, struct iovec *iov, int iovcnt)
+{
+	char *data = malloc(area_size);
+	char *expect = malloc(area_size);
+	size_t total = 0;
+	size_t got = 0;
+	ssize_t rc;
+	size_t i;
+	int j;
+
+	if (!data || !expect) {
+		perror("vmsplice_bounce");
+		return 1;
+	}
+
+	fill();
+	for (i = 0; i < area_size; i++) {
+		expect[i] = pattern(i);
+	}
+	for (j = 0; j < iovcnt; j++) {
+		total += iov[j].iov_len;
+		memset(expect + ((char *)iov[j].iov_base - area), 0,
+		       iov[j].iov_len);
+	}
+
+	rc = vmsplice(pipefd[1], iov, iovcnt, 0);
+	if (rc != (ssize_t)total) {
+		fprintf(stderr, "vmsplice_bounce: %s sent %zd of %zu\n", what,
+			rc, total);
+		return 1;
+	}
+
+	for (i = 0; i < area_size; i++) {
+		if (area[i] != expect[i]) {
+			fprintf(stderr, "vmsplice_bounce: %s byte %zu of the "
+				"area is %s\n", what, i,
+				area[i] ? "not scrubbed" : "scrubbed");
+			return 1;
+		}
+	}
+
+	while (got < total) {
+		rc = read(pipefd[0], data + got, total - got);
+		if (rc <= 0) {
+			perror("vmsplice_bounce: read");
+			return 1;
+		}
+		got += rc;
+	}
+
+	for (j = 0, got = 0; j < iovcnt; j++) {
+		size_t off = (char *)iov[j].iov_base - area;
+
+		for (i = 0; i < iov[j].iov_len; i++, got++) {
+			if (data[got] != pattern(off + i)) {
+				fprintf(stderr, "vmsplice_bounce: %s byte %zu "
+					"read from the pipe is wrong\n", what,
+					got);
+				return 1;
+			}
+		}
+	}
+
+	free(expect);
+	free(data);
+
+	return 0;
+}
+
+int main(void)
+{
+	size_t page_size = getpagesize();
+	struct iovec iov[SEGMENTS];
+	int i;
+
+	area_size = PAGES * page_size;
+	area = mmap(NULL, area_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((area == MAP_FAILED) || pipe(pipefd) ||
+	    (fcntl(pipefd[1], F_SETPIPE_SZ, PIPE_SIZE) < 0)) {
+		perror("vmsplice_bounce");
+		return 1;
+	}
+
+	/* partial pages at both ends around whole pages */
+	iov[0].iov_base = area + 100;
+	iov[0].iov_len = 3 * page_size;
+	if (check("partial and whole pages", iov, 1)) {
+		return 1;
+	}
+
+	/* within a page, all bounced */
+	iov[0].iov_base = area + page_size + 10;
+	iov[0].iov_len = 1000;
+	iov[1].iov_base = area + 3 * page_size - 500;
+	iov[1].iov_len = 1000;
+	if (check("no whole page", iov, 2)) {
+		return 1;
+	}
+
+	/* more segments than a batch, with gaps */
+	for (i = 0; i < SEGMENTS; i++) {
+		iov[i].iov_base = area + 50 + i * (area_size / SEGMENTS);
+		iov[i].iov_len = area_size / SEGMENTS - 100;
+	}
+	if (check("many segments", iov, SEGMENTS)) {
+		return 1;
+	}
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+	munmap(area, area_size);
+
+	printf("vmsplice_bounce: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file writev_partial.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that a vectored write scrubs exactly the bytes written.
+ *
+ * The file size limit (RLIMIT_FSIZE) makes writev(), pwritev() and
+ * pwritev2() stop in the middle of an iovec. Only the bytes the call
+ * returned may be scrubbed: the rest of the iovecs and the gaps between
+ * them must be left alone, and a call that fails must not touch anything.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/writev_partial
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+#define BUF_SIZE	(3 * 4096)
+#define SEG_SIZE	3000
+#define SEG_STRIDE	4000
+#define FILE_LIMIT	5000
+
+static char *buf;
+static char expect[BUF_SIZE];
+static struct iovec iov[3];
+
+static void setup(void)
+{
+	int i;
+
+	memset(buf, 'a', BUF_SIZE);
+	memset(expect, 'a', BUF_SIZE);
+
+	/* three segments with a gap after each */
+	for (i = 0; i < 3; i++) {
+		iov[i].iov_base = buf + (i * SEG_STRIDE);
+		iov[i].iov_len = SEG_SIZE;
+	}
+}
+
+static int check(const char *what, ssize_t rc, ssize_t expected_rc)
+{
+	size_t i;
+
+	if (rc != expected_rc) {
+		fprintf(stderr, "writev_partial: %s returned %zd (%s), "
+			"expected %zd\n", what, rc,
+			(rc < 0) ? strerror(errno) : "", expected_rc);
+		return 1;
+	}
+
+	for (i = 0; i < BUF_SIZE; i++) {
+		if (buf[i] != expect[i]) {
+			fprintf(stderr, "writev_partial: %s byte %zu is %s\n",
+				what, i, buf[i] ? "not scrubbed" : "scrubbed");
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	struct rlimit limit;
+	char name[] = "/tmp/writev_partialXXXXXX";
+	int fd;
+
+	buf = malloc(BUF_SIZE);
+	fd = mkstemp(name);
+	if (!buf || (fd < 0)) {
+		perror("writev_partial");
+		return 1;
+	}
+	unlink(name);
+
+	/* writes beyond the limit fail with EFBIG instead of a signal */
+	signal(SIGXFSZ, SIG_IGN);
+	getrlimit(RLIMIT_FSIZE, &limit);
+	limit.rlim_cur = FILE_LIMIT;
+	if (setrlimit(RLIMIT_FSIZE, &limit)) {
+		perror("writev_partial: setrlimit");
+		return 1;
+	}
+
+	/* the whole first segment and the start of the second one */
+	setup();
+	memset(expect, 0, SEG_SIZE);
+	memset(expect + SEG_STRIDE, 0, FILE_LIMIT - SEG_SIZE);
+	if (check("writev", writev(fd, iov, 3), FILE_LIMIT)) {
+		return 1;
+	}
+
+	/* ending 1000 bytes into the second segment */
+	setup();
+	memset(expect, 0, SEG_SIZE);
+	memset(expect + SEG_STRIDE, 0, 1000);
+	if (check("pwritev", pwritev(fd, iov, 3, FILE_LIMIT - SEG_SIZE - 1000),
+		  SEG_SIZE + 1000)) {
+		return 1;
+	}
+
+	/* ending in the middle of the first segment */
+	setup();
+	memset(expect, 0, 2500);
+	if (check("pwritev2", pwritev2(fd, iov, 3, FILE_LIMIT - 2500, 0),
+		  2500)) {
+		return 1;
+	}
+
+	/* nothing can be written: nothing is scrubbed */
+	setup();
+	if (check("pwritev at the limit", pwritev(fd, iov, 3, FILE_LIMIT),
+		  -1)) {
+		return 1;
+	}
+
+	close(fd);
+	free(buf);
+
+	printf("writev_partial: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2026 Jean-Christophe DUBOIS.
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * @file zerocopy_close.c
+ * @author Jean-Christophe DUBOIS (jcd@tribudubois.net)
+ * @brief check that a zerocopy send is scrubbed when its socket is closed.
+ *
+ * A buffer sent with MSG_ZEROCOPY must be left alone when the call
+ * returns. The application closes the socket without reading the
+ * completion: the close must read it and scrub the buffer.
+ *
+ * Usage: LD_PRELOAD=./clean_write.so tests/zerocopy_close
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BUF_SIZE	(64 * 1024)
+
+static int all_equal(const char *buf, char c, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != c) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int main(void)
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	char *buf;
+	char *data;
+	size_t got = 0;
+	ssize_t rc;
+	int one = 1;
+	int listener;
+	int client;
+	int server;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	client = socket(AF_INET, SOCK_STREAM, 0);
+	if ((listener < 0) || (client < 0) ||
+	    bind(listener, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listener, 1) ||
+	    getsockname(listener, (struct sockaddr *)&addr, &addrlen)) {
+		perror("zerocopy_close: socket");
+		return 1;
+	}
+
+	if (setsockopt(client, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+		printf("zerocopy_close: skipped, no SO_ZEROCOPY\n");
+		return 0;
+	}
+
+	if (connect(client, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("zerocopy_close: connect");
+		return 1;
+	}
+	server = accept(listener, NULL, NULL);
+	if (server < 0) {
+		perror("zerocopy_close: accept");
+		return 1;
+	}
+
+	buf = malloc(BUF_SIZE);
+	data = malloc(BUF_SIZE);
+	memset(buf, 'a', BUF_SIZE);
+
+	rc = send(client, buf, BUF_SIZE, MSG_ZEROCOPY);
+	if (rc <= 0) {
+		perror("zerocopy_close: send");
+		return 1;
+	}
+	if (!all_equal(buf, 'a', rc)) {
+		fprintf(stderr, "zerocopy_close: buffer scrubbed while the "
+			"kernel may still send it\n");
+		return 1;
+	}
+
+	while (got < (size_t)rc) {
+		ssize_t n = read(server, data + got, BUF_SIZE - got);
+
+		if (n <= 0) {
+			perror("zerocopy_close: read");
+			return 1;
+		}
+		got += n;
+	}
+	if (!all_equal(data, 'a', got)) {
+		fprintf(stderr, "zerocopy_close: received data corrupted\n");
+		return 1;
+	}
+
+	/* the completion has not been read, close() must do it */
+	close(client);
+	if (!all_equal(buf, 0, rc)) {
+		fprintf(stderr, "zerocopy_close: buffer not scrubbed on close\n");
+		return 1;
+	}
+
+	close(server);
+	close(listener);
+	free(data);
+	free(buf);
+
+	printf("zerocopy_close: ok\n");
+
+	return 0;
+}